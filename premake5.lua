@@ -12,6 +12,16 @@ newoption {
 	description = "Enable LZHAM compression"
 }
 
+newoption {
+	trigger = "with-avx",
+	description = "Use AVX in the culling kernels (8 instances at once instead of 4 with SSE)"
+}
+
+newoption {
+	trigger = "with-profiler",
+	description = "Enable the hot-path profiler also in Release builds"
+}
+
 
 workspace "ViceCity_OneDrawCall"
 	configurations { "Debug", "Release" }
@@ -42,11 +52,18 @@ workspace "ViceCity_OneDrawCall"
 		files {
 			"source/config.h",
 			"source/main_baker.cpp",
+			"source/util_culling.cpp",
+			"source/util_meshlet.cpp",
+			"source/util_morton.cpp",
+			"source/util_occlusion.cpp",
+			"source/util_pvs.cpp",
+			"source/util_simplify.cpp",
+			"source/util_jobs.cpp",
 			"3rdparty/rwtools/src/*.cpp"
 		}
 
 		filter "system:not windows"
-			links { "lzhamcomp" }
+			links { "lzhamcomp", "pthread" }
 		filter { "system:windows", "Debug" }
 			links { "lzhamcomp_x86D" }
 		filter { "system:windows", "Release" }
@@ -72,7 +89,16 @@ workspace "ViceCity_OneDrawCall"
 			"source/config.h",
 			"source/main_renderer.cpp",
 			"source/app_renderer.cpp",
+			"source/util_camera_path.cpp",
+			"source/util_culling.cpp",
 			"source/util_gl.cpp",
+			"source/util_jobs.cpp",
+			"source/util_meshlet.cpp",
+			"source/util_occlusion.cpp",
+			"source/util_profiler.cpp",
+			"source/util_pvs.cpp",
+			"source/util_sort.cpp",
+			"source/util_stream.cpp",
 			"source/util_file.cpp"
 		}
 
@@ -81,12 +107,20 @@ workspace "ViceCity_OneDrawCall"
 			"SDL2main"
 		}
 
+		filter { "configurations:Debug" }
+			defines { "DEBUG", "ENABLE_PROFILER" }
+		filter { "options:with-profiler" }
+			defines { "ENABLE_PROFILER" }
+		filter { "options:with-avx" }
+			vectorextensions "AVX"
+
 		filter { "system:not windows" }
 			buildoptions { os.outputof("sdl2-config --cflags") }
 			links {
 				"lzhamdecomp",
 				"GL",
-				"GLEW"
+				"GLEW",
+				"pthread"
 			}
 		filter { "system:windows" }
 			includedirs {
@@ -106,6 +140,34 @@ workspace "ViceCity_OneDrawCall"
 			links { "lzhamdecomp_x86" }
 
 
+	-- CPU tests of the culling kernels and the baking code (no GPU or baked data needed)
+	project "vicetests"
+		kind "ConsoleApp"
+		language "C++"
+		location "build/%{prj.name}"
+
+		defines {
+			"GLM_FORCE_RADIANS",
+		}
+		files {
+			"source/tests.h",
+			"source/main_tests.cpp",
+			"source/test_culling.cpp",
+			"source/test_occlusion.cpp",
+			"source/test_meshlet.cpp",
+			"source/test_morton.cpp",
+			"source/test_simplify.cpp",
+			"source/util_culling.cpp",
+			"source/util_occlusion.cpp",
+			"source/util_meshlet.cpp",
+			"source/util_morton.cpp",
+			"source/util_simplify.cpp"
+		}
+
+		filter { "options:with-avx" }
+			vectorextensions "AVX"
+
+
 	-- Endianness converter tailored for big-endian platforms like PS3
 	project "ps3rebake"
 		kind "ConsoleApp"
@@ -3,22 +3,41 @@
  */
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <vector>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp> // glm::perspective
+#include <glm/gtc/constants.hpp> // glm::two_pi
 #include <glm/gtc/type_ptr.hpp>
 #include <map>
 
 #include <SDL.h>
 #include <GL/glew.h>
 #include "shaders.h"
-
-
-extern void start_opengl_log(const char *filename);
+#include "camera_path.h"
+#include "profiler.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "pvs.h"
+#include "meshlet.h"
+#include "sort.h"
+#include "stream.h"
+#include "jobs.h"
+
+
+extern void start_opengl_log(const char *filename, GLenum min_severity);
+extern void set_opengl_log_mode(bool enabled, bool synchronous);
+extern void ignore_opengl_messages(const GLuint *ids, GLsizei count);
+extern uint64_t opengl_log_message_count();
 extern void stop_opengl_log();
 extern GLuint compile_glsl_source(GLenum type, char *source);
 extern GLuint link_glsl(GLuint vertex_shader, GLuint fragment_shader);
+extern GLuint link_glsl_compute(GLuint compute_shader);
+int render(void); // Autotuning renders frames before the main loop starts
 
 
 #if defined(BAKED_WITH_LZHAM)
@@ -55,6 +74,18 @@ size_t fread_compressed(void *data, size_t element_size, size_t element_count, F
 #endif
 }
 
+//! Counterpart of fread_compressed() which skips the data block without reading it.
+void fskip_compressed(size_t element_size, size_t element_count, FILE *file)
+{
+#if defined(BAKE_WITH_LZHAM)
+	uLong compressed_bytes = 0;
+	fread(&compressed_bytes, sizeof(uLong), 1, file);
+	fseek(file, compressed_bytes, SEEK_CUR);
+#else
+	fseek(file, element_size * element_count, SEEK_CUR);
+#endif
+}
+
 #define GL_CHECK() do { \
 	GLenum err; \
 	while (GL_NO_ERROR != (err = glGetError())) { \
@@ -70,7 +101,9 @@ enum VertexAttribute {
 	ATTRIB_TEXCOORD = 3,
 
 	// Instanced attributes
-	ATTRIB_WORLD_MATRIX = 12
+	ATTRIB_WORLD_MATRIX = 4, //!< Rows 4 to 7, used only when matrices don't fit into a buffer texture
+	ATTRIB_INSTANCE_INDEX = 12,
+	ATTRIB_DRAW_DATA = 13 //!< Advances once per draw call (PATH_DRAW_ATTRIBUTE only)
 };
 
 
@@ -105,36 +138,423 @@ struct MultiDrawCall {
 	uint32_t indirect_count;
 	GLuint tex_array;
 	GLuint texid_offset;
+	uint32_t alpha_class;
 };
 std::vector<MultiDrawCall> multicalls;
 
+//! Header of a single texture array stored in "texturebuckets.blob".
+struct TextureSplit {
+	GLenum format;
+	GLsizei width, height, layers;
+	GLsizei size; //!< size = layers * tex.dataSizes[0]
+	long data_offset; //!< Position of the (possibly compressed) texel data within the blob
+};
+std::vector<TextureSplit> texture_splits;
+
+//! Texel data of a texture array split read by the streaming thread, waiting for upload.
+struct StreamedSplit {
+	uint32_t split; //!< Index into `texture_splits` (texture array name minus one)
+	uint8_t *texels;
+};
+
+//! Range of instances drawn by all material splits of a model, which are culled together.
+struct InstanceGroup {
+	uint32_t base_instance;
+	uint32_t count;
+};
+
+//! Box around all instances of a spatial cluster, as read from "clusters.blob".
+//! The baker splits placements of every model into clusters, so each cluster is an instance group.
+struct InstanceCluster {
+	glm::vec3 lo;
+	uint32_t base_instance;
+	glm::vec3 hi;
+	uint32_t count;
+};
+
+//! Range of draw calls (in indirect buffer order) that sample given texture array.
+struct DrawRange {
+	uint32_t first;
+	uint32_t count;
+};
+
+//! How draw calls are drawn, as classified by the baker from alpha of their textures (the order of passes).
+enum AlphaClass {
+	ALPHA_OPAQUE,      //!< Without blending and alpha test
+	ALPHA_CUTOUT,      //!< Alpha-tested, without blending
+	ALPHA_TRANSLUCENT, //!< Blended over everything else, without writing depth
+	NUM_ALPHA_CLASSES
+};
+
+//! Available strategies of submitting draw calls (from the fastest one).
+enum RenderPath {
+	PATH_MDI_BINDLESS,   //!< 1 call to glMultiDrawElementsIndirect() with bindless textures
+	PATH_MDI_PER_ARRAY,  //!< 1 call to glMultiDrawElementsIndirect() per texture array
+	PATH_DRAW_ATTRIBUTE, //!< Like above without draw parameters (or 1 draw call per DrawCall without it), texture layers come from an instanced attribute
+	PATH_INSTANCED,      //!< 1 instanced draw call per DrawCall
+	NUM_RENDER_PATHS
+};
+
+static const char *RENDER_PATH_NAMES[NUM_RENDER_PATHS] = {
+	"mdi_bindless",
+	"mdi_per_array",
+	"draw_attribute",
+	"instanced"
+};
+
+//! Measurements of a single benchmarked frame.
+struct BenchSample {
+	float cpu_ms; //!< Time spent in render() before swapping buffers
+	float gpu_ms; //!< Time measured with GL_TIME_ELAPSED query
+	float frame_ms; //!< Time between two consecutive buffer swaps
+	uint32_t draw_calls;
+	uint32_t culled_instances;
+	uint32_t occluded_instances;
+	uint32_t occluded_triangles;
+	uint32_t triangles; //!< Drawn triangles (counted by CPU culling only)
+	float latency_ms; //!< Time from handing the frame packet over to render() until the buffer swap
+};
+
+//! How are OpenGL debug messages reported.
+enum GlLogMode {
+	GL_LOG_OFF,   //!< GL_DEBUG_OUTPUT disabled
+	GL_LOG_ASYNC, //!< Driver reports messages whenever it wants (default)
+	GL_LOG_SYNC,  //!< Messages are reported from within the offending call (GL_DEBUG_OUTPUT_SYNCHRONOUS)
+	NUM_GL_LOG_MODES
+};
+
+static const char *GL_LOG_MODE_NAMES[NUM_GL_LOG_MODES] = {
+	"off",
+	"async",
+	"sync"
+};
+
+//! Single benchmarked configuration.
+struct BenchRun {
+	RenderPath path;
+	GlLogMode log_mode;
+	bool depth_prepass;
+	bool visibility_buffer;
+	std::vector<BenchSample> results;
+	uint64_t gl_messages; //!< Debug messages received during the measured frames
+};
+
+
+
+// --AATTTT TTTTTTTT SSSSSSSS ---IIIII IIIIIIII CCCCCCCC CCCCCCCC MMMMMMMM (alpha class, bucket, slice, model, cluster, split)
+static const uint64_t TEXTURE_ARRAY_MASK = 0x3FFFFF0000000000ULL; //!< Bits of sort keys selecting the texture array (batches never mix alpha classes)
+static const int ALPHA_CLASS_SHIFT = 60;
+static const float ALPHA_CUTOFF = 0.5f; //!< Alpha test of the cutout pass
 
+//! @returns Alpha class stored in the sort key of a draw call.
+static inline
+AlphaClass get_alpha_class(uint64_t key)
+{
+	return (AlphaClass)std::min((uint32_t)(key >> ALPHA_CLASS_SHIFT) & 0x3, (uint32_t)ALPHA_TRANSLUCENT);
+}
 
 static const glm::vec3 LOOK_DIR(0.0f, -1.0f, 0.0f);
 static GLint MAX_ARRAY_TEXTURE_LAYERS = 2048;
 static GLuint baked_buffers[4];
 static GLuint baked_vao;
-static GLuint instance_buffer;
+static GLuint instance_buffer; //!< Matrices of all instances (accessed through `instance_texture`)
+static GLuint instance_texture;
+static bool matrix_attributes = false; //!< `instance_buffer` holds a copy of all matrices per region of `visible_buffer` instead
 static GLuint indirect_buffer;
-static GLuint texid_buffer;
+static GLuint texid_buffer; //!< Texture indices of all draw calls (indexed with gl_DrawIDARB of the single MDI)
+static GLuint texid_array_buffer; //!< Same as above, but every texture array starts at aligned offset
 static GLuint texhandle_buffer;
+static GLuint draw_data_buffer; //!< First slot of visible instances and texture layer of every draw call (for PATH_DRAW_ATTRIBUTE)
+static GLuint visible_texture; //!< `visible_buffer` fetched by PATH_DRAW_ATTRIBUTE, where the base instance selects draw data
 static SDL_Window *wnd;
+static SDL_GLContext gl_context; //!< Current on the thread calling render()
 static int draw_call_counter = 0;
 static int window_width = 800, window_height = 600;
 static glm::mat4 proj_mat;
 static glm::mat4 view_proj;
+static glm::vec3 view_pos; //!< Position of the camera `view_proj` was built for
 static glm::vec3 cam_pos(256.0f, -1265.0f, 15.0f);
 static float cam_yaw = 0.0f;
 static float cam_pitch = 0.0f;
+static float cam_fovy = 45.0f;
+static float cam_near = 1.0f;
+static float cam_far = 4000.0f;
 static GLint WORLD_MATRIX_UNIFORM;
 static GLint VIEW_PROJ_MATRIX_UNIFORM;
 static GLint TEXTURE_0_UNIFORM;
 static GLint TEMP_TEX_IDX_UNIFORM;
+static GLint SLOT_OFFSET_UNIFORM;
+static GLint DRAW_ID_OFFSET_UNIFORM;
+static GLint ALPHA_CUTOFF_UNIFORM;
 std::vector<GLuint> textures;
 static std::vector<GLuint64> tex_handles; // bindless texture handles
 static bool has_multi_draw_indirect;
 static bool has_bindless_textures;
 static bool has_shader_draw_params;
+static bool has_buffer_storage;
+static bool has_compute_shader;
+static bool has_indirect_parameters;
+static bool supported_paths[NUM_RENDER_PATHS];
+static GLuint programs[NUM_RENDER_PATHS];
+
+// Depth pre-pass (--depth-prepass) draws opaque instances into the depth buffer first, so the color pass
+// (with GL_EQUAL depth test) shades every pixel once. Whether it pays off depends on the GPU, see --bench-prepass.
+static bool depth_prepass = false;
+static bool bench_prepass = false; //!< Benchmark every render path with and without the depth pre-pass
+static GLuint depth_programs[NUM_RENDER_PATHS]; //!< Transforming vertices exactly like `programs`
+static GLint DEPTH_VIEW_PROJ_MATRIX_UNIFORM[NUM_RENDER_PATHS], DEPTH_SLOT_OFFSET_UNIFORM[NUM_RENDER_PATHS];
+static RenderPath render_path = PATH_INSTANCED;
+
+// Visibility buffer (--visibility-buffer, paths with draw parameters only): opaque instances write just IDs of
+// the instance and the triangle covering every pixel, then a full-screen pass fetches vertices of those triangles
+// and samples every texture once. Alpha-tested and translucent instances are drawn forward on top of it.
+static bool visibility_buffer = false;
+static bool bench_visibility = false; //!< Benchmark paths with draw parameters with and without the visibility buffer
+static uint32_t vis_primitive_bits = 0; //!< Low bits of the packed draw and triangle ID taken by the triangle
+static GLuint vis_program;
+static GLuint resolve_programs[2]; //!< Per texture array and with bindless textures
+static GLint VIS_VIEW_PROJ_MATRIX_UNIFORM, VIS_DRAW_ID_OFFSET_UNIFORM, VIS_PRIMITIVE_BITS_UNIFORM;
+static GLint RESOLVE_VIEW_PROJ_MATRIX_UNIFORM[2], RESOLVE_PRIMITIVE_BITS_UNIFORM[2], RESOLVE_TEXTURE_ARRAY_UNIFORM;
+static GLuint vis_draw_buffer; //!< First index, base vertex and texture array of every draw call
+static GLuint vis_fbo;
+static GLuint vis_color;
+static GLuint vis_ids; //!< Instance index + 1 (zero for the background) and draw ID << `vis_primitive_bits` | triangle
+static GLuint vis_depth;
+static int vis_width = 0, vis_height = 0;
+
+// Vertex pulling (--vertex-pulling, paths with draw parameters only): vertex shaders fetch positions, colors and UVs
+// from storage buffers by gl_VertexID. ClipFromObject of every instance slot is computed once per frame by a compute
+// shader, so vertices are transformed by a single matrix fetched with gl_BaseInstanceARB + gl_InstanceID.
+static bool vertex_pulling = false;
+static GLuint clip_program;
+static GLint CLIP_VIEW_PROJ_MATRIX_UNIFORM, CLIP_SLOT_OFFSET_UNIFORM, CLIP_NUM_SLOTS_UNIFORM;
+static GLuint clip_buffer; //!< ClipFromObject of every slot of `visible_buffer` (all regions)
+static bool gpu_clip_slots = false; //!< GPU culling lists the visible slots and counts them for an indirect dispatch
+static GLuint clip_slots_buffer; //!< Visible slots listed by GPU culling (or all slots, if it can't list them)
+static StreamBuffer clip_slot_stream; //!< Visible slots listed after CPU culling (one region per frame)
+
+// Multithreaded view-frustum culling (disable with --no-culling)
+// Every frame writes compacted indices of visible instances and patched indirect commands into its own region
+// of `visible_buffer` and `indirect_buffer`, so the CPU never overwrites data used by frames in flight.
+static const uint32_t CULL_FRAMES = STREAM_FRAMES; //!< Number of buffer regions (frames in flight)
+static const uint32_t CULL_BATCH_SIZE = 64; //!< Instance groups culled by a single job
+static bool culling = true;
+static float cull_distance = CULL_DISTANCE_UNLIMITED;
+static uint32_t num_instances = 0;
+static BoundingSpheres instance_bounds;
+static std::vector<InstanceGroup> instance_groups;
+static std::vector<uint32_t> draw_instance_group; //!< Instance group of every draw call (in indirect buffer order)
+static std::vector<uint32_t> group_visible; //!< Number of visible instances of every group in the current frame
+static bool cluster_culling = true; //!< Test boxes of instance groups before their instances (disable with --no-cluster-culling)
+static std::vector<InstanceCluster> group_clusters; //!< Box of every instance group
+static std::vector<uint32_t> group_triangles; //!< Triangles drawn per instance of every group
+static std::vector<DrawElementsIndirectCommand> draw_commands; //!< Unculled indirect commands of all draw calls
+static GLuint visible_buffer; //!< Instance indices fed to the ATTRIB_INSTANCE_INDEX
+static StreamBuffer visible_stream; //!< Regions of `visible_buffer` written by CPU culling (one per frame)
+static StreamBuffer command_stream; //!< Regions of `indirect_buffer` patched by CPU culling
+static uint32_t cull_region = 0; //!< Region of the per-frame buffers used by the current frame
+static uint32_t culled_instances = 0; //!< Culled in the last frame
+
+// Software occlusion culling (--software-occlusion) rasterizes baked occluders on the CPU,
+// so it works with the CPU culling and all render paths (including the GL 3.3 fallback).
+static const uint32_t OCCLUSION_BUFFER_WIDTH = 256;
+static const uint32_t OCCLUSION_BUFFER_HEIGHT = 128;
+static const uint32_t OCCLUDER_BATCH_SIZE = 1024; //!< Occluder vertices transformed by a single job
+static bool software_occlusion = false;
+static Occluders occluders;
+static OcclusionBuffer occlusion_buffer;
+static std::vector<uint32_t> group_occluded; //!< Number of occluded instances of every group in the current frame
+static std::vector<uint32_t> cull_scratch; //!< Frustum culling results, before the PVS and occlusion tests
+
+// Precomputed potentially visible sets (--pvs) hide instances, which can't be seen from the view cell
+// containing the camera. It's meant for fixed camera paths within the grid baked to "pvs.blob".
+static bool pvs_culling = false;
+static PotentiallyVisibleSets pvs;
+static uint32_t pvs_cell = PVS_NO_CELL; //!< Cell decoded to `pvs_visible`
+static std::vector<uint8_t> pvs_visible; //!< 1 for every instance potentially visible from `pvs_cell`
+
+// Meshlet statistics (--meshlet-stats) test meshlets ("meshlets.blob") of every visible instance against the frustum
+// and their normal cones, which tells how much culling of meshlets would save over a camera path.
+static bool meshlet_stats = false;
+static std::vector<Meshlet> meshlets;
+static std::vector<MeshletRange> meshlet_ranges;
+static std::vector<glm::mat4> instance_matrices; //!< Kept on the CPU only for the statistics
+static std::vector<std::vector<uint32_t> > group_meshlets; //!< Meshlets of all draw calls of every instance group
+static std::vector<glm::uvec3> group_meshlet_counts; //!< Tested, outside of the frustum and back-facing meshlets in the current frame
+static uint64_t meshlets_tested = 0, meshlets_outside = 0, meshlets_backfacing = 0;
+static uint32_t meshlet_frames = 0;
+
+// Visible translucent instances are sorted back-to-front by their view-space depth every frame (with CPU culling,
+// disable with --no-translucent-sort). Each of them gets its own indirect command, so the order holds across draw calls.
+static const uint32_t SORT_BENCH_RUNS = 100; //!< Sorts of random keys measured by --bench-sort
+static bool sort_translucent = true;
+static uint32_t bench_sort_count = 0; //!< Keys sorted by the microbenchmark (--bench-sort <n>), zero to render
+static std::vector<uint8_t> group_translucent; //!< 1 for instance groups drawn by translucent draw calls
+static std::vector<uint32_t> translucent_visible; //!< Readable copy of visible instances of those groups (mapped memory is write-only)
+static std::vector<DrawCall> translucent_draw_calls; //!< The translucent range of ordered draw calls
+static std::vector<glm::uvec2> translucent_items; //!< Translucent draw call and slot in `visible_buffer` of every sorted instance
+static std::vector<uint32_t> translucent_keys, translucent_order;
+static RadixSortScratch translucent_scratch;
+static std::vector<DrawElementsIndirectCommand> sorted_commands; //!< One per visible translucent instance (the farthest first)
+static std::vector<GLuint> sorted_texture_indices;
+static std::vector<GLuint64> sorted_texture_handles;
+static std::vector<glm::uvec2> sorted_draw_data; //!< Slot and texture layer of every sorted command (PATH_DRAW_ATTRIBUTE only)
+static std::vector<MultiDrawCall> sorted_batches; //!< Runs of sorted commands sampling the same texture array (texid_offset is the first command)
+static StreamBuffer sorted_stream;
+static GLintptr sorted_offsets[4]; //!< Indirect commands, texture indices, texture handles and draw data of `sorted_commands` in `sorted_stream`
+
+// Distance-based LOD selection draws either the high-detail model of an entry or its LOD model ("lods.blob"),
+// depending on the distance of the instance from the camera. Whole groups out of their range are skipped using cluster boxes.
+// Without culling, or with --no-lod, only the high-detail models are drawn (without their draw distances).
+static bool lod_models = true;
+static float lod_scale = 1.0f; //!< Multiplies all draw distances (--lod-scale)
+static std::vector<glm::vec2> lod_ranges; //!< Range of camera distances every instance is drawn at (empty if unknown)
+static std::vector<glm::vec4> group_lod_ranges; //!< Widest (x, y) and narrowest (z, w) range of instances of every group
+static uint32_t drawn_triangles = 0; //!< Drawn in the last frame
+
+//! How many instances of a group are within their LOD range.
+enum LodCoverage {
+	LOD_NONE,
+	LOD_SOME,
+	LOD_ALL
+};
+
+// GPU-driven culling (--gpu-culling) does the same as above in compute shaders.
+// Visible instances and commands go to the first region of `visible_buffer` and `indirect_buffer`,
+// non-empty commands are also compacted for glMultiDrawElementsIndirectCountARB().
+// Occlusion culling (--occlusion-culling) splits the frame into two phases, each with its own region and compacted buffers.
+static const GLintptr GPU_CULL_HEADER_SIZE = 32; //!< Draw count, visible and occluded instances, occluded triangles and the clip matrix dispatch precede compacted commands
+static const float VERIFY_CULL_EPSILON = 0.01f; //!< GPU may disagree with CPU about spheres this close to the frustum
+static const uint32_t CULL_PHASES = 2;
+static bool gpu_culling = false;
+static bool verify_gpu_culling = false; //!< Compare results with CPU every frame (--verify-gpu-culling)
+static GLuint cull_program, emit_program;
+static GLint CULL_PLANES_UNIFORM, CULL_CAMERA_UNIFORM, CULL_CLIP_FROM_WORLD_UNIFORM, CULL_PHASE_UNIFORM, CULL_VISIBLE_OFFSET_UNIFORM;
+static GLint EMIT_NUM_COMMANDS_UNIFORM, EMIT_COMMAND_OFFSET_UNIFORM, EMIT_INSTANCE_OFFSET_UNIFORM, EMIT_NUM_COMPACTED_UNIFORM;
+static GLuint bounds_buffer;
+static GLuint groups_buffer;
+static GLuint group_visible_buffer;
+static GLuint lod_ranges_buffer;
+static GLuint command_template_buffer;
+static GLuint compact_indirect_buffers[CULL_PHASES];
+static GLuint compact_texid_buffers[CULL_PHASES];
+static GLuint compact_texhandle_buffers[CULL_PHASES];
+static GLuint gpu_cull_stats[CULL_FRAMES]; //!< Copies of the headers of both phases, which are read a few frames later
+static uint32_t gpu_cull_frame = 0;
+static uint32_t gpu_cull_verified = 0; //!< Number of frames that matched the CPU reference
+static BoundingSpheres verify_bounds_inner, verify_bounds_outer;
+
+//! What does a single run of the culling compute shaders draw (has to match PHASE_* of the shader).
+enum CullPhase {
+	CULL_FRUSTUM,            //!< Everything inside the frustum (without occlusion culling)
+	CULL_PREVIOUSLY_VISIBLE, //!< Occlusion culling, phase 1: what was visible in the last frame
+	CULL_OCCLUSION           //!< Occlusion culling, phase 2: what passes the test against the depth pyramid and wasn't drawn yet
+};
+
+// Hierarchical-Z occlusion culling renders into an offscreen framebuffer, so we can reduce its depth
+static bool occlusion_culling = false;
+static GLuint pyramid_program;
+static GLint PYRAMID_SOURCE_LEVEL_UNIFORM, PYRAMID_SCALE_UNIFORM;
+static GLuint last_visible_buffer; //!< 1 for every instance, that passed the occlusion test in the last frame
+static GLuint group_triangles_buffer; //!< Triangles per instance of every instance group
+static GLuint occlusion_fbo;
+static GLuint occlusion_color;
+static GLuint occlusion_depth;
+static GLuint depth_pyramid;
+static int occlusion_width = 0, occlusion_height = 0, pyramid_levels = 0;
+static uint32_t occluded_instances = 0; //!< Occluded in the last frame (read a few frames later, like `culled_instances`)
+static uint32_t occluded_triangles = 0;
+
+// Headless benchmark (--bench)
+static const uint32_t BENCH_WARMUP_FRAMES = 30;
+static const uint32_t BENCH_QUERY_LATENCY = 4; //!< How many frames we wait before reading timer queries
+static const char *bench_camera_file = NULL;
+static const char *bench_output_file = "bench.json";
+static uint32_t bench_frames = 0; //!< Number of measured frames per render path (0 = length of camera path)
+static bool headless = false;
+static CameraPath camera_path; //!< Camera path used by both the benchmark and the replay
+static bool bench_gl_log = false; //!< Measure every render path with each GlLogMode
+static const char *bench_screenshot_prefix = NULL; //!< Last frame of every benchmark run is saved into <prefix><run>.ppm
+static std::vector<BenchRun> bench_runs;
+static size_t bench_run_idx = 0;
+static uint32_t bench_frame = 0; //!< Frame within the current benchmark run (including warmup)
+static std::vector<BenchSample> bench_samples; //!< Samples of the current benchmark run
+static uint64_t bench_gl_messages;
+static GLuint bench_queries[BENCH_QUERY_LATENCY];
+static uint64_t bench_render_start;
+static uint64_t bench_prev_swap;
+
+// Render path selection (--path) and autotuning at startup (--autotune): every supported path renders
+// a full turn of the camera at its start position and the fastest one is cached for the GPU and driver
+static const uint32_t AUTOTUNE_WARMUP_FRAMES = 8;
+static const uint32_t AUTOTUNE_FRAMES = 32; //!< Measured frames per render path
+static const char *AUTOTUNE_CACHE_FILE = "autotune.cache";
+static RenderPath forced_path = NUM_RENDER_PATHS; //!< NUM_RENDER_PATHS to take the fastest one
+static bool autotune = false;
+static GLuint autotune_query; //!< Measures render() of the current autotuning frame (zero otherwise)
+
+// Camera path recording (--record) and replay (--replay)
+static const char *record_camera_file = NULL;
+static const char *replay_camera_file = NULL;
+static CameraPath recorded_camera;
+static uint64_t replay_time = 0;
+
+// Frame packets handed from the simulation (fixed_update() and post_update()) to render(). With --render-thread,
+// render() runs on its own thread owning the OpenGL context and the framework alternates between the packets,
+// so the simulation of the next frame overlaps rendering of the current one (but never gets further ahead).
+struct FramePacket {
+	CameraKey camera;
+	int width, height; //!< Window size seen by the simulation
+	uint64_t delta_micros; //!< Passed to the last post_update()
+	uint64_t publish_time; //!< SDL performance counter, when the simulation handed the packet over
+};
+bool threaded_rendering = false; //!< Read by the framework once initialize() returns
+static FramePacket frame_packets[2];
+static FramePacket sim_frame; //!< Written by the simulation, copied into a packet by publish_frame()
+static uint64_t frame_publish_time; //!< Of the packet being rendered
+
+// OpenGL debug context and log (always in Debug builds, --gl-debug otherwise)
+#if defined(DEBUG)
+static bool gl_debug = true;
+#else
+static bool gl_debug = false;
+#endif
+static GlLogMode gl_log_mode = GL_LOG_ASYNC;
+static GLenum gl_log_severity = GL_DEBUG_SEVERITY_LOW; //!< Notifications are mostly spam
+static std::vector<GLuint> gl_log_ignored;
+
+// Profiler (F8 prints statistics, F9 or --trace writes Chrome trace)
+static const char *trace_file = NULL;
+static const char *PROFILED_ZONES[] = { "fixed_update", "post_update", "render", "swap", "gpu:clear", "gpu:draw", "gpu:draw_batch", "gpu:swap" };
+
+// Progressive texture streaming (--progressive)
+static const size_t MAX_PENDING_SPLITS = 4; //!< How many decompressed splits may wait for upload
+static const size_t STREAM_UPLOAD_BUDGET = 16 * 1024 * 1024; //!< Bytes uploaded per frame (at least one split)
+static const float STREAM_NEAR_DISTANCE = 50.0f; //!< Instances closer than this have the same priority
+static bool progressive_textures = false;
+static GLuint placeholder_texture;
+static GLuint64 placeholder_handle;
+static std::vector<bool> texture_resident; //!< Indexed by texture array name (the first is reserved)
+static std::vector<DrawRange> texture_draw_ranges; //!< Indexed by texture array name (the first is reserved) and alpha class
+static DrawRange alpha_draw_ranges[NUM_ALPHA_CLASSES]; //!< Draw calls of every pass (contiguous, thanks to sort keys)
+static std::vector<glm::vec3> instance_positions;
+static std::vector<uint32_t> stream_order;
+static std::thread stream_thread;
+static std::mutex stream_mutex;
+static std::condition_variable stream_cv;
+static std::vector<StreamedSplit> streamed_splits; //!< Guarded by `stream_mutex`
+static bool stream_cancelled = false; //!< Guarded by `stream_mutex`
+static uint32_t splits_uploaded = 0;
+static uint64_t stream_start_time = 0;
+
+
+//! Returns the texture array to bind in place of given one.
+//! While textures are still streaming in, all missing arrays are replaced with a placeholder.
+static inline
+GLuint resident_texture(GLuint tex_array)
+{
+	return texture_resident[tex_array] ? tex_array : placeholder_texture;
+}
 
 
 int init_renderer()
@@ -144,15 +564,31 @@ int init_renderer()
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG | SDL_GL_CONTEXT_DEBUG_FLAG);
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG | (gl_debug ? SDL_GL_CONTEXT_DEBUG_FLAG : 0));
+	if (headless) {
+		// The "offscreen" video driver renders into an EGL pbuffer, so it works even without a display (Mesa llvmpipe)
+		SDL_QuitSubSystem(SDL_INIT_VIDEO);
+		SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+		if (0 != SDL_InitSubSystem(SDL_INIT_VIDEO)) {
+			fprintf(stderr, "ERROR: Cannot initialize offscreen video driver: %s\n", SDL_GetError());
+			return 1;
+		}
+	}
+	const Uint32 window_flags = bench_camera_file ? SDL_WINDOW_HIDDEN : (SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE);
 	wnd = SDL_CreateWindow("mani3xis' Vice City Renderer", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
-		window_width, window_height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL);
+		window_width, window_height, window_flags | SDL_WINDOW_OPENGL);
+	if (!wnd) {
+		fprintf(stderr, "ERROR: Cannot create window: %s\n", SDL_GetError());
+		return 1;
+	}
 
 	// Create and intialize OpenGL context
-	SDL_GLContext ctx = SDL_GL_CreateContext(wnd);
+	gl_context = SDL_GL_CreateContext(wnd);
 	glewExperimental = GL_TRUE; // HACK: This has to be `true`, otherwise NVIDIA crashes on glGenVertexArrays() in core profile
 	glewInit();
-	if (-1 == SDL_GL_SetSwapInterval(-1))
+	if (bench_camera_file)
+		SDL_GL_SetSwapInterval(0); // We don't want to measure VSync
+	else if (-1 == SDL_GL_SetSwapInterval(-1))
 		SDL_GL_SetSwapInterval(1);
 
 	// Print which supported OpenGL extensions are available, since their presence specifies which code path will be taken.
@@ -161,24 +597,229 @@ int init_renderer()
 	has_multi_draw_indirect = SDL_GL_ExtensionSupported("GL_ARB_multi_draw_indirect");
 	has_bindless_textures = SDL_GL_ExtensionSupported("GL_ARB_bindless_texture");
 	has_shader_draw_params = SDL_GL_ExtensionSupported("GL_ARB_shader_draw_parameters");
+	has_buffer_storage = SDL_GL_ExtensionSupported("GL_ARB_buffer_storage");
+	has_compute_shader = SDL_GL_ExtensionSupported("GL_ARB_compute_shader") && SDL_GL_ExtensionSupported("GL_ARB_shader_storage_buffer_object");
+	has_indirect_parameters = SDL_GL_ExtensionSupported("GL_ARB_indirect_parameters");
 	printf("GL_ARB_multi_draw_indirect: %s\n", has_multi_draw_indirect ? "yes" : "no");
 	printf("GL_ARB_bindless_texture: %s\n", has_bindless_textures ? "yes" : "no");
 	printf("GL_ARB_shader_draw_parameters: %s\n", has_shader_draw_params ? "yes" : "no");
+	printf("GL_ARB_buffer_storage: %s\n", has_buffer_storage ? "yes" : "no");
+	printf("GL_ARB_compute_shader: %s\n", has_compute_shader ? "yes" : "no");
+	printf("GL_ARB_indirect_parameters: %s\n", has_indirect_parameters ? "yes" : "no");
+	supported_paths[PATH_MDI_BINDLESS] = has_multi_draw_indirect && has_shader_draw_params && has_bindless_textures;
+	supported_paths[PATH_MDI_PER_ARRAY] = has_multi_draw_indirect && has_shader_draw_params;
+	supported_paths[PATH_INSTANCED] = true; // PATH_DRAW_ATTRIBUTE depends on GPU culling (see load_content())
 
 	// glewInit() generates OpenGL errors, so we have to manually clean the error flags
 	while (GL_NO_ERROR != glGetError()) {};
 
-	start_opengl_log("opengl-log.csv");
+	if (gl_debug) {
+		start_opengl_log("opengl-log.csv", gl_log_severity);
+		if (!gl_log_ignored.empty())
+			ignore_opengl_messages(gl_log_ignored.data(), gl_log_ignored.size());
+		set_opengl_log_mode(GL_LOG_OFF != gl_log_mode, GL_LOG_SYNC == gl_log_mode);
+	}
 	glClearColor(0.341f, 0.498f, 0.738f, 1.0f); // HACK: Clear to sky blue (which I sampled from a random photograph)
 	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); // Only the translucent pass enables blending
 	GL_CHECK();
 
 	return 0;
 }
 
 
+//! Read headers of all texture array splits stored in given blob (skipping the texel data).
+static
+bool read_texture_splits(const char *filename, uint32_t *biggest_split_buffer)
+{
+	FILE *blob = fopen(filename, "rb");
+	if (!blob)
+		return false;
+
+	uint32_t num_texture_splits = 0;
+	fread(&num_texture_splits, sizeof(uint32_t), 1, blob);
+	fread(biggest_split_buffer, sizeof(uint32_t), 1, blob);
+
+	texture_splits.resize(num_texture_splits);
+	for (TextureSplit &split : texture_splits) {
+		fread(&split.format, sizeof(GLenum), 1, blob);
+		fread(&split.width, sizeof(GLsizei), 1, blob);
+		fread(&split.height, sizeof(GLsizei), 1, blob);
+		fread(&split.layers, sizeof(GLsizei), 1, blob);
+		fread(&split.size, sizeof(GLsizei), 1, blob);
+		split.data_offset = ftell(blob);
+		fskip_compressed(1, split.size, blob);
+	}
+
+	fclose(blob);
+	return true;
+}
+
+
+//! Upload texels of given split into its texture array (and make it resident when bindless).
+static
+void upload_texture_split(uint32_t i, const uint8_t *texels)
+{
+	const TextureSplit &split = texture_splits[i];
+	glBindTexture(GL_TEXTURE_2D_ARRAY, textures[i]);
+	if (GL_RGBA == split.format || GL_RGB == split.format)
+		// Handle not compressed textures
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, split.format, split.width, split.height, split.layers, 0, split.format, GL_UNSIGNED_BYTE, texels);
+	else
+		// Handle (DXT) compressed textures
+		glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, split.format, split.width, split.height, split.layers, 0, split.size, texels);
+
+	//glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	GL_CHECK();
+
+	if (has_bindless_textures) {
+		GLuint64 bindless_handle = glGetTextureHandleARB(textures[i]);
+		glMakeTextureHandleResidentARB(bindless_handle);
+		tex_handles[i + 1] = bindless_handle;
+		GL_CHECK();
+	}
+	texture_resident[i + 1] = true;
+}
+
+
+//! Create 1x1 texture array which is sampled instead of arrays that are not loaded yet.
+static
+void create_placeholder_texture()
+{
+	const uint8_t GREY[4] = { 128, 128, 128, 255 };
+	glGenTextures(1, &placeholder_texture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, placeholder_texture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, GREY);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	if (has_bindless_textures) {
+		placeholder_handle = glGetTextureHandleARB(placeholder_texture);
+		glMakeTextureHandleResidentARB(placeholder_handle);
+	}
+	GL_CHECK();
+}
+
+
+//! Do shaders of given render path index per-draw data with gl_DrawIDARB?
+static
+bool uses_draw_parameters(RenderPath path)
+{
+	return PATH_MDI_BINDLESS == path || PATH_MDI_PER_ARRAY == path;
+}
+
+
+//! Compile and link shaders used by given render path.
+//! @param fragment_shader GLSL_FRAGMENT_SHADER, or the one of the depth pre-pass or the visibility buffer
+//! @param pulling Fetch vertices from storage buffers (requires draw parameters of a multi-draw indirect path)
+static
+GLuint build_program(RenderPath path, const char *fragment_shader, bool pulling)
+{
+	const int draw_parameters = uses_draw_parameters(path);
+	const int draw_attribute = (PATH_DRAW_ATTRIBUTE == path);
+	const int bindless = (PATH_MDI_BINDLESS == path);
+
+	// Prepare shader sources
+	const size_t SOURCE_LENGTH = 8192;
+	char vertex_source[SOURCE_LENGTH];
+	char fragment_source[SOURCE_LENGTH];
+	int vertex_source_length = snprintf(vertex_source, SOURCE_LENGTH, "%s\n"
+		"#define HAS_SHADER_DRAW_PARAMETERS %i\n"
+		"#define HAS_DRAW_ATTRIBUTE %i\n"
+		"#define HAS_BINDLESS_TEXTURE %i\n"
+		"#define HAS_VERTEX_PULLING %i\n"
+		"#define HAS_MATRIX_ATTRIBUTES %i\n"
+		"%s\n",
+		GLSL_PREAMBLE, draw_parameters, draw_attribute, bindless, pulling ? 1 : 0, matrix_attributes ? 1 : 0, GLSL_VERTEX_SHADER);
+	int fragment_source_length = snprintf(fragment_source, SOURCE_LENGTH, "%s\n"
+		"#define HAS_SHADER_DRAW_PARAMETERS %i\n"
+		"#define HAS_DRAW_ATTRIBUTE %i\n"
+		"#define HAS_BINDLESS_TEXTURE %i\n"
+		"%s\n",
+		GLSL_PREAMBLE, draw_parameters, draw_attribute, bindless, fragment_shader);
+	assert(0 < vertex_source_length && vertex_source_length < SOURCE_LENGTH);
+	assert(0 < fragment_source_length && fragment_source_length < SOURCE_LENGTH);
+
+	// Load shaders and build program
+	GLuint vsh = compile_glsl_source(GL_VERTEX_SHADER, vertex_source);
+	GLuint fsh = compile_glsl_source(GL_FRAGMENT_SHADER, fragment_source);
+	GLuint program = (vsh && fsh) ? link_glsl(vsh, fsh) : 0;
+	glDeleteShader(fsh);
+	glDeleteShader(vsh);
+	return program;
+}
+
+
+//! Compile and link the full-screen pass shading the visibility buffer.
+static
+GLuint build_resolve_program(bool bindless)
+{
+	const size_t SOURCE_LENGTH = 8192;
+	char vertex_source[SOURCE_LENGTH];
+	char fragment_source[SOURCE_LENGTH];
+	int vertex_source_length = snprintf(vertex_source, SOURCE_LENGTH, "#version 430 core\n%s\n", GLSL_FULLSCREEN_VERTEX_SHADER);
+	int fragment_source_length = snprintf(fragment_source, SOURCE_LENGTH, "#version 430 core\n"
+		"#define HAS_BINDLESS_TEXTURE %i\n"
+		"%s\n",
+		bindless ? 1 : 0, GLSL_RESOLVE_FRAGMENT_SHADER);
+	assert(0 < vertex_source_length && vertex_source_length < SOURCE_LENGTH);
+	assert(0 < fragment_source_length && fragment_source_length < SOURCE_LENGTH);
+
+	GLuint vsh = compile_glsl_source(GL_VERTEX_SHADER, vertex_source);
+	GLuint fsh = compile_glsl_source(GL_FRAGMENT_SHADER, fragment_source);
+	GLuint program = (vsh && fsh) ? link_glsl(vsh, fsh) : 0;
+	glDeleteShader(fsh);
+	glDeleteShader(vsh);
+	return program;
+}
+
+
+static
+GLuint build_compute_program(const char *source, const char *defines)
+{
+	const size_t SOURCE_LENGTH = 16384;
+	char compute_source[SOURCE_LENGTH];
+	int compute_source_length = snprintf(compute_source, SOURCE_LENGTH, "#version 430 core\n"
+		"#define HAS_BINDLESS_TEXTURE %i\n"
+		"%s"
+		"%s\n",
+		has_bindless_textures ? 1 : 0, defines, source);
+	assert(0 < compute_source_length && compute_source_length < SOURCE_LENGTH);
+
+	GLuint csh = compile_glsl_source(GL_COMPUTE_SHADER, compute_source);
+	GLuint program = csh ? link_glsl_compute(csh) : 0;
+	glDeleteShader(csh);
+	return program;
+}
+
+
+//! Switch to given render path, which has to be supported.
+static
+void select_render_path(RenderPath path)
+{
+	render_path = path;
+	const GLuint program = programs[path];
+	glUseProgram(program);
+	WORLD_MATRIX_UNIFORM = glGetUniformLocation(program, "u_WorldFromObject");
+	VIEW_PROJ_MATRIX_UNIFORM = glGetUniformLocation(program, "u_ClipFromWorld");
+	TEXTURE_0_UNIFORM = glGetUniformLocation(program, "u_Texture0");
+	TEMP_TEX_IDX_UNIFORM = glGetUniformLocation(program, "u_TempTextureIdx");
+	DRAW_ID_OFFSET_UNIFORM = glGetUniformLocation(program, "u_DrawIDOffset");
+	ALPHA_CUTOFF_UNIFORM = glGetUniformLocation(program, "u_AlphaCutoff");
+	SLOT_OFFSET_UNIFORM = glGetUniformLocation(program, "u_SlotOffset");
+
+	// Draw data of PATH_DRAW_ATTRIBUTE replaces instance indices (the base instance of its commands is out of their range)
+	if (PATH_DRAW_ATTRIBUTE == path) {
+		glDisableVertexAttribArray(ATTRIB_INSTANCE_INDEX);
+		glEnableVertexAttribArray(ATTRIB_DRAW_DATA);
+	} else {
+		glDisableVertexAttribArray(ATTRIB_DRAW_DATA);
+		glEnableVertexAttribArray(ATTRIB_INSTANCE_INDEX);
+	}
+}
+
+
 int load_content()
 {
 	FILE *blob = NULL;
@@ -186,55 +827,40 @@ int load_content()
 	size_t bytes_read = 0;
 
 	{ // Load texture array splits from "texturebuckets.blob"
-		blob = fopen("texturebuckets.blob", "rb");
-		uint32_t num_texture_splits = 0;
+		PROFILE_ZONE("load_textures");
 		uint32_t biggest_split_buffer = 0;
-		fread(&num_texture_splits, sizeof(uint32_t), 1, blob);
-		fread(&biggest_split_buffer, sizeof(uint32_t), 1, blob);
-
-		textures.reserve(num_texture_splits);
-		tex_handles.push_back(0); // The first is reserved!
-
-		buffer = (uint8_t *)malloc(biggest_split_buffer);
-		for (uint32_t i = 0; i < num_texture_splits; ++i) {
-			GLuint texture = 0;
-			glGenTextures(1, &texture);
-			glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
-			textures.push_back(texture);
-
-			GLenum format = GL_INVALID_ENUM;
-			GLsizei width = 0, height = 0, layers = 0, size = 0;
-			fread(&format, sizeof(GLenum), 1, blob);
-			fread(&width, sizeof(GLsizei), 1, blob);
-			fread(&height, sizeof(GLsizei), 1, blob);
-			fread(&layers, sizeof(GLsizei), 1, blob);
-			fread(&size, sizeof(GLsizei), 1, blob); // size = layers * tex.dataSizes[0]
-			fread_compressed(buffer, 1, size, blob);
-
-			if (GL_RGBA == format || GL_RGB == format)
-				// Handle not compressed textures
-				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, width, height, layers, 0, format, GL_UNSIGNED_BYTE, buffer);
-			else
-				// Handle (DXT) compressed textures
-				glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, width, height, layers, 0, size, buffer);
-
-			//glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
-			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			GL_CHECK();
-
-			if (has_bindless_textures) {
-				GLuint64 bindless_handle = glGetTextureHandleARB(texture);
-				glMakeTextureHandleResidentARB(bindless_handle);
-				tex_handles.push_back(bindless_handle);
-				GL_CHECK();
+		if (!read_texture_splits("texturebuckets.blob", &biggest_split_buffer)) {
+			fprintf(stderr, "ERROR: Failed to read 'texturebuckets.blob'\n");
+			return 1;
+		}
+
+		// Draw calls refer to texture arrays by their names, so all of them are generated up-front (1..N)
+		textures.resize(texture_splits.size());
+		glGenTextures(textures.size(), textures.data());
+		tex_handles.assign(texture_splits.size() + 1, 0); // The first is reserved!
+		texture_resident.assign(texture_splits.size() + 1, false);
+
+		if (progressive_textures) {
+			// Every texture array samples the placeholder until its texels are streamed in.
+			// The actual loading starts in start_texture_streaming(), once we know what is around the camera.
+			create_placeholder_texture();
+			for (size_t i = 1; i < tex_handles.size(); ++i)
+				tex_handles[i] = placeholder_handle;
+		} else {
+			blob = fopen("texturebuckets.blob", "rb");
+			buffer = (uint8_t *)malloc(biggest_split_buffer);
+			for (uint32_t i = 0; i < texture_splits.size(); ++i) {
+				fseek(blob, texture_splits[i].data_offset, SEEK_SET);
+				fread_compressed(buffer, 1, texture_splits[i].size, blob);
+				upload_texture_split(i, buffer);
 			}
+			free(buffer);
+			fclose(blob);
 		}
-		free(buffer);
-		fclose(blob);
 	}
 
 	{ // Load VBOs and IBO from "meshes.blob"
+		PROFILE_ZONE("load_meshes");
 		glGenVertexArrays(1, &baked_vao);
 		glBindVertexArray(baked_vao);
 		glGenBuffers(4, baked_buffers);
@@ -246,10 +872,11 @@ int load_content()
 		fread(&num_indices, sizeof(uint32_t), 1, blob);
 		buffer = (uint8_t *)malloc(std::max(num_indices * sizeof(uint16_t), num_vertices * sizeof(glm::vec4)));
 
-		// Upload indices
+		// Upload indices (padded to whole 32-bit words, which are read by the visibility buffer resolve)
 		fread_compressed(buffer, sizeof(uint16_t), num_indices, blob);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, baked_buffers[0]);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * num_indices, buffer, GL_STATIC_DRAW);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * ((num_indices + 1) & ~1u), NULL, GL_STATIC_DRAW);
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(uint16_t) * num_indices, buffer);
 
 		// Upload vertex positions
 		fread_compressed(buffer, sizeof(glm::vec3), num_vertices, blob);
@@ -278,29 +905,237 @@ int load_content()
 	}
 
 	{ // Load instance matrices from "instances.blob"
+		PROFILE_ZONE("load_instances");
 		blob = fopen("instances.blob", "rb");
-		uint32_t num_instances = 0;
 		fread(&num_instances, sizeof(uint32_t), 1, blob);
 
 		buffer = (uint8_t *)calloc(sizeof(glm::mat4), num_instances);
 		bytes_read = fread_compressed(buffer, sizeof(glm::mat4), num_instances, blob);
 		fclose(blob);
 
-		// Upload instance buffer to OpenGL
+		// Keep instance positions around for prioritizing texture streaming
+		const glm::mat4 *xforms = (const glm::mat4 *)buffer;
+		instance_positions.resize(num_instances);
+		for (uint32_t i = 0; i < num_instances; ++i)
+			instance_positions[i] = glm::vec3(xforms[i][3]);
+		if (meshlet_stats)
+			instance_matrices.assign(xforms, xforms + num_instances);
+
+		// Upload instance buffer to OpenGL. Shaders fetch the matrices by index, so it's bound as buffer texture.
+		GLint max_texels = 0;
+		glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
 		glGenBuffers(1, &instance_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
-		glBufferData(GL_ARRAY_BUFFER, bytes_read, buffer, GL_STATIC_DRAW);
-		for (int row = 0; row < 4; ++row) {
-			glVertexAttribPointer(ATTRIB_WORLD_MATRIX + row, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(sizeof(glm::vec4) * row));
-			glVertexAttribDivisor(ATTRIB_WORLD_MATRIX + row, 1);
-			glEnableVertexAttribArray(ATTRIB_WORLD_MATRIX + row);
+		if ((int64_t)4 * num_instances > max_texels) {
+			// Drivers may support as few as 65536 texels, then the matrices are instanced attributes like before culling.
+			// Without culling every region of visible instances is the identity, so each region gets its copy of the matrices.
+			fprintf(stderr, "WARNING: %u instances don't fit into buffer texture (max %i texels), drawing them without culling\n", num_instances, max_texels);
+			matrix_attributes = true;
+			culling = false;
+			glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+			glBufferData(GL_ARRAY_BUFFER, CULL_FRAMES * sizeof(glm::mat4) * num_instances, NULL, GL_STATIC_DRAW);
+			for (uint32_t region = 0; region < CULL_FRAMES; ++region)
+				glBufferSubData(GL_ARRAY_BUFFER, region * sizeof(glm::mat4) * num_instances, sizeof(glm::mat4) * num_instances, buffer);
+			for (int row = 0; row < 4; ++row) {
+				glVertexAttribPointer(ATTRIB_WORLD_MATRIX + row, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(sizeof(glm::vec4) * row));
+				glVertexAttribDivisor(ATTRIB_WORLD_MATRIX + row, 1);
+				glEnableVertexAttribArray(ATTRIB_WORLD_MATRIX + row);
+			}
+		} else {
+			glBindBuffer(GL_TEXTURE_BUFFER, instance_buffer);
+			glBufferData(GL_TEXTURE_BUFFER, bytes_read, buffer, GL_STATIC_DRAW);
+			glGenTextures(1, &instance_texture);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_BUFFER, instance_texture);
+			glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, instance_buffer);
+			glActiveTexture(GL_TEXTURE0);
 		}
-
 		free(buffer);
+
+		// Visible instance indices. Until (or without) culling, every region holds all instances.
+		if (!create_stream_buffer(visible_stream, sizeof(uint32_t) * num_instances, sizeof(uint32_t), has_buffer_storage)) {
+			fprintf(stderr, "ERROR: Cannot map buffer of visible instances\n");
+			return 3;
+		}
+		visible_buffer = visible_stream.buffer;
+		std::vector<uint32_t> identity(CULL_FRAMES * num_instances);
+		for (uint32_t i = 0; i < identity.size(); ++i)
+			identity[i] = i % num_instances;
+		glBindBuffer(GL_ARRAY_BUFFER, visible_buffer);
+		if (visible_stream.mapped)
+			memcpy(visible_stream.mapped, identity.data(), sizeof(uint32_t) * identity.size());
+		else
+			glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(uint32_t) * identity.size(), identity.data());
+		glVertexAttribIPointer(ATTRIB_INSTANCE_INDEX, 1, GL_UNSIGNED_INT, sizeof(uint32_t), NULL);
+		glVertexAttribDivisor(ATTRIB_INSTANCE_INDEX, 1);
+		glEnableVertexAttribArray(ATTRIB_INSTANCE_INDEX);
+		GL_CHECK();
+	}
+
+	if (culling) { // Load bounding spheres of instances from "bounds.blob" (optional)
+		PROFILE_ZONE("load_bounds");
+		blob = fopen("bounds.blob", "rb");
+		uint32_t num_bounds = 0;
+		if (blob)
+			fread(&num_bounds, sizeof(uint32_t), 1, blob);
+
+		if (num_bounds == num_instances) {
+			std::vector<glm::vec4> bounds(num_bounds);
+			fread_compressed(bounds.data(), sizeof(glm::vec4), num_bounds, blob);
+			assign_bounding_spheres(instance_bounds, bounds.data(), num_bounds);
+		} else {
+			fprintf(stderr, "WARNING: 'bounds.blob' is missing or doesn't match instances, culling is disabled\n");
+			culling = false;
+		}
+		if (blob)
+			fclose(blob);
+	}
+
+	// Whether GPU culling falls back to CPU culling is known by now, which settles the supported render paths
+	if (gpu_culling && (!culling || !supported_paths[PATH_MDI_PER_ARRAY] || !has_compute_shader)) {
+		fprintf(stderr, "WARNING: GPU culling requires bounds, multi-draw indirect and compute shaders, using CPU culling\n");
+		gpu_culling = occlusion_culling = false;
+	}
+	supported_paths[PATH_DRAW_ATTRIBUTE] = !gpu_culling && !matrix_attributes; // Commands emitted by the GPU point at slots of instances, not draw data
+	if (supported_paths[PATH_DRAW_ATTRIBUTE]) {
+		glGenTextures(1, &visible_texture);
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_BUFFER, visible_texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, visible_buffer);
+		glActiveTexture(GL_TEXTURE0);
 		GL_CHECK();
 	}
 
+	if (culling && cluster_culling) { // Load boxes of spatial clusters from "clusters.blob" (optional)
+		PROFILE_ZONE("load_clusters");
+		blob = fopen("clusters.blob", "rb");
+		uint32_t num_clusters = 0;
+		if (blob)
+			fread(&num_clusters, sizeof(uint32_t), 1, blob);
+
+		if (0 < num_clusters) {
+			group_clusters.resize(num_clusters);
+			fread_compressed(group_clusters.data(), sizeof(InstanceCluster), num_clusters, blob);
+		} else {
+			fprintf(stderr, "WARNING: 'clusters.blob' is missing, cluster culling is disabled\n");
+			cluster_culling = false;
+		}
+		if (blob)
+			fclose(blob);
+	} else {
+		cluster_culling = false;
+	}
+
+	if (culling && software_occlusion) { // Load low-poly occluders from "occluders.blob" (optional)
+		PROFILE_ZONE("load_occluders");
+		blob = fopen("occluders.blob", "rb");
+		uint32_t num_vertices = 0, num_triangles = 0;
+		if (blob) {
+			fread(&num_vertices, sizeof(uint32_t), 1, blob);
+			fread(&num_triangles, sizeof(uint32_t), 1, blob);
+		}
+
+		if (0 < num_triangles) {
+			occluders.vertices.resize(num_vertices);
+			occluders.indices.resize(3 * num_triangles);
+			fread_compressed(occluders.vertices.data(), sizeof(glm::vec3), num_vertices, blob);
+			fread_compressed(occluders.indices.data(), sizeof(uint32_t), 3 * num_triangles, blob);
+			fprintf(stderr, "INFO: Loaded %u occluder triangles\n", num_triangles);
+		} else {
+			fprintf(stderr, "WARNING: 'occluders.blob' is missing or empty, software occlusion culling is disabled\n");
+			software_occlusion = false;
+		}
+		if (blob)
+			fclose(blob);
+	} else {
+		software_occlusion = false;
+	}
+
+	{ // Load camera distance ranges of instances from "lods.blob" (optional)
+		PROFILE_ZONE("load_lods");
+		blob = fopen("lods.blob", "rb");
+		uint32_t num_ranges = 0;
+		if (blob)
+			fread(&num_ranges, sizeof(uint32_t), 1, blob);
+
+		if (num_ranges == num_instances) {
+			lod_ranges.resize(num_ranges);
+			fread_compressed(lod_ranges.data(), sizeof(glm::vec2), num_ranges, blob);
+
+			// LOD models are selected only by culling, otherwise they would be drawn over the high-detail ones
+			const bool select = culling && lod_models;
+			for (glm::vec2 &range : lod_ranges) {
+				if (!select)
+					range = glm::vec2((range.x > 0.0f) ? CULL_DISTANCE_UNLIMITED : 0.0f, CULL_DISTANCE_UNLIMITED);
+				else
+					range *= lod_scale;
+			}
+		} else {
+			fprintf(stderr, "WARNING: 'lods.blob' is missing or doesn't match instances, LOD selection is disabled\n");
+		}
+		if (blob)
+			fclose(blob);
+	}
+
+	if (culling && pvs_culling) { // Load potentially visible sets from "pvs.blob" (optional)
+		PROFILE_ZONE("load_pvs");
+		blob = fopen("pvs.blob", "rb");
+		uint32_t num_layers = 0, num_runs = 0;
+		if (blob) {
+			fread(&pvs.num_instances, sizeof(uint32_t), 1, blob);
+			fread(&pvs.cells_x, sizeof(uint32_t), 1, blob);
+			fread(&pvs.cells_y, sizeof(uint32_t), 1, blob);
+			fread(&num_layers, sizeof(uint32_t), 1, blob);
+			fread(&num_runs, sizeof(uint32_t), 1, blob);
+			fread(&pvs.origin, sizeof(glm::vec2), 1, blob);
+			fread(&pvs.cell_size, sizeof(float), 1, blob);
+		}
+
+		if (pvs.num_instances == num_instances && 0 < num_layers) {
+			pvs.layers.resize(num_layers + 1);
+			fread(pvs.layers.data(), sizeof(float), num_layers + 1, blob);
+			pvs.cell_runs.resize(pvs.num_cells() + 1);
+			pvs.runs.resize(num_runs);
+			fread_compressed(pvs.cell_runs.data(), sizeof(uint32_t), pvs.cell_runs.size(), blob);
+			fread_compressed(pvs.runs.data(), sizeof(uint16_t), num_runs, blob);
+			fprintf(stderr, "INFO: Loaded PVS of %ux%ux%u cells\n", pvs.cells_x, pvs.cells_y, num_layers);
+		} else {
+			fprintf(stderr, "WARNING: 'pvs.blob' is missing or doesn't match instances, PVS culling is disabled\n");
+			pvs_culling = false;
+		}
+		if (blob)
+			fclose(blob);
+	} else {
+		pvs_culling = false;
+	}
+
+	if (culling && meshlet_stats) { // Load meshlets from "meshlets.blob" (optional, the indices aren't needed)
+		PROFILE_ZONE("load_meshlets");
+		blob = fopen("meshlets.blob", "rb");
+		uint32_t num_meshes = 0, num_meshlets = 0, num_indices = 0;
+		if (blob) {
+			fread(&num_meshes, sizeof(uint32_t), 1, blob);
+			fread(&num_meshlets, sizeof(uint32_t), 1, blob);
+			fread(&num_indices, sizeof(uint32_t), 1, blob);
+		}
+
+		if (0 < num_meshlets) {
+			meshlet_ranges.resize(num_meshes);
+			meshlets.resize(num_meshlets);
+			fread_compressed(meshlet_ranges.data(), sizeof(MeshletRange), num_meshes, blob);
+			fread_compressed(meshlets.data(), sizeof(Meshlet), num_meshlets, blob);
+			fprintf(stderr, "INFO: Loaded %u meshlets of %u meshes\n", num_meshlets, num_meshes);
+		} else {
+			fprintf(stderr, "WARNING: 'meshlets.blob' is missing or empty, meshlet statistics are disabled\n");
+			meshlet_stats = false;
+		}
+		if (blob)
+			fclose(blob);
+	} else {
+		meshlet_stats = false;
+	}
+
 	{ // Load ordered draw calls from "drawables.blob"
+		PROFILE_ZONE("load_drawables");
 		blob = fopen("drawables.blob", "rb");
 		uint32_t num_draw_calls = 0;
 		fread(&num_draw_calls, sizeof(uint32_t), 1, blob);
@@ -318,129 +1153,463 @@ int load_content()
 		free(buffer);
 	}
 
-	// Prepare shader sources
-	const size_t SOURCE_LENGTH = 4096;
-	char vertex_source[SOURCE_LENGTH];
-	char fragment_source[SOURCE_LENGTH];
-	int vertex_source_length = snprintf(vertex_source, SOURCE_LENGTH, "%s\n"
-		"#define HAS_SHADER_DRAW_PARAMETERS %i\n"
-		"#define HAS_BINDLESS_TEXTURE %i\n"
-		"%s\n",
-		GLSL_PREAMBLE, has_multi_draw_indirect && has_shader_draw_params, has_bindless_textures, GLSL_VERTEX_SHADER);
-	int fragment_source_length = snprintf(fragment_source, SOURCE_LENGTH, "%s\n"
-		"#define HAS_SHADER_DRAW_PARAMETERS %i\n"
-		"#define HAS_BINDLESS_TEXTURE %i\n"
-		"%s\n",
-		GLSL_PREAMBLE, has_multi_draw_indirect && has_shader_draw_params, has_bindless_textures, GLSL_FRAGMENT_SHADER);
-	assert(0 < vertex_source_length && vertex_source_length < SOURCE_LENGTH);
-	assert(0 < fragment_source_length && fragment_source_length < SOURCE_LENGTH);
+	// Build shader program for every render path supported by the GPU
+	PROFILE_ZONE("build_programs");
+	if (vertex_pulling) {
+		// Bindings 8+ are left for vertex pulling, so other passes never have to restore them
+		// (but GPU culling, which lists visible slots into binding 8 right before compute_clip_matrices())
+		GLint vertex_blocks = 0, bindings = 0;
+		if (has_compute_shader) {
+			glGetIntegerv(GL_MAX_VERTEX_SHADER_STORAGE_BLOCKS, &vertex_blocks);
+			glGetIntegerv(GL_MAX_SHADER_STORAGE_BUFFER_BINDINGS, &bindings);
+		}
+		if (matrix_attributes) {
+			fprintf(stderr, "WARNING: Vertex pulling fetches matrices from a buffer texture, which is too small, disabling it\n");
+			vertex_pulling = false;
+		} else if (!supported_paths[PATH_MDI_PER_ARRAY] || vertex_blocks < 4 || bindings < 12) {
+			fprintf(stderr, "WARNING: Vertex pulling requires multi-draw indirect and 4 storage buffers in vertex shaders, disabling it\n");
+			vertex_pulling = false;
+		}
+	}
+	for (int path = 0; path < NUM_RENDER_PATHS; ++path) {
+		if (!supported_paths[path])
+			continue;
+		programs[path] = build_program((RenderPath)path, GLSL_FRAGMENT_SHADER, vertex_pulling && uses_draw_parameters((RenderPath)path));
+		if (!programs[path]) {
+			fprintf(stderr, "ERROR: SHADER COMPILATION FAILED\n");
+			return 9;
+		}
+	}
 
-	// Load shaders and build program
-	GLuint vsh = compile_glsl_source(GL_VERTEX_SHADER, vertex_source);
-	GLuint fsh = compile_glsl_source(GL_FRAGMENT_SHADER, fragment_source);
-	GLuint program = link_glsl(vsh, fsh);
-	glDeleteShader(fsh);
-	glDeleteShader(vsh);
-	if (!vsh || !fsh || !program) {
-		fprintf(stderr, "ERROR: SHADER COMPILATION FAILED\n");
-		return 9;
+	// Textures aren't needed by the depth pre-pass, but every path has to transform vertices exactly like its color pass
+	// (with vertex pulling, or with instance indices fetched through the draw data)
+	if (depth_prepass || bench_prepass) {
+		for (int path = 0; path < NUM_RENDER_PATHS; ++path) {
+			if (!supported_paths[path])
+				continue;
+			depth_programs[path] = build_program((RenderPath)path, GLSL_DEPTH_FRAGMENT_SHADER, vertex_pulling && uses_draw_parameters((RenderPath)path));
+			if (!depth_programs[path]) {
+				fprintf(stderr, "ERROR: SHADER COMPILATION FAILED\n");
+				return 9;
+			}
+			DEPTH_VIEW_PROJ_MATRIX_UNIFORM[path] = glGetUniformLocation(depth_programs[path], "u_ClipFromWorld");
+			DEPTH_SLOT_OFFSET_UNIFORM[path] = glGetUniformLocation(depth_programs[path], "u_SlotOffset");
+		}
+	}
+
+	if (vertex_pulling) {
+		// GPU culling lists visible slots into one more storage block, which compute shaders may not have
+		GLint compute_blocks = 0;
+		glGetIntegerv(GL_MAX_COMPUTE_SHADER_STORAGE_BLOCKS, &compute_blocks);
+		gpu_clip_slots = gpu_culling && compute_blocks >= 9;
+		clip_program = build_compute_program(GLSL_CLIP_MATRICES_COMPUTE_SHADER, gpu_clip_slots ? "#define HAS_SLOT_COUNT 1\n" : "");
+		if (!clip_program) {
+			fprintf(stderr, "ERROR: SHADER COMPILATION FAILED\n");
+			return 9;
+		}
+		CLIP_VIEW_PROJ_MATRIX_UNIFORM = glGetUniformLocation(clip_program, "u_ClipFromWorld");
+		CLIP_SLOT_OFFSET_UNIFORM = glGetUniformLocation(clip_program, "u_SlotOffset");
+		CLIP_NUM_SLOTS_UNIFORM = glGetUniformLocation(clip_program, "u_NumSlots");
+		glGenBuffers(1, &clip_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clip_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::mat4) * CULL_FRAMES * num_instances, NULL, GL_DYNAMIC_COPY);
+		GL_CHECK();
 	}
-	glUseProgram(program);
-	WORLD_MATRIX_UNIFORM = glGetUniformLocation(program, "u_WorldFromObject");
-	VIEW_PROJ_MATRIX_UNIFORM = glGetUniformLocation(program, "u_ClipFromWorld");
-	TEXTURE_0_UNIFORM = glGetUniformLocation(program, "u_Texture0");
-	TEMP_TEX_IDX_UNIFORM = glGetUniformLocation(program, "u_TempTextureIdx");
+
+	// Take the fastest path available (presumably, unless it is forced or autotuned later)
+	for (int path = NUM_RENDER_PATHS - 1; path >= 0; --path)
+		if (supported_paths[path])
+			render_path = (RenderPath)path;
+	if (NUM_RENDER_PATHS != forced_path && supported_paths[forced_path])
+		render_path = forced_path;
+	else if (NUM_RENDER_PATHS != forced_path)
+		fprintf(stderr, "WARNING: Render path '%s' is not supported, using '%s'\n", RENDER_PATH_NAMES[forced_path], RENDER_PATH_NAMES[render_path]);
+	select_render_path(render_path);
 
 	fprintf(stderr, "INFO: Compiled shaders\n");
 	return 0;
 }
 
 
-int post_load()
+//! Build compute shaders and buffers for GPU culling (its support is checked by load_content()).
+static
+int init_gpu_culling()
 {
-	const uint64_t TEXTURE_ARRAY_MASK = 0xFFFFF000000ULL;
+	if (verify_gpu_culling && occlusion_culling) {
+		fprintf(stderr, "WARNING: Only frustum culling can be verified, disabling occlusion culling\n");
+		occlusion_culling = false;
+	}
 
-	// SSBO have offset alignment requirements - remember it!
-	// We keep texture indices in SSBO which are indexed in shaders with gl_DrawIDARB (if supported)
-	GLint ssbo_alignment = 4;
-	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssbo_alignment);
-	ssbo_alignment--;
+	cull_program = build_compute_program(GLSL_CULL_COMPUTE_SHADER, gpu_clip_slots ? "#define HAS_CLIP_SLOTS 1\n" : "");
+	emit_program = build_compute_program(GLSL_EMIT_COMPUTE_SHADER, "");
+	pyramid_program = occlusion_culling ? build_compute_program(GLSL_DEPTH_PYRAMID_SHADER, "") : 0;
+	if (!cull_program || !emit_program || (occlusion_culling && !pyramid_program)) {
+		fprintf(stderr, "ERROR: Failed to build culling compute shaders\n");
+		return 10;
+	}
+	CULL_PLANES_UNIFORM = glGetUniformLocation(cull_program, "u_Planes");
+	CULL_CAMERA_UNIFORM = glGetUniformLocation(cull_program, "u_Camera");
+	CULL_CLIP_FROM_WORLD_UNIFORM = glGetUniformLocation(cull_program, "u_ClipFromWorld");
+	CULL_PHASE_UNIFORM = glGetUniformLocation(cull_program, "u_Phase");
+	CULL_VISIBLE_OFFSET_UNIFORM = glGetUniformLocation(cull_program, "u_VisibleOffset");
+	EMIT_NUM_COMMANDS_UNIFORM = glGetUniformLocation(emit_program, "u_NumCommands");
+	EMIT_COMMAND_OFFSET_UNIFORM = glGetUniformLocation(emit_program, "u_CommandOffset");
+	EMIT_INSTANCE_OFFSET_UNIFORM = glGetUniformLocation(emit_program, "u_InstanceOffset");
+	EMIT_NUM_COMPACTED_UNIFORM = glGetUniformLocation(emit_program, "u_NumCompacted");
+	PYRAMID_SOURCE_LEVEL_UNIFORM = glGetUniformLocation(pyramid_program, "u_SourceLevel");
+	PYRAMID_SCALE_UNIFORM = glGetUniformLocation(pyramid_program, "u_Scale");
+
+	// Static inputs: bounding spheres, instance groups and command templates
+	std::vector<glm::vec4> bounds(num_instances);
+	for (uint32_t i = 0; i < num_instances; ++i)
+		bounds[i] = glm::vec4(instance_bounds.x[i], instance_bounds.y[i], instance_bounds.z[i], instance_bounds.radius[i]);
+	glGenBuffers(1, &bounds_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, bounds_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * bounds.size(), bounds.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &groups_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, groups_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(InstanceGroup) * instance_groups.size(), instance_groups.data(), GL_STATIC_DRAW);
+
+	// The shader always tests the ranges, so everything is in range without "lods.blob"
+	std::vector<glm::vec2> ranges(lod_ranges);
+	if (ranges.empty())
+		ranges.assign(num_instances, glm::vec2(0.0f, CULL_DISTANCE_UNLIMITED));
+	glGenBuffers(1, &lod_ranges_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lod_ranges_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec2) * ranges.size(), ranges.data(), GL_STATIC_DRAW);
+
+	std::vector<DrawElementsIndirectCommand> templates(draw_commands);
+	for (size_t i = 0; i < templates.size(); ++i)
+		templates[i].instance_count = draw_instance_group[i]; // The shader replaces it with the number of visible instances
+	glGenBuffers(1, &command_template_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_template_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand) * templates.size(), templates.data(), GL_STATIC_DRAW);
+
+	// Outputs
+	glGenBuffers(1, &group_visible_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, group_visible_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * instance_groups.size(), NULL, GL_DYNAMIC_COPY);
+
+	const uint32_t phases = occlusion_culling ? CULL_PHASES : 1;
+	glGenBuffers(phases, compact_indirect_buffers);
+	glGenBuffers(phases, compact_texid_buffers);
+	if (has_bindless_textures)
+		glGenBuffers(phases, compact_texhandle_buffers);
+	for (uint32_t phase = 0; phase < phases; ++phase) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, compact_indirect_buffers[phase]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, GPU_CULL_HEADER_SIZE + sizeof(DrawElementsIndirectCommand) * draw_commands.size(), NULL, GL_DYNAMIC_COPY);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, compact_texid_buffers[phase]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint) * draw_commands.size(), NULL, GL_DYNAMIC_COPY);
+		if (has_bindless_textures) {
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, compact_texhandle_buffers[phase]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint64) * draw_commands.size(), NULL, GL_DYNAMIC_COPY);
+		}
+	}
 
-	// Allocate indirect draw buffer on the GPU. It will contain all draw calls parameters.
-	// NOTE: It is required only for the gl*Draw*Indirect() family of functions.
-	glGenBuffers(1, &indirect_buffer);
-	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
-	glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * ordered_draw_calls.size(), NULL, GL_STATIC_DRAW);
+	const uint8_t no_stats[CULL_PHASES * GPU_CULL_HEADER_SIZE] = {};
+	glGenBuffers(CULL_FRAMES, gpu_cull_stats);
+	for (GLuint stats : gpu_cull_stats) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, stats);
+		glBufferData(GL_COPY_WRITE_BUFFER, sizeof(no_stats), no_stats, GL_STREAM_READ);
+	}
 
-	uint64_t prev_key = UINT64_MAX;
-	std::vector<GLuint> texture_idx;
-	std::vector<GLuint64> texture_handles;
-	std::vector<DrawElementsIndirectCommand> call_args;
-	uint32_t indirect_offset = 0;
-	uint32_t texid_offset = 0;
-	MultiDrawCall mdc = {};
+	if (occlusion_culling) {
+		// Nothing was visible in the last frame, so the first one is drawn by phase 2 alone
+		const std::vector<uint32_t> last_visible(num_instances, 0);
+		glGenBuffers(1, &last_visible_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, last_visible_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * last_visible.size(), last_visible.data(), GL_DYNAMIC_COPY);
 
-	if (has_multi_draw_indirect && has_shader_draw_params) {
-		// Batch the hell out of those instanced draw calls...
-		// This loop groups all draw calls that use the same texture array to fill the indirect buffer.
-		for (const auto &draw_call_pair : ordered_draw_calls) {
-			const DrawCall &dc = draw_call_pair.second;
-			const uint64_t key = draw_call_pair.first;
-			const uint64_t changes = key ^ prev_key;
+		glGenBuffers(1, &group_triangles_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, group_triangles_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * group_triangles.size(), group_triangles.data(), GL_STATIC_DRAW);
+	}
 
-			// If there is a change in texture array then we have to flush the batch and start a new one
-			if (changes & TEXTURE_ARRAY_MASK) {
-				if (!call_args.empty()) {
-					// Upload MultiDraw arguments
-					mdc.texid_offset = texid_offset;
-					mdc.indirect_count = call_args.size();
-					mdc.indirect_offset = indirect_offset;
-					const GLsizei args_size = sizeof(DrawElementsIndirectCommand) * call_args.size();
-					glBufferSubData(GL_DRAW_INDIRECT_BUFFER, indirect_offset, args_size, call_args.data());
-					indirect_offset += args_size;
+	// CPU reference with slightly shrunk and inflated spheres, so we don't report rounding differences
+	if (verify_gpu_culling) {
+		for (glm::vec4 &sphere : bounds)
+			sphere.w -= VERIFY_CULL_EPSILON;
+		assign_bounding_spheres(verify_bounds_inner, bounds.data(), num_instances);
+		for (glm::vec4 &sphere : bounds)
+			sphere.w += 2.0f * VERIFY_CULL_EPSILON;
+		assign_bounding_spheres(verify_bounds_outer, bounds.data(), num_instances);
+	}
 
-					multicalls.push_back(mdc);
-				}
+	GL_CHECK();
+	fprintf(stderr, "INFO: GPU culling enabled (%s%s)\n", has_indirect_parameters ? "with indirect draw count" : "without indirect draw count",
+		occlusion_culling ? ", occlusion culling" : "");
+	return 0;
+}
+
+
+//! Build programs and buffers of the visibility buffer (disables it, if it can't be used).
+static
+int init_visibility_buffer()
+{
+	if (!supported_paths[PATH_MDI_PER_ARRAY] || !has_compute_shader) {
+		fprintf(stderr, "WARNING: Visibility buffer requires multi-draw indirect and storage buffers, disabling it\n");
+		visibility_buffer = bench_visibility = false;
+		return 0;
+	}
+	if (matrix_attributes) {
+		fprintf(stderr, "WARNING: Visibility buffer fetches matrices from a buffer texture, which is too small, disabling it\n");
+		visibility_buffer = bench_visibility = false;
+		return 0;
+	}
+	if (occlusion_culling) {
+		fprintf(stderr, "WARNING: Visibility buffer doesn't work with occlusion culling, disabling it\n");
+		visibility_buffer = bench_visibility = false;
+		return 0;
+	}
+
+	// Draw IDs share 32 bits with triangles of their strips (opaque draw calls come first)
+	const DrawRange &range = alpha_draw_ranges[ALPHA_OPAQUE];
+	uint32_t max_triangles = 1, draw_bits = 0;
+	for (uint32_t i = range.first; i < range.first + range.count; ++i)
+		max_triangles = std::max(max_triangles, (draw_commands[i].count > 2) ? draw_commands[i].count - 2 : 0);
+	vis_primitive_bits = 0;
+	while ((1ULL << vis_primitive_bits) < max_triangles)
+		++vis_primitive_bits;
+	while ((1ULL << draw_bits) < range.first + range.count)
+		++draw_bits;
+	if (vis_primitive_bits + draw_bits > 32) {
+		fprintf(stderr, "WARNING: %u draw calls of up to %u triangles don't fit into visibility IDs, disabling the visibility buffer\n",
+			range.first + range.count, max_triangles);
+		visibility_buffer = bench_visibility = false;
+		return 0;
+	}
+
+	vis_program = build_program(PATH_MDI_PER_ARRAY, GLSL_VISIBILITY_FRAGMENT_SHADER, vertex_pulling);
+	resolve_programs[0] = build_resolve_program(false);
+	resolve_programs[1] = supported_paths[PATH_MDI_BINDLESS] ? build_resolve_program(true) : 0;
+	if (!vis_program || !resolve_programs[0] || (supported_paths[PATH_MDI_BINDLESS] && !resolve_programs[1])) {
+		fprintf(stderr, "ERROR: SHADER COMPILATION FAILED\n");
+		return 9;
+	}
+	VIS_VIEW_PROJ_MATRIX_UNIFORM = glGetUniformLocation(vis_program, "u_ClipFromWorld");
+	VIS_DRAW_ID_OFFSET_UNIFORM = glGetUniformLocation(vis_program, "u_DrawIDOffset");
+	VIS_PRIMITIVE_BITS_UNIFORM = glGetUniformLocation(vis_program, "u_PrimitiveBits");
+	for (int bindless = 0; bindless < 2 && resolve_programs[bindless]; ++bindless) {
+		RESOLVE_VIEW_PROJ_MATRIX_UNIFORM[bindless] = glGetUniformLocation(resolve_programs[bindless], "u_ClipFromWorld");
+		RESOLVE_PRIMITIVE_BITS_UNIFORM[bindless] = glGetUniformLocation(resolve_programs[bindless], "u_PrimitiveBits");
+	}
+	RESOLVE_TEXTURE_ARRAY_UNIFORM = glGetUniformLocation(resolve_programs[0], "u_TextureArray");
+
+	// Texture indices and handles of draw calls are already in `texid_buffer` and `texhandle_buffer`
+	std::vector<glm::uvec4> draws;
+	draws.reserve(draw_commands.size());
+	uint32_t draw_idx = 0;
+	for (const auto &draw_call_pair : ordered_draw_calls) {
+		const DrawElementsIndirectCommand &cmd = draw_commands[draw_idx++];
+		draws.push_back(glm::uvec4(cmd.first_index, cmd.base_vertex, draw_call_pair.second.texture_array, 0));
+	}
+	glGenBuffers(1, &vis_draw_buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, vis_draw_buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec4) * draws.size(), draws.data(), GL_STATIC_DRAW);
+	GL_CHECK();
+	return 0;
+}
+
+
+int post_load()
+{
+	PROFILE_ZONE("post_load");
+
+	// SSBO have offset alignment requirements - remember it!
+	// We keep texture indices in SSBO which are indexed in shaders with gl_DrawIDARB (if supported)
+	GLint ssbo_alignment = 4;
+	glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &ssbo_alignment);
+	ssbo_alignment--;
+
+	// Remember which draw calls sample each texture array, so streamed textures can patch their handles.
+	// Draw calls of an array are split by alpha classes, which precede the texture array in sort keys.
+	// All material splits of a model share the same range of instances, which is culled only once.
+	texture_draw_ranges.assign(NUM_ALPHA_CLASSES * (textures.size() + 1), DrawRange());
+	std::map<uint32_t, uint32_t> group_lookup; //!< base_instance -> index of the instance group
+	uint32_t draw_idx = 0;
+	for (const auto &draw_call_pair : ordered_draw_calls) {
+		const DrawCall &dc = draw_call_pair.second;
+		const uint32_t alpha_class = get_alpha_class(draw_call_pair.first);
+		DrawRange *ranges[] = { &texture_draw_ranges[NUM_ALPHA_CLASSES * dc.texture_array + alpha_class], &alpha_draw_ranges[alpha_class] };
+		for (DrawRange *range : ranges) {
+			if (0 == range->count)
+				range->first = draw_idx;
+			++range->count;
+		}
+		++draw_idx;
+
+		auto group = group_lookup.find(dc.base_instance);
+		if (group_lookup.end() == group) {
+			InstanceGroup ig = { dc.base_instance, dc.num_instances };
+			group = group_lookup.insert(std::make_pair(dc.base_instance, (uint32_t)instance_groups.size())).first;
+			instance_groups.push_back(ig);
+		}
+		draw_instance_group.push_back(group->second);
+
+		DrawElementsIndirectCommand cmd = {
+			dc.num_vertices, // = count
+			dc.num_instances, // = instanceCount = primcount
+			dc.index_offset / sizeof(uint16_t), // firstIndex = indexOffset / sizeofType
+			dc.base_vertex,
+			dc.base_instance
+		};
+		draw_commands.push_back(cmd);
+	}
+	fprintf(stderr, "INFO: Draw calls by alpha class: %u opaque, %u cutout, %u translucent\n",
+		alpha_draw_ranges[ALPHA_OPAQUE].count, alpha_draw_ranges[ALPHA_CUTOUT].count, alpha_draw_ranges[ALPHA_TRANSLUCENT].count);
+	if (sort_translucent && gpu_culling && 0 < alpha_draw_ranges[ALPHA_TRANSLUCENT].count) {
+		fprintf(stderr, "WARNING: Translucent instances are sorted only with CPU culling, drawing them in baked order\n");
+		sort_translucent = false;
+	} else if (sort_translucent && 0 < alpha_draw_ranges[ALPHA_TRANSLUCENT].count) {
+		const DrawRange &range = alpha_draw_ranges[ALPHA_TRANSLUCENT];
+		translucent_draw_calls.reserve(range.count);
+		auto draw_call_it = std::next(ordered_draw_calls.begin(), range.first);
+		for (uint32_t i = 0; i < range.count; ++i, ++draw_call_it)
+			translucent_draw_calls.push_back(draw_call_it->second);
+
+		// Without culling every instance stays in its own slot
+		group_translucent.assign(instance_groups.size(), 0);
+		for (uint32_t i = range.first; i < range.first + range.count; ++i)
+			group_translucent[draw_instance_group[i]] = 1;
+		translucent_visible.resize(num_instances);
+		for (uint32_t i = 0; i < num_instances; ++i)
+			translucent_visible[i] = i;
+
+		// Regions of the stream fit all translucent instances (and the alignment of all four arrays)
+		GLsizeiptr max_sorted = 0;
+		for (uint32_t i = range.first; i < range.first + range.count; ++i)
+			max_sorted += instance_groups[draw_instance_group[i]].count;
+		const GLsizeiptr alignment = std::max(ssbo_alignment + 1, 16);
+		const GLsizeiptr sorted_size = sizeof(DrawElementsIndirectCommand) + sizeof(GLuint) + sizeof(GLuint64) + sizeof(glm::uvec2);
+		if (!create_stream_buffer(sorted_stream, max_sorted * sorted_size + 4 * alignment, alignment, has_buffer_storage)) {
+			fprintf(stderr, "ERROR: Cannot map buffer of sorted translucent instances\n");
+			return 1;
+		}
+	} else {
+		sort_translucent = false;
+	}
+	group_visible.resize(instance_groups.size());
+	for (size_t g = 0; g < instance_groups.size(); ++g)
+		group_visible[g] = instance_groups[g].count;
+	if (!culling && !lod_ranges.empty()) {
+		for (size_t g = 0; g < instance_groups.size(); ++g)
+			if (lod_ranges[instance_groups[g].base_instance].x > 0.0f)
+				group_visible[g] = 0;
+	}
+
+	// Members of HLOD proxies are placements of the same model, but each is replaced at its own distance
+	if (!lod_ranges.empty()) {
+		group_lod_ranges.resize(instance_groups.size());
+		for (size_t g = 0; g < instance_groups.size(); ++g) {
+			const InstanceGroup &group = instance_groups[g];
+			glm::vec2 widest = lod_ranges[group.base_instance], narrowest = widest;
+			for (uint32_t i = group.base_instance + 1; i < group.base_instance + group.count; ++i) {
+				widest = glm::vec2(std::min(widest.x, lod_ranges[i].x), std::max(widest.y, lod_ranges[i].y));
+				narrowest = glm::vec2(std::max(narrowest.x, lod_ranges[i].x), std::min(narrowest.y, lod_ranges[i].y));
+			}
+			group_lod_ranges[g] = glm::vec4(widest, narrowest);
+		}
+	}
+
+	// Clusters are stored in the order of instances, reorder them to match instance groups
+	if (cluster_culling) {
+		std::vector<InstanceCluster> clusters;
+		clusters.swap(group_clusters);
+		group_clusters.resize(instance_groups.size());
+		uint32_t num_matched = 0;
+		for (const InstanceCluster &cluster : clusters) {
+			// Clusters of models without any drawable material have no group
+			const auto group = group_lookup.find(cluster.base_instance);
+			if (group_lookup.end() != group && instance_groups[group->second].count == cluster.count) {
+				group_clusters[group->second] = cluster;
+				++num_matched;
+			}
+		}
+		if (num_matched != instance_groups.size()) {
+			fprintf(stderr, "WARNING: 'clusters.blob' doesn't match draw calls, cluster culling is disabled\n");
+			cluster_culling = false;
+			group_clusters.clear();
+		}
+	}
+	group_triangles.assign(instance_groups.size(), 0);
+	for (size_t i = 0; i < draw_commands.size(); ++i)
+		group_triangles[draw_instance_group[i]] += (draw_commands[i].count > 2) ? draw_commands[i].count - 2 : 0;
+
+	uint64_t prev_key = UINT64_MAX;
+	std::vector<GLuint> texture_idx;
+	std::vector<GLuint> texture_array_idx;
+	std::vector<GLuint64> texture_handles;
+	uint32_t num_commands = 0;
+	MultiDrawCall mdc = {};
+
+	if (has_multi_draw_indirect) {
+		// Allocate indirect draw buffer on the GPU. It will contain all draw calls parameters (patched every frame).
+		// NOTE: It is required only for the gl*Draw*Indirect() family of functions.
+		if (!create_stream_buffer(command_stream, sizeof(DrawElementsIndirectCommand) * draw_commands.size(), sizeof(GLuint), has_buffer_storage)) {
+			fprintf(stderr, "ERROR: Cannot map indirect draw buffer\n");
+			return 1;
+		}
+		indirect_buffer = command_stream.buffer;
+
+		// Batch the hell out of those instanced draw calls...
+		// This loop groups all draw calls that use the same texture array to fill the indirect buffer.
+		for (const auto &draw_call_pair : ordered_draw_calls) {
+			const DrawCall &dc = draw_call_pair.second;
+			const uint64_t key = draw_call_pair.first;
+			const uint64_t changes = key ^ prev_key;
+
+			// If there is a change in texture array then we have to flush the batch and start a new one
+			if (changes & TEXTURE_ARRAY_MASK) {
+				if (prev_key != UINT64_MAX) {
+					mdc.indirect_count = num_commands - mdc.indirect_offset / sizeof(DrawElementsIndirectCommand);
+					multicalls.push_back(mdc);
+				}
 
 				// Start a new batch from scratch
 				prev_key = key;
 				mdc = {};
 				mdc.tex_array = dc.texture_array;
-				call_args.clear();
-				texid_offset = sizeof(float) * texture_idx.size();
+				mdc.alpha_class = get_alpha_class(key);
+				mdc.indirect_offset = sizeof(DrawElementsIndirectCommand) * num_commands;
 
 				// Align the offset to meet the SSBO alignment requirements
-				if (!has_bindless_textures) {
-					const uint32_t aligned_offset = (texid_offset + ssbo_alignment) & ~ssbo_alignment;
-					const uint32_t padding = aligned_offset - texid_offset;
-					assert(0 == padding % 4); // I'm assuming that padding is a multiple of 4
-					for (uint32_t _ = 0; _ < padding / 4; ++_)
-						texture_idx.push_back(0);
-					texid_offset = aligned_offset;
-				}
+				const uint32_t texid_offset = sizeof(float) * texture_array_idx.size();
+				const uint32_t aligned_offset = (texid_offset + ssbo_alignment) & ~ssbo_alignment;
+				const uint32_t padding = aligned_offset - texid_offset;
+				assert(0 == padding % 4); // I'm assuming that padding is a multiple of 4
+				for (uint32_t _ = 0; _ < padding / 4; ++_)
+					texture_array_idx.push_back(0);
+				mdc.texid_offset = aligned_offset;
 			}
 
-			if (has_shader_draw_params)
-				texture_idx.push_back(dc.tex_index);
+			texture_idx.push_back(dc.tex_index);
+			texture_array_idx.push_back(dc.tex_index);
 			if (has_bindless_textures)
 				texture_handles.push_back(tex_handles[dc.texture_array]);
+			++num_commands;
+		}
 
-			DrawElementsIndirectCommand cmd = {
-				dc.num_vertices, // = count
-				dc.num_instances, // = instanceCount = primcount
-				dc.index_offset / sizeof(uint16_t), // firstIndex = indexOffset / sizeofType
-				dc.base_vertex,
-				dc.base_instance
-			};
-			call_args.push_back(cmd);
+		// Don't forget about the last batch
+		if (prev_key != UINT64_MAX) {
+			mdc.indirect_count = num_commands - mdc.indirect_offset / sizeof(DrawElementsIndirectCommand);
+			multicalls.push_back(mdc);
 		}
 
+	}
+
+	if (supported_paths[PATH_MDI_PER_ARRAY]) {
 		// One MegaBuffer(TM) containing all texture indices of all draw calls.
 		// Ideally this buffer will be indexed with gl_DrawIDARB during rendering.
 		glGenBuffers(1, &texid_buffer);
 		glBindBuffer(GL_SHADER_STORAGE_BUFFER, texid_buffer);
 		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * texture_idx.size(), texture_idx.data(), GL_STATIC_DRAW);
 
+		// Without bindless textures we bind a range of texture indices for each texture array
+		glGenBuffers(1, &texid_array_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, texid_array_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * texture_array_idx.size(), texture_array_idx.data(), GL_STATIC_DRAW);
+
 		if (has_bindless_textures) {
 			// This buffer contains all the bindless texture handles. Unfortunatelly this requires `GL_ARB_bindless_texture`
 			glGenBuffers(1, &texhandle_buffer);
@@ -449,21 +1618,1413 @@ int post_load()
 		}
 	}
 
+	if (supported_paths[PATH_DRAW_ATTRIBUTE]) {
+		// Commands of this path carry the draw call index in their base instance. Instances never outnumber
+		// the divisor, so every draw reads a single element (slots are offset by the region in shaders).
+		std::vector<glm::uvec2> draw_data;
+		draw_data.reserve(draw_commands.size());
+		for (const auto &draw_call_pair : ordered_draw_calls)
+			draw_data.push_back(glm::uvec2(draw_call_pair.second.base_instance, draw_call_pair.second.tex_index));
+		glGenBuffers(1, &draw_data_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, draw_data_buffer);
+		glBufferData(GL_ARRAY_BUFFER, sizeof(glm::uvec2) * draw_data.size(), draw_data.data(), GL_STATIC_DRAW);
+		glVertexAttribIPointer(ATTRIB_DRAW_DATA, 2, GL_UNSIGNED_INT, sizeof(glm::uvec2), NULL);
+		glVertexAttribDivisor(ATTRIB_DRAW_DATA, std::max(num_instances, 1u));
+		GL_CHECK();
+	}
+
+	if (gpu_culling) {
+		const int status = init_gpu_culling();
+		if (0 != status)
+			return status;
+	}
+
+	// Clip matrices are computed only for visible slots, listed by culling
+	if (vertex_pulling && gpu_culling) {
+		// Every slot lists itself, in case culling can't list them
+		std::vector<uint32_t> identity(CULL_PHASES * num_instances);
+		for (uint32_t i = 0; i < identity.size(); ++i)
+			identity[i] = i;
+		glGenBuffers(1, &clip_slots_buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, clip_slots_buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * identity.size(), identity.data(), GL_DYNAMIC_COPY);
+	} else if (vertex_pulling && !create_stream_buffer(clip_slot_stream, sizeof(uint32_t) * num_instances, ssbo_alignment + 1, has_buffer_storage)) {
+		fprintf(stderr, "ERROR: Cannot map buffer of visible slots\n");
+		return 1;
+	}
+
+	if (visibility_buffer || bench_visibility) {
+		const int status = init_visibility_buffer();
+		if (0 != status)
+			return status;
+	}
+
+	if (software_occlusion && gpu_culling) {
+		fprintf(stderr, "WARNING: Software occlusion culling works only with CPU culling, disabling it\n");
+		software_occlusion = false;
+	} else if (software_occlusion) {
+		resize_occlusion_buffer(occlusion_buffer, occluders, OCCLUSION_BUFFER_WIDTH, OCCLUSION_BUFFER_HEIGHT);
+		group_occluded.assign(instance_groups.size(), 0);
+	}
+
+	if (meshlet_stats && gpu_culling) {
+		fprintf(stderr, "WARNING: Meshlet statistics work only with CPU culling, disabling them\n");
+		meshlet_stats = false;
+	} else if (meshlet_stats) {
+		// Item definition ID and material split of draw calls come from their sort keys
+		std::map<uint32_t, MeshletRange> ranges;
+		for (const MeshletRange &range : meshlet_ranges)
+			ranges[range.id] = range;
+		group_meshlets.assign(instance_groups.size(), std::vector<uint32_t>());
+		group_meshlet_counts.assign(instance_groups.size(), glm::uvec3(0));
+		uint32_t i = 0;
+		for (const auto &draw_call_pair : ordered_draw_calls) {
+			const auto range = ranges.find((draw_call_pair.first >> 24) & 0x1FFF);
+			const uint32_t split = draw_call_pair.first & 0xFF;
+			if (ranges.end() != range) {
+				for (uint32_t m = range->second.first_meshlet; m < range->second.first_meshlet + range->second.num_meshlets; ++m)
+					if (meshlets[m].split == split)
+						group_meshlets[draw_instance_group[i]].push_back(m);
+			}
+			++i;
+		}
+	}
+
+	if (pvs_culling && gpu_culling) {
+		fprintf(stderr, "WARNING: PVS culling works only with CPU culling, disabling it\n");
+		pvs_culling = false;
+	} else if (pvs_culling) {
+		pvs_visible.resize(num_instances);
+	}
+	if (software_occlusion || pvs_culling || meshlet_stats || sort_translucent || !lod_ranges.empty())
+		cull_scratch.resize(num_instances);
+	return 0;
+}
+
+
+//! Rasterize occluders into `occlusion_buffer` from the current camera (on all workers).
+static
+void rasterize_occlusion_buffer()
+{
+	PROFILE_ZONE("rasterize_occluders");
+	parallel_for(occluders.vertices.size(), OCCLUDER_BATCH_SIZE, [](uint32_t begin, uint32_t end) {
+		transform_occluders(occlusion_buffer, occluders, view_proj, begin, end);
+	});
+	parallel_for(occlusion_buffer.tiles_y, 1, [](uint32_t begin, uint32_t end) {
+		rasterize_occluders(occlusion_buffer, occluders, begin, end);
+	});
+}
+
+
+//! Test meshlets of a visible instance against the frustum and their normal cones (for --meshlet-stats).
+static
+void count_meshlets(uint32_t group, uint32_t instance, const CullingFrustum &frustum)
+{
+	// Instances are only rotated and translated, so the cones can be tested in object space
+	const glm::mat4 &world_from_object = instance_matrices[instance];
+	const glm::vec3 camera = glm::vec3(glm::inverse(world_from_object) * glm::vec4(view_pos, 1.0f));
+	glm::uvec3 &counts = group_meshlet_counts[group];
+	for (uint32_t m : group_meshlets[group]) {
+		const Meshlet &meshlet = meshlets[m];
+		const glm::vec4 sphere(glm::vec3(world_from_object * glm::vec4(glm::vec3(meshlet.sphere), 1.0f)), meshlet.sphere.w);
+		++counts.x;
+		if (!is_sphere_visible(frustum, sphere))
+			++counts.y;
+		else if (is_meshlet_backfacing(meshlet, camera))
+			++counts.z;
+	}
+}
+
+
+//! Check, if the instance is within its range of camera distances (extended by `margin`).
+static inline
+bool is_lod_selected(uint32_t instance, float margin)
+{
+	const glm::vec2 &range = lod_ranges[instance];
+	const float distance = glm::length(glm::vec3(instance_bounds.x[instance], instance_bounds.y[instance], instance_bounds.z[instance]) - view_pos);
+	return distance >= range.x - margin && distance < range.y + margin;
+}
+
+
+//! Compare distance ranges of instances of a group with its cluster box. The ranges of a group may differ
+//! (members of HLOD proxies), so none is selected only outside of all of them and all only within all of them.
+static
+LodCoverage get_group_lod_coverage(uint32_t g)
+{
+	if (lod_ranges.empty())
+		return LOD_ALL;
+	if (!cluster_culling)
+		return LOD_SOME;
+
+	// Centers of all instances are within the box
+	const glm::vec4 &ranges = group_lod_ranges[g];
+	const InstanceCluster &box = group_clusters[g];
+	const float nearest = glm::length(glm::max(glm::max(box.lo - view_pos, view_pos - box.hi), glm::vec3(0.0f)));
+	const float farthest = glm::length(glm::max(glm::abs(view_pos - box.lo), glm::abs(view_pos - box.hi)));
+	if (nearest >= ranges.y || farthest < ranges.x)
+		return LOD_NONE;
+	return (nearest >= ranges.z && farthest < ranges.w) ? LOD_ALL : LOD_SOME;
+}
+
+
+//! Base instance of given draw call: its slots in the region of visible instances, or its draw data with PATH_DRAW_ATTRIBUTE.
+static inline
+GLuint get_base_instance(uint32_t region, uint32_t draw_idx)
+{
+	return (PATH_DRAW_ATTRIBUTE == render_path) ? draw_idx : region * num_instances + draw_commands[draw_idx].base_instance;
+}
+
+
+//! Cull all instances against the current view frustum and fill this frame's region
+//! of the visible instance buffer and indirect buffer (with patched instance counts).
+static
+void cull_instances()
+{
+	PROFILE_ZONE("cull");
+
+	// Make sure that the GPU is done with the regions we are about to overwrite
+	begin_stream_frame(visible_stream);
+	if (indirect_buffer)
+		begin_stream_frame(command_stream);
+	cull_region = visible_stream.region;
+
+	GLintptr offset = 0;
+	if (culling) {
+		uint32_t *visible = (uint32_t *)stream_alloc(visible_stream, sizeof(uint32_t) * num_instances, &offset);
+		const CullingFrustum frustum = make_culling_frustum(view_proj, view_pos, cull_distance);
+		if (software_occlusion)
+			rasterize_occlusion_buffer();
+
+		// The sets are decoded only when the camera moves to another cell
+		if (pvs_culling) {
+			const uint32_t cell = find_pvs_cell(pvs, view_pos);
+			if (cell != pvs_cell && PVS_NO_CELL != cell)
+				decode_pvs_cell(pvs, cell, pvs_visible.data());
+			pvs_cell = cell;
+		}
+		const bool use_pvs = pvs_culling && PVS_NO_CELL != pvs_cell;
+
+		parallel_for(instance_groups.size(), CULL_BATCH_SIZE, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t g = begin; g < end; ++g) {
+				// Each group compacts its visible instances within its own range, so jobs never overlap
+				const InstanceGroup &group = instance_groups[g];
+				if (meshlet_stats)
+					group_meshlet_counts[g] = glm::uvec3(0);
+				const LodCoverage lod = get_group_lod_coverage(g);
+				if (LOD_NONE == lod || (cluster_culling && !is_box_visible(frustum, group_clusters[g].lo, group_clusters[g].hi))) {
+					group_visible[g] = 0;
+					if (software_occlusion)
+						group_occluded[g] = 0;
+					continue;
+				}
+				const bool translucent = sort_translucent && group_translucent[g];
+				if (!software_occlusion && !use_pvs && !meshlet_stats && !translucent && LOD_ALL == lod) {
+					group_visible[g] = cull_spheres(frustum, instance_bounds, group.base_instance, group.count, visible + group.base_instance);
+					continue;
+				}
+
+				// Mapped memory is write-only, so the frustum culling goes to the scratch buffer first
+				const uint32_t *candidates = &cull_scratch[group.base_instance];
+				const uint32_t num_candidates = cull_spheres(frustum, instance_bounds, group.base_instance, group.count, &cull_scratch[group.base_instance]);
+				uint32_t num_visible = 0, num_hidden = 0;
+				for (uint32_t i = 0; i < num_candidates; ++i) {
+					const uint32_t idx = candidates[i];
+					if ((use_pvs && !pvs_visible[idx]) || (LOD_SOME == lod && !is_lod_selected(idx, 0.0f))) {
+						++num_hidden;
+						continue;
+					}
+					const glm::vec4 sphere(instance_bounds.x[idx], instance_bounds.y[idx], instance_bounds.z[idx], instance_bounds.radius[idx]);
+					if (software_occlusion && is_sphere_occluded(occlusion_buffer, view_proj, sphere))
+						continue;
+					if (translucent)
+						translucent_visible[group.base_instance + num_visible] = idx;
+					visible[group.base_instance + num_visible++] = idx;
+					if (meshlet_stats)
+						count_meshlets(g, idx, frustum);
+				}
+				group_visible[g] = num_visible;
+				if (software_occlusion)
+					group_occluded[g] = num_candidates - num_hidden - num_visible;
+			}
+		});
+
+		stream_flush(visible_stream);
+	}
+
+	uint32_t visible_instances = 0;
+	drawn_triangles = 0;
+	for (size_t g = 0; g < instance_groups.size(); ++g) {
+		visible_instances += group_visible[g];
+		drawn_triangles += group_visible[g] * group_triangles[g];
+	}
+	culled_instances = num_instances - visible_instances;
+	if (meshlet_stats) {
+		for (size_t g = 0; g < instance_groups.size(); ++g) {
+			meshlets_tested += group_meshlet_counts[g].x;
+			meshlets_outside += group_meshlet_counts[g].y;
+			meshlets_backfacing += group_meshlet_counts[g].z;
+		}
+		++meshlet_frames;
+	}
+	if (software_occlusion) {
+		occluded_instances = occluded_triangles = 0;
+		for (size_t g = 0; g < instance_groups.size(); ++g) {
+			occluded_instances += group_occluded[g];
+			occluded_triangles += group_occluded[g] * group_triangles[g];
+		}
+	}
+
+	// Patch indirect commands (base instance points into this frame's region of visible instances, see get_base_instance())
+	if (indirect_buffer) {
+		DrawElementsIndirectCommand *commands = (DrawElementsIndirectCommand *)stream_alloc(command_stream, sizeof(DrawElementsIndirectCommand) * draw_commands.size(), &offset);
+		for (size_t i = 0; i < draw_commands.size(); ++i) {
+			DrawElementsIndirectCommand cmd = draw_commands[i];
+			cmd.instance_count = group_visible[draw_instance_group[i]];
+			cmd.base_instance = get_base_instance(cull_region, i);
+			commands[i] = cmd;
+		}
+		stream_flush(command_stream);
+	}
+}
+
+
+//! Copy one of the arrays of `sorted_commands` into the region of the current frame (to `sorted_offsets[array]`).
+//! Translucent instances are dropped for this frame, if they don't fit.
+static
+void stream_sorted_data(uint32_t array, const void *data, GLsizeiptr size)
+{
+	void *dst = stream_alloc(sorted_stream, size, &sorted_offsets[array]);
+	if (dst)
+		memcpy(dst, data, size);
+	else
+		sorted_commands.clear();
+}
+
+
+//! Sort visible translucent instances back-to-front and build an indirect command for every one of them.
+//! @param region Region of `visible_buffer` filled by cull_instances()
+static
+void sort_translucent_instances(uint32_t region)
+{
+	PROFILE_ZONE("sort_translucent");
+	const DrawRange &range = alpha_draw_ranges[ALPHA_TRANSLUCENT];
+	translucent_items.clear();
+	translucent_keys.clear();
+
+	// View-space depth of a point is its clip-space w, so the keys don't depend on the direction to the camera
+	const glm::vec4 depth_row(view_proj[0][3], view_proj[1][3], view_proj[2][3], view_proj[3][3]);
+	for (uint32_t d = 0; d < range.count; ++d) {
+		const uint32_t g = draw_instance_group[range.first + d];
+		const InstanceGroup &group = instance_groups[g];
+		for (uint32_t slot = group.base_instance; slot < group.base_instance + group_visible[g]; ++slot) {
+			const uint32_t idx = translucent_visible[slot];
+			const float depth = glm::dot(depth_row, glm::vec4(instance_bounds.x[idx], instance_bounds.y[idx], instance_bounds.z[idx], 1.0f));
+			translucent_keys.push_back(~float_to_sortable(depth)); // The farthest first
+			translucent_items.push_back(glm::uvec2(d, slot));
+		}
+	}
+	const uint32_t count = translucent_keys.size();
+	translucent_order.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+		translucent_order[i] = i;
+	radix_sort(translucent_keys.data(), translucent_order.data(), count, translucent_scratch);
+
+	const bool draw_attribute = (PATH_DRAW_ATTRIBUTE == render_path);
+	sorted_commands.resize(count);
+	sorted_texture_indices.resize(count);
+	sorted_texture_handles.resize(count);
+	sorted_draw_data.resize(draw_attribute ? count : 0);
+	sorted_batches.clear();
+	for (uint32_t i = 0; i < count; ++i) {
+		const glm::uvec2 &item = translucent_items[translucent_order[i]];
+		const DrawCall &dc = translucent_draw_calls[item.x];
+		DrawElementsIndirectCommand cmd = draw_commands[range.first + item.x];
+		cmd.instance_count = 1;
+		cmd.base_instance = draw_attribute ? i : region * num_instances + item.y;
+		sorted_commands[i] = cmd;
+		if (draw_attribute) // Slots are absolute, the shader doesn't offset them by the region
+			sorted_draw_data[i] = glm::uvec2(region * num_instances + item.y, dc.tex_index);
+		sorted_texture_indices[i] = dc.tex_index;
+		sorted_texture_handles[i] = tex_handles[dc.texture_array];
+
+		if (sorted_batches.empty() || sorted_batches.back().tex_array != dc.texture_array) {
+			MultiDrawCall mdc = {};
+			mdc.indirect_offset = sizeof(DrawElementsIndirectCommand) * i;
+			mdc.tex_array = dc.texture_array;
+			mdc.texid_offset = i;
+			mdc.alpha_class = ALPHA_TRANSLUCENT;
+			sorted_batches.push_back(mdc);
+		}
+		++sorted_batches.back().indirect_count;
+	}
+
+	// The GPU may still read regions of the previous frames, so this frame writes its own one
+	begin_stream_frame(sorted_stream);
+	if (indirect_buffer && 0 < count)
+		stream_sorted_data(0, sorted_commands.data(), sizeof(DrawElementsIndirectCommand) * count);
+	if (draw_attribute && 0 < count)
+		stream_sorted_data(3, sorted_draw_data.data(), sizeof(glm::uvec2) * count);
+	if (supported_paths[PATH_MDI_PER_ARRAY] && 0 < count) {
+		stream_sorted_data(1, sorted_texture_indices.data(), sizeof(GLuint) * count);
+		if (has_bindless_textures)
+			stream_sorted_data(2, sorted_texture_handles.data(), sizeof(GLuint64) * count);
+	}
+	stream_flush(sorted_stream);
+}
+
+
+//! Compare results of GPU culling of the current frame with the CPU reference.
+//! The GPU may disagree only about spheres which are (almost) touching the frustum.
+static
+bool check_gpu_culling(const CullingFrustum &frustum)
+{
+	PROFILE_ZONE("verify_gpu_culling");
+	std::vector<uint32_t> gpu_counts(instance_groups.size());
+	std::vector<uint32_t> gpu_visible(num_instances);
+	GLuint header[2] = {};
+	glBindBuffer(GL_COPY_READ_BUFFER, group_visible_buffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(uint32_t) * gpu_counts.size(), gpu_counts.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, visible_buffer);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(uint32_t) * num_instances, gpu_visible.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, compact_indirect_buffers[0]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(header), header);
+
+	uint32_t mismatches = 0;
+	uint32_t visible_instances = 0;
+	std::vector<uint32_t> inner(num_instances), outer(num_instances);
+	for (uint32_t g = 0; g < instance_groups.size(); ++g) {
+		const InstanceGroup &group = instance_groups[g];
+		const uint32_t *gpu = &gpu_visible[group.base_instance];
+		const uint32_t gpu_count = gpu_counts[g];
+		uint32_t *in = &inner[group.base_instance];
+		uint32_t *out = &outer[group.base_instance];
+		uint32_t inner_count = cull_spheres_scalar(frustum, verify_bounds_inner, group.base_instance, group.count, in);
+		uint32_t outer_count = cull_spheres_scalar(frustum, verify_bounds_outer, group.base_instance, group.count, out);
+		if (!lod_ranges.empty()) {
+			inner_count = std::remove_if(in, in + inner_count, [](uint32_t idx) { return !is_lod_selected(idx, -VERIFY_CULL_EPSILON); }) - in;
+			outer_count = std::remove_if(out, out + outer_count, [](uint32_t idx) { return !is_lod_selected(idx, VERIFY_CULL_EPSILON); }) - out;
+		}
+		visible_instances += gpu_count;
+
+		// Both lists are sorted, since the compaction keeps the order of instances
+		const bool valid = (inner_count <= gpu_count) && (gpu_count <= outer_count)
+			&& std::includes(gpu, gpu + gpu_count, in, in + inner_count)
+			&& std::includes(out, out + outer_count, gpu, gpu + gpu_count);
+		if (!valid && mismatches++ < 10)
+			fprintf(stderr, "ERROR: GPU culled instance group %u differently (gpu=%u, cpu=%u..%u)\n", g, gpu_count, inner_count, outer_count);
+	}
+
+	// Only opaque draw calls are compacted
+	uint32_t draw_count = 0;
+	for (size_t i = 0; i < alpha_draw_ranges[ALPHA_OPAQUE].count; ++i)
+		draw_count += (0 < gpu_counts[draw_instance_group[i]]) ? 1 : 0;
+	if (header[0] != draw_count || header[1] != visible_instances) {
+		fprintf(stderr, "ERROR: GPU culling reports %u draws and %u instances, expected %u and %u\n", header[0], header[1], draw_count, visible_instances);
+		++mismatches;
+	}
+
+	if (0 == mismatches)
+		++gpu_cull_verified;
+	return 0 == mismatches;
+}
+
+
+//! GPU counterpart of cull_instances().
+//! Results of phase 2 of occlusion culling go to the second region and the second set of compacted buffers.
+//! @returns Status for render() - non-zero if verification against the CPU failed.
+static
+int cull_instances_gpu(CullPhase phase)
+{
+	PROFILE_ZONE("cull_gpu");
+	PROFILE_GPU_BEGIN("cull");
+	const uint32_t region = (CULL_OCCLUSION == phase) ? 1 : 0;
+
+	// Statistics of an older frame should be available by now, so reading them doesn't stall
+	if (CULL_OCCLUSION != phase && gpu_cull_frame >= CULL_FRAMES) {
+		GLuint headers[CULL_PHASES][GPU_CULL_HEADER_SIZE / sizeof(GLuint)] = {};
+		glBindBuffer(GL_COPY_READ_BUFFER, gpu_cull_stats[gpu_cull_frame % CULL_FRAMES]);
+		glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizeof(headers), headers);
+		culled_instances = num_instances - headers[0][1] - headers[1][1];
+		occluded_instances = headers[1][2];
+		occluded_triangles = headers[1][3];
+	}
+
+	const CullingFrustum frustum = make_culling_frustum(view_proj, view_pos, cull_distance);
+	const GLuint zero[4] = { 0, 0, 0, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, compact_indirect_buffers[region]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zero), zero);
+
+	// Cull instances and compact the visible ones within their groups
+	glUseProgram(cull_program);
+	glUniform4fv(CULL_PLANES_UNIFORM, 6, glm::value_ptr(frustum.planes[0]));
+	glUniform4f(CULL_CAMERA_UNIFORM, frustum.camera.x, frustum.camera.y, frustum.camera.z, frustum.max_distance);
+	glUniformMatrix4fv(CULL_CLIP_FROM_WORLD_UNIFORM, 1, GL_FALSE, glm::value_ptr(view_proj));
+	glUniform1ui(CULL_PHASE_UNIFORM, phase);
+	glUniform1ui(CULL_VISIBLE_OFFSET_UNIFORM, region * num_instances);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, bounds_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, groups_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visible_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, group_visible_buffer);
+	glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, compact_indirect_buffers[region], 0, GPU_CULL_HEADER_SIZE);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, lod_ranges_buffer);
+	if (occlusion_culling) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, last_visible_buffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, group_triangles_buffer);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, depth_pyramid);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	glDispatchCompute(instance_groups.size(), 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Emit commands
+	glUseProgram(emit_program);
+	glUniform1ui(EMIT_NUM_COMMANDS_UNIFORM, draw_commands.size());
+	glUniform1ui(EMIT_COMMAND_OFFSET_UNIFORM, region * draw_commands.size());
+	glUniform1ui(EMIT_INSTANCE_OFFSET_UNIFORM, region * num_instances);
+	glUniform1ui(EMIT_NUM_COMPACTED_UNIFORM, alpha_draw_ranges[ALPHA_OPAQUE].count);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, command_template_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, group_visible_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, indirect_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, compact_indirect_buffers[region]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, texid_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, compact_texid_buffers[region]);
+	if (has_bindless_textures) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, texhandle_buffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, compact_texhandle_buffers[region]);
+	}
+	glDispatchCompute((draw_commands.size() + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	// Keep statistics of the whole frame once its last phase is done
+	if (!occlusion_culling || CULL_OCCLUSION == phase) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, gpu_cull_stats[gpu_cull_frame % CULL_FRAMES]);
+		for (uint32_t i = 0; i <= region; ++i) {
+			glBindBuffer(GL_COPY_READ_BUFFER, compact_indirect_buffers[i]);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, i * GPU_CULL_HEADER_SIZE, GPU_CULL_HEADER_SIZE);
+		}
+		++gpu_cull_frame;
+	}
+
+	glUseProgram(programs[render_path]);
+	PROFILE_GPU_END();
+
+	if (verify_gpu_culling && !check_gpu_culling(frustum))
+		return 6;
+	return 0;
+}
+
+
+//! (Re)create the offscreen framebuffer and the depth pyramid for the current window size.
+static
+bool create_occlusion_targets()
+{
+	glDeleteFramebuffers(1, &occlusion_fbo);
+	glDeleteRenderbuffers(1, &occlusion_color);
+	glDeleteTextures(1, &occlusion_depth);
+	glDeleteTextures(1, &depth_pyramid);
+	occlusion_width = window_width;
+	occlusion_height = window_height;
+
+	glGenRenderbuffers(1, &occlusion_color);
+	glBindRenderbuffer(GL_RENDERBUFFER, occlusion_color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, occlusion_width, occlusion_height);
+
+	glGenTextures(1, &occlusion_depth);
+	glBindTexture(GL_TEXTURE_2D, occlusion_depth);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, occlusion_width, occlusion_height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+	// Level 0 has the size of the viewport, so the culling shader can work with window coordinates
+	pyramid_levels = 1;
+	while ((std::max(occlusion_width, occlusion_height) >> pyramid_levels) > 0)
+		++pyramid_levels;
+	glGenTextures(1, &depth_pyramid);
+	glBindTexture(GL_TEXTURE_2D, depth_pyramid);
+	glTexStorage2D(GL_TEXTURE_2D, pyramid_levels, GL_R32F, occlusion_width, occlusion_height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &occlusion_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, occlusion_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, occlusion_color);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, occlusion_depth, 0);
+	const bool complete = (GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER));
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+
+//! (Re)create the offscreen framebuffer of the visibility buffer for the current window size.
+//! Color goes to attachment 0 and IDs to attachment 1, passes select one of them with glDrawBuffers().
+static
+bool create_visibility_targets()
+{
+	glDeleteFramebuffers(1, &vis_fbo);
+	glDeleteRenderbuffers(1, &vis_color);
+	glDeleteTextures(1, &vis_ids);
+	glDeleteRenderbuffers(1, &vis_depth);
+	vis_width = window_width;
+	vis_height = window_height;
+
+	glGenRenderbuffers(1, &vis_color);
+	glBindRenderbuffer(GL_RENDERBUFFER, vis_color);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, vis_width, vis_height);
+	glGenRenderbuffers(1, &vis_depth);
+	glBindRenderbuffer(GL_RENDERBUFFER, vis_depth);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, vis_width, vis_height);
+
+	glGenTextures(1, &vis_ids);
+	glBindTexture(GL_TEXTURE_2D, vis_ids);
+	glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, vis_width, vis_height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &vis_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, vis_fbo);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, vis_color);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, vis_ids, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, vis_depth);
+	const GLenum color_buffers[] = { GL_COLOR_ATTACHMENT0, GL_NONE };
+	glDrawBuffers(2, color_buffers);
+	const bool complete = (GL_FRAMEBUFFER_COMPLETE == glCheckFramebufferStatus(GL_FRAMEBUFFER));
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+
+//! Reduce the depth buffer of phase 1 to a pyramid of the farthest depths.
+static
+void build_depth_pyramid()
+{
+	PROFILE_ZONE("depth_pyramid");
+	PROFILE_GPU_BEGIN("depth_pyramid");
+	glUseProgram(pyramid_program);
+	glActiveTexture(GL_TEXTURE2);
+	for (int level = 0; level < pyramid_levels; ++level) {
+		// Level 0 is a copy of the depth buffer, each other level reduces the previous one
+		glBindTexture(GL_TEXTURE_2D, (0 == level) ? occlusion_depth : depth_pyramid);
+		glUniform1i(PYRAMID_SOURCE_LEVEL_UNIFORM, (0 == level) ? 0 : level - 1);
+		glUniform1i(PYRAMID_SCALE_UNIFORM, (0 == level) ? 1 : 2);
+		glBindImageTexture(0, depth_pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		const int width = std::max(occlusion_width >> level, 1);
+		const int height = std::max(occlusion_height >> level, 1);
+		glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glUseProgram(programs[render_path]);
+	PROFILE_GPU_END();
+}
+
+
+//! Do vertex shaders of the current render path pull vertices from storage buffers?
+static
+bool use_vertex_pulling()
+{
+	return vertex_pulling && uses_draw_parameters(render_path);
+}
+
+
+//! Compute ClipFromObject of visible instance slots in given region of `visible_buffer` (for vertex pulling).
+//! GPU culling lists and counts the slots itself, so the pass is dispatched indirectly without any readback.
+static
+void compute_clip_matrices(uint32_t region)
+{
+	PROFILE_GPU_BEGIN("clip_matrices");
+	glUseProgram(clip_program);
+	glUniformMatrix4fv(CLIP_VIEW_PROJ_MATRIX_UNIFORM, 1, GL_FALSE, glm::value_ptr(view_proj));
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, visible_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, clip_buffer);
+	if (gpu_clip_slots) {
+		glUniform1ui(CLIP_SLOT_OFFSET_UNIFORM, region * num_instances);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clip_slots_buffer);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, compact_indirect_buffers[region], 0, GPU_CULL_HEADER_SIZE);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, compact_indirect_buffers[region]);
+		glDispatchComputeIndirect(4 * sizeof(GLuint)); // after the counters
+	} else if (gpu_culling) {
+		// Slots list themselves, so all of them are computed
+		glUniform1ui(CLIP_SLOT_OFFSET_UNIFORM, region * num_instances);
+		glUniform1ui(CLIP_NUM_SLOTS_UNIFORM, num_instances);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, clip_slots_buffer);
+		glDispatchCompute((num_instances + 63) / 64, 1, 1);
+	} else {
+		// Visible instances of every group are compacted at its beginning
+		begin_stream_frame(clip_slot_stream);
+		GLintptr offset = 0;
+		uint32_t *slots = (uint32_t *)stream_alloc(clip_slot_stream, sizeof(uint32_t) * num_instances, &offset);
+		uint32_t num_slots = 0;
+		for (size_t g = 0; g < instance_groups.size(); ++g) {
+			const uint32_t first = region * num_instances + instance_groups[g].base_instance;
+			for (uint32_t i = 0; i < group_visible[g]; ++i)
+				slots[num_slots++] = first + i;
+		}
+		stream_flush(clip_slot_stream);
+		glUniform1ui(CLIP_SLOT_OFFSET_UNIFORM, 0);
+		glUniform1ui(CLIP_NUM_SLOTS_UNIFORM, num_slots);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 2, clip_slot_stream.buffer, offset, sizeof(uint32_t) * std::max(num_slots, 1u));
+		if (0 < num_slots)
+			glDispatchCompute((num_slots + 63) / 64, 1, 1);
+	}
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	// Vertex shaders pull from bindings, which no other pass uses
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, baked_buffers[1]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, baked_buffers[2]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, baked_buffers[3]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, clip_buffer);
+	glUseProgram(programs[render_path]);
+	PROFILE_GPU_END();
+}
+
+
+//! Background thread reading (and decompressing) texture arrays in the order of their priority.
+static
+void texture_streaming_thread()
+{
+	FILE *blob = fopen("texturebuckets.blob", "rb");
+	for (uint32_t split : stream_order) {
+		PROFILE_ZONE("stream_texture");
+		const TextureSplit &ts = texture_splits[split];
+		uint8_t *texels = (uint8_t *)malloc(ts.size);
+		fseek(blob, ts.data_offset, SEEK_SET);
+		fread_compressed(texels, 1, ts.size, blob);
+
+		// Don't run too far ahead of the uploads, otherwise we would keep the whole blob in memory
+		std::unique_lock<std::mutex> lock(stream_mutex);
+		stream_cv.wait(lock, [] { return stream_cancelled || streamed_splits.size() < MAX_PENDING_SPLITS; });
+		if (stream_cancelled) {
+			free(texels);
+			break;
+		}
+		StreamedSplit ss = { split, texels };
+		streamed_splits.push_back(ss);
+	}
+	fclose(blob);
+}
+
+
+//! Prioritize texture arrays by their usage around the camera and start streaming them in.
+static
+void start_texture_streaming()
+{
+	// Each instance contributes to the priority of all texture arrays it samples, closer ones more
+	std::vector<float> priority(texture_splits.size(), 0.0f);
+	for (const auto &draw_call_pair : ordered_draw_calls) {
+		const DrawCall &dc = draw_call_pair.second;
+		for (GLuint i = dc.base_instance; i < dc.base_instance + dc.num_instances; ++i) {
+			const float distance = glm::length(instance_positions[i] - cam_pos);
+			priority[dc.texture_array - 1] += 1.0f / std::max(distance, STREAM_NEAR_DISTANCE);
+		}
+	}
+
+	stream_order.resize(texture_splits.size());
+	for (uint32_t i = 0; i < stream_order.size(); ++i)
+		stream_order[i] = i;
+	std::stable_sort(stream_order.begin(), stream_order.end(), [&priority](uint32_t a, uint32_t b) {
+		return priority[a] > priority[b];
+	});
+
+	stream_start_time = SDL_GetPerformanceCounter();
+	stream_thread = std::thread(texture_streaming_thread);
+}
+
+
+//! Upload texture arrays that were streamed in since the last frame.
+static
+void upload_streamed_textures()
+{
+	if (splits_uploaded == texture_splits.size())
+		return;
+
+	PROFILE_ZONE("upload_textures");
+	std::vector<StreamedSplit> ready;
+	{
+		std::lock_guard<std::mutex> lock(stream_mutex);
+		size_t bytes = 0;
+		size_t count = 0;
+		while (count < streamed_splits.size() && (0 == count || bytes < STREAM_UPLOAD_BUDGET))
+			bytes += texture_splits[streamed_splits[count++].split].size;
+		ready.assign(streamed_splits.begin(), streamed_splits.begin() + count);
+		streamed_splits.erase(streamed_splits.begin(), streamed_splits.begin() + count);
+	}
+	stream_cv.notify_one();
+
+	for (const StreamedSplit &ss : ready) {
+		upload_texture_split(ss.split, ss.texels);
+		free(ss.texels);
+		++splits_uploaded;
+
+		// Replace placeholder handles of all draw calls sampling this array
+		const GLuint tex_array = ss.split + 1;
+		for (uint32_t alpha_class = 0; alpha_class < NUM_ALPHA_CLASSES; ++alpha_class) {
+			const DrawRange &range = texture_draw_ranges[NUM_ALPHA_CLASSES * tex_array + alpha_class];
+			if (texhandle_buffer && 0 < range.count) {
+				std::vector<GLuint64> handles(range.count, tex_handles[tex_array]);
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, texhandle_buffer);
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint64) * range.first, sizeof(GLuint64) * range.count, handles.data());
+			}
+		}
+	}
+	GL_CHECK();
+
+	if (splits_uploaded == texture_splits.size()) {
+		stream_thread.join();
+		const uint64_t elapsed = SDL_GetPerformanceCounter() - stream_start_time;
+		fprintf(stderr, "INFO: Streamed %u texture arrays in %g sec\n", splits_uploaded, elapsed / (double)SDL_GetPerformanceFrequency());
+	}
+}
+
+
+//! Stop the streaming thread (if it's still running) and release texels which were not uploaded.
+static
+void stop_texture_streaming()
+{
+	if (!stream_thread.joinable())
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(stream_mutex);
+		stream_cancelled = true;
+	}
+	stream_cv.notify_one();
+	stream_thread.join();
+
+	for (const StreamedSplit &ss : streamed_splits)
+		free(ss.texels);
+	streamed_splits.clear();
+}
+
+
+//! Compute view matrix of the camera placed at given position and orientation.
+static
+glm::mat4 camera_view(const glm::vec3 &position, float yaw, float pitch)
+{
+	glm::mat3 look_mat = glm::mat3(glm::rotate(glm::mat4(1.0f), yaw, glm::vec3(0.0f, 0.0, 1.0))
+		* glm::rotate(glm::mat4(1.0f), pitch, glm::vec3(1.0f, 0.0f, 0.0f)));
+	glm::vec3 fwd = look_mat * LOOK_DIR;
+
+	return glm::lookAt(position, position + fwd, look_mat[2]);
+}
+
+
+//! Recompute the projection matrix after the window or camera parameters changed.
+static
+void update_projection()
+{
+	proj_mat = glm::perspective(cam_fovy, window_width / (float)window_height, cam_near, cam_far);
+}
+
+
+//! Compute mean and percentiles of given samples and write them as JSON object.
+static
+void write_json_stats(FILE *out, const char *name, std::vector<float> values)
+{
+	if (values.empty()) {
+		fprintf(out, "\"%s\": null", name);
+		return;
+	}
+
+	std::sort(values.begin(), values.end());
+	double sum = 0.0;
+	for (float v : values)
+		sum += v;
+	const size_t last = values.size() - 1;
+	fprintf(out, "\"%s\": { \"mean\": %g, \"p50\": %g, \"p95\": %g, \"p99\": %g, \"max\": %g }",
+		name, sum / values.size(), values[last * 50 / 100], values[last * 95 / 100], values[last * 99 / 100], values[last]);
+}
+
+
+//! Write results of all benchmark runs to the output file.
+static
+bool write_bench_results()
+{
+	FILE *out = fopen(bench_output_file, "w");
+	if (!out)
+		return false;
+
+	fprintf(out, "{\n");
+	fprintf(out, "\t\"renderer\": \"%s\",\n", (const char *)glGetString(GL_RENDERER));
+	fprintf(out, "\t\"version\": \"%s\",\n", (const char *)glGetString(GL_VERSION));
+	fprintf(out, "\t\"camera_path\": \"%s\",\n", bench_camera_file);
+	fprintf(out, "\t\"width\": %i,\n", window_width);
+	fprintf(out, "\t\"height\": %i,\n", window_height);
+	fprintf(out, "\t\"warmup_frames\": %u,\n", BENCH_WARMUP_FRAMES);
+	fprintf(out, "\t\"frames\": %u,\n", bench_frames);
+	fprintf(out, "\t\"gl_debug_context\": %s,\n", gl_debug ? "true" : "false");
+	fprintf(out, "\t\"render_thread\": %s,\n", threaded_rendering ? "true" : "false");
+	fprintf(out, "\t\"culling\": \"%s\",\n", culling ? (gpu_culling ? "gpu" : "cpu") : "off");
+	fprintf(out, "\t\"occlusion_culling\": \"%s\",\n", occlusion_culling ? "hzb" : (software_occlusion ? "software" : "off"));
+	fprintf(out, "\t\"pvs\": %s,\n", pvs_culling ? "true" : "false");
+	fprintf(out, "\t\"vertex_pulling\": %s,\n", vertex_pulling ? "true" : "false");
+	if (lod_ranges.empty() || !lod_models)
+		fprintf(out, "\t\"lod_scale\": null,\n");
+	else
+		fprintf(out, "\t\"lod_scale\": %g,\n", lod_scale);
+	fprintf(out, "\t\"instances\": %u,\n", num_instances);
+	fprintf(out, "\t\"paths\": [\n");
+	for (size_t i = 0; i < bench_runs.size(); ++i) {
+		const BenchRun &run = bench_runs[i];
+		const std::vector<BenchSample> &samples = run.results;
+		std::vector<float> cpu_ms, gpu_ms, frame_ms, latency_ms, draw_calls, culled, occluded, occluded_triangles, triangles;
+		for (const BenchSample &sample : samples) {
+			cpu_ms.push_back(sample.cpu_ms);
+			gpu_ms.push_back(sample.gpu_ms);
+			frame_ms.push_back(sample.frame_ms);
+			latency_ms.push_back(sample.latency_ms);
+			draw_calls.push_back((float)sample.draw_calls);
+			culled.push_back((float)sample.culled_instances);
+			occluded.push_back((float)sample.occluded_instances);
+			occluded_triangles.push_back((float)sample.occluded_triangles);
+			if (!gpu_culling)
+				triangles.push_back((float)sample.triangles);
+		}
+
+		fprintf(out, "\t\t{\n");
+		fprintf(out, "\t\t\t\"name\": \"%s\",\n", RENDER_PATH_NAMES[run.path]);
+		fprintf(out, "\t\t\t\"gl_log\": \"%s\",\n", GL_LOG_MODE_NAMES[run.log_mode]);
+		fprintf(out, "\t\t\t\"depth_prepass\": %s,\n", run.depth_prepass ? "true" : "false");
+		fprintf(out, "\t\t\t\"visibility_buffer\": %s,\n", run.visibility_buffer ? "true" : "false");
+		fprintf(out, "\t\t\t\"gl_messages\": %llu,\n", (unsigned long long)run.gl_messages);
+		fprintf(out, "\t\t\t");
+		write_json_stats(out, "draw_calls", draw_calls);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "culled_instances", culled);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "occluded_instances", occluded);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "occluded_triangles", occluded_triangles);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "triangles", triangles);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "cpu_ms", cpu_ms);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "gpu_ms", gpu_ms);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "frame_ms", frame_ms);
+		fprintf(out, ",\n\t\t\t");
+		write_json_stats(out, "latency_ms", latency_ms);
+		fprintf(out, "\n\t\t}%s\n", (i + 1 < bench_runs.size()) ? "," : "");
+	}
+	fprintf(out, "\t]\n");
+	fprintf(out, "}\n");
+	fclose(out);
+	return true;
+}
+
+
+static
+void select_bench_run(const BenchRun &run)
+{
+	select_render_path(run.path);
+	depth_prepass = run.depth_prepass;
+	visibility_buffer = run.visibility_buffer;
+	if (gl_debug)
+		set_opengl_log_mode(GL_LOG_OFF != run.log_mode, GL_LOG_SYNC == run.log_mode);
+}
+
+
+//! Read the GPU time of given benchmarked frame (this blocks, if the result is not available yet).
+static
+void collect_bench_query(uint32_t frame)
+{
+	GLuint64 elapsed_ns = 0;
+	glGetQueryObjectui64v(bench_queries[frame % BENCH_QUERY_LATENCY], GL_QUERY_RESULT, &elapsed_ns);
+	bench_samples[frame].gpu_ms = elapsed_ns / 1000000.0f;
+}
+
+
+//! Tell for every benchmarked render path, whether an option (depth pre-pass or visibility buffer) paid off
+//! by the median GPU time. Runs are compared only if they differ just by that option.
+static
+void print_bench_verdicts(bool BenchRun::*option, const char *name, const char *argument)
+{
+	bool BenchRun::*other = (&BenchRun::depth_prepass == option) ? &BenchRun::visibility_buffer : &BenchRun::depth_prepass;
+	for (const BenchRun &with : bench_runs) {
+		if (!(with.*option) || with.results.empty())
+			continue;
+		for (const BenchRun &without : bench_runs) {
+			if (without.*option || without.*other != with.*other || without.path != with.path || without.log_mode != with.log_mode || without.results.empty())
+				continue;
+			std::vector<float> with_ms, without_ms;
+			for (const BenchSample &sample : with.results)
+				with_ms.push_back(sample.gpu_ms);
+			for (const BenchSample &sample : without.results)
+				without_ms.push_back(sample.gpu_ms);
+			std::sort(with_ms.begin(), with_ms.end());
+			std::sort(without_ms.begin(), without_ms.end());
+			const float a = with_ms[with_ms.size() / 2], b = without_ms[without_ms.size() / 2];
+			fprintf(stderr, "INFO: %s on render path '%s': %.3f ms vs. %.3f ms GPU time (median), %s%s\n",
+				name, RENDER_PATH_NAMES[with.path], a, b, (a < b) ? "use " : "not worth it", (a < b) ? argument : "");
+		}
+	}
+}
+
+
+//! Advance the benchmark by one frame (on the thread owning the OpenGL context).
+//! @returns Status for render() - negative once all runs are measured.
+static
+int update_benchmark()
+{
+	const uint32_t total_frames = BENCH_WARMUP_FRAMES + bench_frames;
+	if (total_frames == bench_frame) {
+		// Finish measurements of the current run
+		for (uint32_t f = total_frames - std::min(total_frames, BENCH_QUERY_LATENCY); f < total_frames; ++f)
+			collect_bench_query(f);
+		BenchRun &run = bench_runs[bench_run_idx];
+		run.results.assign(bench_samples.begin() + BENCH_WARMUP_FRAMES, bench_samples.end());
+		run.gl_messages = opengl_log_message_count() - bench_gl_messages;
+		fprintf(stderr, "INFO: Benchmarked render path '%s' (OpenGL log: %s, depth pre-pass: %s, visibility buffer: %s)\n",
+			RENDER_PATH_NAMES[run.path], GL_LOG_MODE_NAMES[run.log_mode], run.depth_prepass ? "on" : "off", run.visibility_buffer ? "on" : "off");
+		if (!run.results.empty()) {
+			// Throughput and latency are what --render-thread trades against each other
+			std::vector<float> frame_ms, latency_ms;
+			for (const BenchSample &sample : run.results) {
+				frame_ms.push_back(sample.frame_ms);
+				latency_ms.push_back(sample.latency_ms);
+			}
+			std::sort(frame_ms.begin(), frame_ms.end());
+			std::sort(latency_ms.begin(), latency_ms.end());
+			fprintf(stderr, "INFO: %.3f ms per frame, %.3f ms latency (median, render thread: %s)\n",
+				frame_ms[frame_ms.size() / 2], latency_ms[latency_ms.size() / 2], threaded_rendering ? "on" : "off");
+		}
+
+		if (++bench_run_idx == bench_runs.size()) {
+			if (bench_prepass)
+				print_bench_verdicts(&BenchRun::depth_prepass, "Depth pre-pass", "--depth-prepass");
+			if (bench_visibility)
+				print_bench_verdicts(&BenchRun::visibility_buffer, "Visibility buffer", "--visibility-buffer");
+			if (!write_bench_results()) {
+				fprintf(stderr, "ERROR: Cannot write benchmark results to '%s'\n", bench_output_file);
+				return 5;
+			}
+			fprintf(stderr, "INFO: Benchmark results written to '%s'\n", bench_output_file);
+			return -1;
+		}
+
+		select_bench_run(bench_runs[bench_run_idx]);
+		bench_frame = 0;
+	}
+
+	// Every run sees exactly the same sequence of frames
+	if (0 == bench_frame)
+		bench_samples.assign(total_frames, BenchSample());
+	if (BENCH_WARMUP_FRAMES == bench_frame)
+		bench_gl_messages = opengl_log_message_count();
+	const CameraKey key = sample_camera_path(camera_path, bench_frame * camera_path.tick_micros);
+	view_proj = proj_mat * camera_view(key.position, key.yaw, key.pitch);
+	view_pos = key.position;
+	draw_call_counter = 0;
+	return 0;
+}
+
+
+//! Prepare measurements of all supported render paths, or just the one selected by --path (each with all OpenGL
+//! log modes and with and without the depth pre-pass and the visibility buffer, if requested).
+//! The pre-pass is never combined with the latter.
+static
+int start_benchmark()
+{
+	if (0 == bench_frames)
+		bench_frames = camera_path.keys.size();
+
+	for (int path = 0; path < NUM_RENDER_PATHS; ++path) {
+		if (!supported_paths[path] || (NUM_RENDER_PATHS != forced_path && path != render_path))
+			continue;
+		for (int mode = 0; mode < NUM_GL_LOG_MODES; ++mode) {
+			if (bench_gl_log || mode == gl_log_mode) {
+				for (int prepass = 0; prepass < 2; ++prepass) {
+					if (!bench_prepass && prepass != (depth_prepass ? 1 : 0))
+						continue;
+					for (int vis = 0; vis < 2; ++vis) {
+						const bool selected = bench_visibility ? (0 == vis || uses_draw_parameters((RenderPath)path)) : vis == ((visibility_buffer && uses_draw_parameters((RenderPath)path)) ? 1 : 0);
+						if (selected && !(prepass && vis)) {
+							BenchRun run = { (RenderPath)path, (GlLogMode)mode, prepass != 0, vis != 0, {}, 0 };
+							bench_runs.push_back(run);
+						}
+					}
+				}
+			}
+		}
+	}
+	select_bench_run(bench_runs.front());
+
+	glGenQueries(BENCH_QUERY_LATENCY, bench_queries);
+	bench_prev_swap = SDL_GetPerformanceCounter();
+	return 0;
+}
+
+
+//! Print statistics of the most interesting profiler zones.
+static
+void print_profiler_stats()
+{
+	for (const char *zone : PROFILED_ZONES) {
+		ProfileStats stats;
+		if (!profiler_zone_stats(zone, stats))
+			continue;
+		fprintf(stderr, "PROFILE: %-16s n=%-6u mean=%9.1f us  min=%9.1f us  max=%9.1f us  |", zone, stats.count, stats.mean_us, stats.min_us, stats.max_us);
+		for (int i = 0; i < PROFILER_HISTOGRAM_BUCKETS; ++i)
+			fprintf(stderr, " %u", stats.histogram[i]);
+		fprintf(stderr, "\n");
+	}
+}
+
+
+static
+void write_profiler_trace()
+{
+	const char *filename = trace_file ? trace_file : "trace.json";
+	if (profiler_write_trace(filename))
+		fprintf(stderr, "INFO: Profiler trace written to '%s'\n", filename);
+	else
+		fprintf(stderr, "WARNING: Cannot write profiler trace (is the profiler enabled in this build?)\n");
+}
+
+
+static
+GLenum parse_debug_severity(const char *name)
+{
+	if (0 == strcmp("notification", name))
+		return GL_DEBUG_SEVERITY_NOTIFICATION;
+	if (0 == strcmp("medium", name))
+		return GL_DEBUG_SEVERITY_MEDIUM;
+	if (0 == strcmp("high", name))
+		return GL_DEBUG_SEVERITY_HIGH;
+	if (0 != strcmp("low", name))
+		fprintf(stderr, "WARNING: Unknown debug message severity '%s', using 'low'\n", name);
+	return GL_DEBUG_SEVERITY_LOW;
+}
+
+
+static
+RenderPath parse_render_path(const char *name)
+{
+	for (int path = 0; path < NUM_RENDER_PATHS; ++path)
+		if (0 == strcmp(RENDER_PATH_NAMES[path], name))
+			return (RenderPath)path;
+	fprintf(stderr, "WARNING: Unknown render path '%s', taking the fastest one\n", name);
+	return NUM_RENDER_PATHS;
+}
+
+
+static
+void parse_arguments(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		if (0 == strcmp("--progressive", argv[i]))
+			progressive_textures = true;
+		else if (0 == strcmp("--bench", argv[i]) && i + 1 < argc)
+			bench_camera_file = argv[++i];
+		else if (0 == strcmp("--frames", argv[i]) && i + 1 < argc)
+			bench_frames = (uint32_t)atoi(argv[++i]);
+		else if (0 == strcmp("--output", argv[i]) && i + 1 < argc)
+			bench_output_file = argv[++i];
+		else if (0 == strcmp("--headless", argv[i]))
+			headless = true;
+		else if (0 == strcmp("--record", argv[i]) && i + 1 < argc)
+			record_camera_file = argv[++i];
+		else if (0 == strcmp("--replay", argv[i]) && i + 1 < argc)
+			replay_camera_file = argv[++i];
+		else if (0 == strcmp("--trace", argv[i]) && i + 1 < argc)
+			trace_file = argv[++i];
+		else if (0 == strcmp("--gl-debug", argv[i]))
+			gl_debug = true;
+		else if (0 == strcmp("--gl-log-sync", argv[i]))
+			gl_log_mode = GL_LOG_SYNC;
+		else if (0 == strcmp("--gl-log-severity", argv[i]) && i + 1 < argc)
+			gl_log_severity = parse_debug_severity(argv[++i]);
+		else if (0 == strcmp("--gl-log-ignore", argv[i]) && i + 1 < argc)
+			gl_log_ignored.push_back((GLuint)strtoul(argv[++i], NULL, 0));
+		else if (0 == strcmp("--bench-gl-log", argv[i]))
+			bench_gl_log = true;
+		else if (0 == strcmp("--no-culling", argv[i]))
+			culling = false;
+		else if (0 == strcmp("--no-cluster-culling", argv[i]))
+			cluster_culling = false;
+		else if (0 == strcmp("--cull-distance", argv[i]) && i + 1 < argc)
+			cull_distance = (float)atof(argv[++i]);
+		else if (0 == strcmp("--gpu-culling", argv[i]))
+			gpu_culling = true;
+		else if (0 == strcmp("--verify-gpu-culling", argv[i]))
+			gpu_culling = verify_gpu_culling = true;
+		else if (0 == strcmp("--occlusion-culling", argv[i]))
+			gpu_culling = occlusion_culling = true;
+		else if (0 == strcmp("--software-occlusion", argv[i]))
+			software_occlusion = true;
+		else if (0 == strcmp("--pvs", argv[i]))
+			pvs_culling = true;
+		else if (0 == strcmp("--meshlet-stats", argv[i]))
+			meshlet_stats = true;
+		else if (0 == strcmp("--no-lod", argv[i]))
+			lod_models = false;
+		else if (0 == strcmp("--lod-scale", argv[i]) && i + 1 < argc)
+			lod_scale = (float)atof(argv[++i]);
+		else if (0 == strcmp("--depth-prepass", argv[i]))
+			depth_prepass = true;
+		else if (0 == strcmp("--bench-prepass", argv[i]))
+			bench_prepass = true;
+		else if (0 == strcmp("--visibility-buffer", argv[i]))
+			visibility_buffer = true;
+		else if (0 == strcmp("--bench-visibility", argv[i]))
+			bench_visibility = true;
+		else if (0 == strcmp("--bench-screenshots", argv[i]) && i + 1 < argc)
+			bench_screenshot_prefix = argv[++i];
+		else if (0 == strcmp("--vertex-pulling", argv[i]))
+			vertex_pulling = true;
+		else if (0 == strcmp("--no-translucent-sort", argv[i]))
+			sort_translucent = false;
+		else if (0 == strcmp("--bench-sort", argv[i]) && i + 1 < argc)
+			bench_sort_count = (uint32_t)atoi(argv[++i]);
+		else if (0 == strcmp("--path", argv[i]) && i + 1 < argc)
+			forced_path = parse_render_path(argv[++i]);
+		else if (0 == strcmp("--render-thread", argv[i]))
+			threaded_rendering = true;
+		else if (0 == strcmp("--autotune", argv[i]))
+			autotune = true;
+		else
+			fprintf(stderr, "WARNING: Unknown argument '%s'\n", argv[i]);
+	}
+
+	if (bench_camera_file && progressive_textures) {
+		fprintf(stderr, "WARNING: Benchmark waits for all textures, ignoring --progressive\n");
+		progressive_textures = false;
+	}
+	if (autotune && (NUM_RENDER_PATHS != forced_path || bench_camera_file)) {
+		fprintf(stderr, "WARNING: Render path is forced or benchmarked, ignoring --autotune\n");
+		autotune = false;
+	}
+	if (bench_gl_log)
+		gl_debug = true; // Toggling the log requires debug context
+	if (!gl_debug)
+		gl_log_mode = GL_LOG_OFF;
+}
+
+
+//! Measure radix_sort() of random depth keys against std::sort() and quit (--bench-sort).
+//! @returns Negative status on success (to quit), positive if the result is not sorted
+static
+int run_sort_benchmark(uint32_t count)
+{
+	std::vector<uint32_t> keys(count), values(count);
+	std::vector<uint64_t> pairs(count);
+	std::vector<float> radix_ms, std_ms;
+	RadixSortScratch scratch;
+	uint32_t seed = 12345;
+	for (uint32_t run = 0; run < SORT_BENCH_RUNS; ++run) {
+		for (uint32_t i = 0; i < count; ++i) {
+			seed = seed * 1664525u + 1013904223u; // Numerical Recipes LCG
+			const float depth = cam_near + (cam_far - cam_near) * (seed >> 8) / (float)(1 << 24);
+			keys[i] = ~float_to_sortable(depth);
+			values[i] = i;
+			pairs[i] = ((uint64_t)keys[i] << 32) | i;
+		}
+
+		uint64_t start = SDL_GetPerformanceCounter();
+		radix_sort(keys.data(), values.data(), count, scratch);
+		uint64_t end = SDL_GetPerformanceCounter();
+		radix_ms.push_back(1000.0f * (end - start) / SDL_GetPerformanceFrequency());
+
+		start = SDL_GetPerformanceCounter();
+		std::sort(pairs.begin(), pairs.end());
+		end = SDL_GetPerformanceCounter();
+		std_ms.push_back(1000.0f * (end - start) / SDL_GetPerformanceFrequency());
+
+		// Both sorts are stable (std::sort thanks to values in the low bits), so they have to agree exactly
+		for (uint32_t i = 0; i < count; ++i) {
+			if (pairs[i] != (((uint64_t)keys[i] << 32) | values[i])) {
+				fprintf(stderr, "ERROR: Radix sort of %u keys differs from std::sort at %u\n", count, i);
+				return 8;
+			}
+		}
+	}
+
+	std::sort(radix_ms.begin(), radix_ms.end());
+	std::sort(std_ms.begin(), std_ms.end());
+	fprintf(stderr, "INFO: Sorting %u keys (median of %u runs): radix_sort %.3f ms, std::sort %.3f ms\n",
+		count, SORT_BENCH_RUNS, radix_ms[radix_ms.size() / 2], std_ms[std_ms.size() / 2]);
+	return -1;
+}
+
+
+//! Describe options, which change the work of render paths, as space-separated `name=value` pairs.
+//! A path autotuned with different ones may not be the fastest anymore.
+static
+void format_autotune_options(char *options, size_t size)
+{
+	char lod[32] = "off";
+	if (!lod_ranges.empty() && lod_models)
+		snprintf(lod, sizeof(lod), "%g", lod_scale);
+	snprintf(options, size, "culling=%s occlusion=%s pvs=%i clusters=%i cull_distance=%g lod_scale=%s prepass=%i visibility=%i vertex_pulling=%i translucent_sort=%i",
+		culling ? (gpu_culling ? "gpu" : "cpu") : "off", occlusion_culling ? "hzb" : (software_occlusion ? "software" : "off"),
+		pvs_culling ? 1 : 0, cluster_culling ? 1 : 0, cull_distance, lod, depth_prepass ? 1 : 0, visibility_buffer ? 1 : 0,
+		vertex_pulling ? 1 : 0, sort_translucent ? 1 : 0);
+}
+
+
+//! Find the render path autotuned for given GPU, driver and options in AUTOTUNE_CACHE_FILE.
+//! Every line holds name of the path, GL_RENDERER, GL_VERSION and format_autotune_options() separated by tabs
+//! (the last match wins).
+//! @returns NUM_RENDER_PATHS, if there is no supported one
+static
+RenderPath read_autotuned_path(const char *renderer, const char *version, const char *options)
+{
+	FILE *file = fopen(AUTOTUNE_CACHE_FILE, "r");
+	if (!file)
+		return NUM_RENDER_PATHS;
+
+	RenderPath result = NUM_RENDER_PATHS;
+	char line[1024];
+	while (fgets(line, sizeof(line), file)) {
+		line[strcspn(line, "\r\n")] = '\0';
+		char *line_renderer = strchr(line, '\t');
+		char *line_version = line_renderer ? strchr(line_renderer + 1, '\t') : NULL;
+		char *line_options = line_version ? strchr(line_version + 1, '\t') : NULL;
+		if (!line_options)
+			continue;
+		*line_renderer++ = '\0';
+		*line_version++ = '\0';
+		*line_options++ = '\0';
+		if (0 != strcmp(renderer, line_renderer) || 0 != strcmp(version, line_version) || 0 != strcmp(options, line_options))
+			continue;
+		const RenderPath path = parse_render_path(line);
+		if (NUM_RENDER_PATHS != path && supported_paths[path])
+			result = path;
+	}
+	fclose(file);
+	return result;
+}
+
+
+//! Select the render path with the lowest median GPU time of a full turn of the camera (--autotune).
+//! The result is cached per GPU, driver and options, so the measurement runs only once for each combination.
+//! @returns Status of render(), if it failed
+static
+int autotune_render_path()
+{
+	const char *renderer = (const char *)glGetString(GL_RENDERER);
+	const char *version = (const char *)glGetString(GL_VERSION);
+	char options[256];
+	format_autotune_options(options, sizeof(options));
+	const RenderPath cached = read_autotuned_path(renderer, version, options);
+	if (NUM_RENDER_PATHS != cached) {
+		select_render_path(cached);
+		fprintf(stderr, "INFO: Using render path '%s' autotuned for this GPU and options (delete '%s' to measure it again)\n", RENDER_PATH_NAMES[cached], AUTOTUNE_CACHE_FILE);
+		return 0;
+	}
+
+	// Paths render exactly the same frames without VSync. Textures may be still streamed in, but the
+	// placeholder is sampled by all paths alike.
+	SDL_GL_SetSwapInterval(0);
+	GLuint queries[AUTOTUNE_FRAMES];
+	glGenQueries(AUTOTUNE_FRAMES, queries);
+	RenderPath fastest = render_path;
+	float fastest_ms = 1.0e30f;
+	for (int path = 0; path < NUM_RENDER_PATHS; ++path) {
+		if (!supported_paths[path])
+			continue;
+		select_render_path((RenderPath)path);
+		for (uint32_t frame = 0; frame < AUTOTUNE_WARMUP_FRAMES + AUTOTUNE_FRAMES; ++frame) {
+			const float yaw = cam_yaw + glm::two_pi<float>() * (frame % AUTOTUNE_FRAMES) / AUTOTUNE_FRAMES;
+			view_proj = proj_mat * camera_view(cam_pos, yaw, cam_pitch);
+			view_pos = cam_pos;
+			PROFILE_FRAME();
+			autotune_query = (frame < AUTOTUNE_WARMUP_FRAMES) ? 0 : queries[frame - AUTOTUNE_WARMUP_FRAMES];
+			const int status = render();
+			if (0 != status) {
+				autotune_query = 0;
+				glDeleteQueries(AUTOTUNE_FRAMES, queries);
+				return status;
+			}
+		}
+		autotune_query = 0;
+		draw_call_counter = 0;
+
+		std::vector<float> gpu_ms(AUTOTUNE_FRAMES);
+		for (uint32_t i = 0; i < AUTOTUNE_FRAMES; ++i) {
+			GLuint64 elapsed_ns = 0;
+			glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsed_ns);
+			gpu_ms[i] = elapsed_ns / 1000000.0f;
+		}
+		std::sort(gpu_ms.begin(), gpu_ms.end());
+		const float median_ms = gpu_ms[AUTOTUNE_FRAMES / 2];
+		fprintf(stderr, "INFO: Render path '%s' took %.3f ms GPU time (median)\n", RENDER_PATH_NAMES[path], median_ms);
+		if (median_ms < fastest_ms) {
+			fastest = (RenderPath)path;
+			fastest_ms = median_ms;
+		}
+	}
+	glDeleteQueries(AUTOTUNE_FRAMES, queries);
+	if (-1 == SDL_GL_SetSwapInterval(-1))
+		SDL_GL_SetSwapInterval(1);
+	select_render_path(fastest);
+
+	FILE *file = fopen(AUTOTUNE_CACHE_FILE, "a");
+	if (file) {
+		fprintf(file, "%s\t%s\t%s\t%s\n", RENDER_PATH_NAMES[fastest], renderer, version, options);
+		fclose(file);
+	} else {
+		fprintf(stderr, "WARNING: Cannot write '%s', the render path will be autotuned again\n", AUTOTUNE_CACHE_FILE);
+	}
+	fprintf(stderr, "INFO: Autotuned render path '%s'\n", RENDER_PATH_NAMES[fastest]);
 	return 0;
 }
 
 
 int initialize(int argc, char *argv[])
 {
+	parse_arguments(argc, argv);
+
+	// Replayed camera paths are seen through exactly the same viewport as they were recorded
+	const char *camera_file = bench_camera_file ? bench_camera_file : replay_camera_file;
+	if (camera_file) {
+		if (!load_camera_path(camera_path, camera_file)) {
+			fprintf(stderr, "ERROR: Cannot load camera path from '%s'\n", camera_file);
+			return 4;
+		}
+		window_width = camera_path.width;
+		window_height = camera_path.height;
+		cam_fovy = camera_path.fovy;
+		cam_near = camera_path.near_plane;
+		cam_far = camera_path.far_plane;
+	}
+
 	if (0 != init_renderer())
 		return 1;
+	profiler_init();
+	start_job_pool(0);
+	if (0 < bench_sort_count)
+		return run_sort_benchmark(bench_sort_count);
 	if (0 != load_content())
 		return 2;
 	if (0 != post_load())
 		return 3;
 
-
-	proj_mat = glm::perspective(45.0f, window_width / (float)window_height, 1.0f, 4000.0f);
+	if (progressive_textures)
+		start_texture_streaming();
+
+	update_projection();
+	recorded_camera.width = window_width;
+	recorded_camera.height = window_height;
+	recorded_camera.fovy = cam_fovy;
+	recorded_camera.near_plane = cam_near;
+	recorded_camera.far_plane = cam_far;
+	sim_frame.camera.position = cam_pos;
+	sim_frame.camera.yaw = cam_yaw;
+	sim_frame.camera.pitch = cam_pitch;
+	sim_frame.width = window_width;
+	sim_frame.height = window_height;
+
+	if (bench_camera_file)
+		return start_benchmark();
+	if (autotune)
+		return autotune_render_path();
 
 	return 0;
 }
@@ -471,22 +3032,28 @@ int initialize(int argc, char *argv[])
 
 int fixed_update(uint64_t delta_micros)
 {
+	PROFILE_ZONE("fixed_update");
+
 	// Process system events to avid hanging the application
 	SDL_Event evt;
 	while (SDL_PollEvent(&evt)) {
 		if (SDL_QUIT == evt.type)
-			return 1;
+			return -1;
+		else if (SDL_KEYDOWN == evt.type && SDL_SCANCODE_F8 == evt.key.keysym.scancode)
+			print_profiler_stats();
+		else if (SDL_KEYDOWN == evt.type && SDL_SCANCODE_F9 == evt.key.keysym.scancode)
+			write_profiler_trace();
 		else if (SDL_WINDOWEVENT == evt.type) {
-			if (SDL_WINDOWEVENT_RESIZED == evt.window.event) {
-				SDL_GetWindowSize(wnd, &window_width, &window_height);
-				glViewport(0, 0, window_width, window_height);
-				proj_mat = glm::perspective(45.0f, window_width / (float)window_height, 1.0f, 4000.0f);
-			}
+			if (SDL_WINDOWEVENT_RESIZED == evt.window.event)
+				SDL_GetWindowSize(wnd, &sim_frame.width, &sim_frame.height); // Applied by acquire_frame()
 		}
 	}
 
+	// The benchmark and the replay drive the camera on their own (once per rendered frame)
+	if (bench_camera_file || replay_camera_file)
+		return 0;
+
 	// Handle camera
-	glm::mat4 camera_matrix;
 	{
 		int mouse_x, mouse_y;
 		uint32_t mouse_btns = SDL_GetRelativeMouseState(&mouse_x, &mouse_y);
@@ -494,8 +3061,8 @@ int fixed_update(uint64_t delta_micros)
 		SDL_CaptureMouse((SDL_bool)mouse_cam);
 		SDL_SetRelativeMouseMode((SDL_bool)mouse_cam);
 		if (mouse_cam) {
-			int half_width = window_width / 2;
-			int half_height = window_height / 2;
+			int half_width = sim_frame.width / 2;
+			int half_height = sim_frame.height / 2;
 			SDL_WarpMouseInWindow(wnd, half_width, half_height);
 
 			float delta_yaw = mouse_x / (float)half_width;
@@ -508,10 +3075,6 @@ int fixed_update(uint64_t delta_micros)
 
 		glm::mat3 look_mat = glm::mat3(glm::rotate(glm::mat4(1.0f), cam_yaw, glm::vec3(0.0f, 0.0, 1.0))
 			* glm::rotate(glm::mat4(1.0f), cam_pitch, glm::vec3(1.0f, 0.0f, 0.0f)));
-		glm::vec3 fwd = look_mat * LOOK_DIR;
-
-		camera_matrix = glm::lookAt(cam_pos, cam_pos + fwd, look_mat[2]);
-
 
 		float MOVE_SPEED = 0.6f;
 		const Uint8 *keys = SDL_GetKeyboardState(NULL);
@@ -531,7 +3094,13 @@ int fixed_update(uint64_t delta_micros)
 			cam_pos -= look_mat[2] * MOVE_SPEED;
 	}
 
-	view_proj = proj_mat * camera_matrix;
+	const CameraKey key = { cam_pos, cam_yaw, cam_pitch };
+	sim_frame.camera = key;
+
+	if (record_camera_file) {
+		recorded_camera.keys.push_back(key);
+		recorded_camera.tick_micros = delta_micros;
+	}
 
 	return 0;
 }
@@ -539,83 +3108,653 @@ int fixed_update(uint64_t delta_micros)
 
 int post_update(uint64_t delta_micros)
 {
-	float delta_time = delta_micros / 1000000.0f; // 1 second = 1000000 microseconds
+	PROFILE_ZONE("post_update");
+
+	// The benchmark drives the camera from render(), since it switches render paths between runs
+	if (bench_camera_file)
+		return 0;
+
+	if (replay_camera_file) {
+		// Interpolate between the recorded ticks, so the replay doesn't depend on the frame rate
+		replay_time += delta_micros;
+		if (replay_time > camera_path.duration())
+			return -1;
+		sim_frame.camera = sample_camera_path(camera_path, replay_time);
+	}
+	sim_frame.delta_micros = delta_micros;
+	return 0;
+}
+
+
+//! Hand the simulated frame over to render() (called by the framework, while the packet isn't read).
+void publish_frame(uint32_t slot)
+{
+	frame_packets[slot] = sim_frame;
+	frame_packets[slot].publish_time = SDL_GetPerformanceCounter();
+}
+
+
+//! Take the frame packet for the next render() on the thread owning the OpenGL context.
+void acquire_frame(uint32_t slot)
+{
+	PROFILE_FRAME();
+	const FramePacket &packet = frame_packets[slot];
+	frame_publish_time = packet.publish_time;
+	if (packet.width != window_width || packet.height != window_height) {
+		window_width = packet.width;
+		window_height = packet.height;
+		glViewport(0, 0, window_width, window_height);
+		update_projection();
+	}
+	if (bench_camera_file)
+		return;
+
+	view_proj = proj_mat * camera_view(packet.camera.position, packet.camera.yaw, packet.camera.pitch);
+	view_pos = packet.camera.position;
+
+	// Statistics are of the previous frame
+	float delta_time = packet.delta_micros / 1000000.0f; // 1 second = 1000000 microseconds
 	int fps = 1.0f / delta_time;
-	fprintf(stderr, "Frame: f=%i Hz\t time=%g sec\tdraw calls=%i\n", fps, delta_time, draw_call_counter);
+	if (occlusion_culling || software_occlusion)
+		fprintf(stderr, "Frame: f=%i Hz\t time=%g sec\tdraw calls=%i\tculled=%u/%u\toccluded=%u (%u triangles)\ttriangles=%u\n", fps, delta_time, draw_call_counter, culled_instances, num_instances, occluded_instances, occluded_triangles, drawn_triangles);
+	else if (!gpu_culling) // Triangles are counted by CPU culling (after LOD selection)
+		fprintf(stderr, "Frame: f=%i Hz\t time=%g sec\tdraw calls=%i\tculled=%u/%u\ttriangles=%u\n", fps, delta_time, draw_call_counter, culled_instances, num_instances, drawn_triangles);
+	else
+		fprintf(stderr, "Frame: f=%i Hz\t time=%g sec\tdraw calls=%i\tculled=%u/%u\n", fps, delta_time, draw_call_counter, culled_instances, num_instances);
 	draw_call_counter = 0;
 
-	return 0;
+	if (progressive_textures)
+		upload_streamed_textures();
 }
 
 
-int render(void)
+//! Make the OpenGL context current on the calling thread (or release it), so the framework can move it to the render thread.
+void bind_render_context(bool bind)
 {
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	SDL_GL_MakeCurrent(wnd, bind ? gl_context : NULL);
+}
 
-	glUniformMatrix4fv(VIEW_PROJ_MATRIX_UNIFORM, 1, GL_FALSE, glm::value_ptr(view_proj));
 
+//! Draw visible instances of an alpha class with the current render path.
+//! @param region Region of `visible_buffer` and `indirect_buffer` (and set of compacted buffers) filled by culling
+static
+void draw_alpha_class(uint32_t region, AlphaClass alpha_class)
+{
+	const DrawRange &range = alpha_draw_ranges[alpha_class];
+	if (0 == range.count)
+		return;
+	const size_t indirect_region_offset = sizeof(DrawElementsIndirectCommand) * region * draw_commands.size();
 	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
-	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, texid_buffer);
-	if (has_multi_draw_indirect && has_shader_draw_params) {
-		if (has_bindless_textures) {
-			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, texhandle_buffer);
-
-			//
-			// ~~~~~~~~~~~~~~~~~~~~ THIS IS IT! ONE DRAW CALL! ~~~~~~~~~~~~~~~~~~~~
-			//
-			glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)0, ordered_draw_calls.size(), sizeof(DrawElementsIndirectCommand));
-			++draw_call_counter;
+	if (PATH_MDI_BINDLESS == render_path) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, texid_buffer);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, texhandle_buffer);
+
+		//
+		// ~~~~~~~~~~~~~~~~~~~~ THIS IS IT! ONE DRAW CALL (PER PASS)! ~~~~~~~~~~~~~~~~~~~~
+		//
+		PROFILE_GPU_BEGIN("draw");
+		if (gpu_culling && has_indirect_parameters && ALPHA_OPAQUE == alpha_class) {
+			// Only non-empty commands, the GPU tells how many of them there are
+			glUniform1ui(DRAW_ID_OFFSET_UNIFORM, 0);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, compact_texid_buffers[region]);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, compact_texhandle_buffers[region]);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, compact_indirect_buffers[region]);
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, compact_indirect_buffers[region]);
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)GPU_CULL_HEADER_SIZE, 0, range.count, sizeof(DrawElementsIndirectCommand));
 		} else {
-			// We don't have bindless textures... but ~31 draw calls is not THAT bad either...
-			for (const MultiDrawCall &mdc : multicalls) {
-				glBindTexture(GL_TEXTURE_2D_ARRAY, mdc.tex_array);
-				glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, texid_buffer, mdc.texid_offset, sizeof(float) * mdc.indirect_count);
-				glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)mdc.indirect_offset, mdc.indirect_count, sizeof(DrawElementsIndirectCommand));
-				++draw_call_counter;
-			}
+			glUniform1ui(DRAW_ID_OFFSET_UNIFORM, range.first);
+			glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)(indirect_region_offset + sizeof(DrawElementsIndirectCommand) * range.first), range.count, sizeof(DrawElementsIndirectCommand));
+		}
+		PROFILE_GPU_END();
+		++draw_call_counter;
+	} else if (PATH_MDI_PER_ARRAY == render_path) {
+		// We don't have bindless textures... but ~31 draw calls is not THAT bad either...
+		glUniform1ui(DRAW_ID_OFFSET_UNIFORM, 0); // Texture indices of every batch are bound separately
+		for (const MultiDrawCall &mdc : multicalls) {
+			if (alpha_class != mdc.alpha_class)
+				continue;
+			glBindTexture(GL_TEXTURE_2D_ARRAY, resident_texture(mdc.tex_array));
+			glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, texid_array_buffer, mdc.texid_offset, sizeof(float) * mdc.indirect_count);
+			PROFILE_GPU_BEGIN("draw_batch");
+			glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)(indirect_region_offset + mdc.indirect_offset), mdc.indirect_count, sizeof(DrawElementsIndirectCommand));
+			PROFILE_GPU_END();
+			++draw_call_counter;
+		}
+	} else if (PATH_DRAW_ATTRIBUTE == render_path && has_multi_draw_indirect) {
+		// The same batches without draw parameters, every command selects its texture layer by its base instance
+		glUniform1ui(SLOT_OFFSET_UNIFORM, region * num_instances);
+		for (const MultiDrawCall &mdc : multicalls) {
+			if (alpha_class != mdc.alpha_class)
+				continue;
+			glBindTexture(GL_TEXTURE_2D_ARRAY, resident_texture(mdc.tex_array));
+			PROFILE_GPU_BEGIN("draw_batch");
+			glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)(indirect_region_offset + mdc.indirect_offset), mdc.indirect_count, sizeof(DrawElementsIndirectCommand));
+			PROFILE_GPU_END();
+			++draw_call_counter;
 		}
 	} else {
 		// This is the ultimate nightmare... fallback to 13932 draw calls :(
-		// But hey, at least we are using instancing
+		// But hey, at least we are using instancing (and with draw data, no uniform changes between them)
+		if (PATH_DRAW_ATTRIBUTE == render_path)
+			glUniform1ui(SLOT_OFFSET_UNIFORM, region * num_instances);
 		uint64_t previous_key = UINT64_MAX;
-		const uint64_t TEXTURE_ARRAY_MASK = 0xFFFFF000000ULL;
-		for (const auto &draw_call_pair : ordered_draw_calls) {
-			const DrawCall &dc = draw_call_pair.second;
-			const uint64_t key = draw_call_pair.first;
+		uint32_t draw_idx = range.first;
+		auto draw_call_it = std::next(ordered_draw_calls.begin(), range.first);
+		PROFILE_GPU_BEGIN("draw");
+		for (uint32_t i = 0; i < range.count; ++i, ++draw_call_it) {
+			const DrawCall &dc = draw_call_it->second;
+			const uint64_t key = draw_call_it->first;
 			const uint64_t changes = key ^ previous_key;
+			const GLuint visible = gpu_culling ? 1 : group_visible[draw_instance_group[draw_idx]];
+			++draw_idx;
+			if (0 == visible)
+				continue;
 
 			if (changes & TEXTURE_ARRAY_MASK) {
-				glBindTexture(GL_TEXTURE_2D_ARRAY, dc.texture_array);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, resident_texture(dc.texture_array));
 				previous_key = key;
 			}
 
-			glUniform1f(TEMP_TEX_IDX_UNIFORM, dc.tex_index);
-			glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLE_STRIP, dc.num_vertices, GL_UNSIGNED_SHORT, (void *)dc.index_offset, dc.num_instances, dc.base_vertex, dc.base_instance);
+			if (PATH_INSTANCED == render_path)
+				glUniform1f(TEMP_TEX_IDX_UNIFORM, dc.tex_index);
+			if (gpu_culling) // Instance counts are known only to the GPU
+				glDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)(sizeof(DrawElementsIndirectCommand) * (region * draw_commands.size() + draw_idx - 1)));
+			else
+				glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLE_STRIP, dc.num_vertices, GL_UNSIGNED_SHORT, (void *)dc.index_offset, visible, dc.base_vertex, get_base_instance(region, draw_idx - 1));
+			++draw_call_counter;
+		}
+		PROFILE_GPU_END();
+	}
+}
+
+
+//! Draw visible opaque instances into the depth buffer only (alpha-tested ones would need their textures).
+//! Textures don't matter, so every path with multi-draw indirect needs a single call.
+static
+void draw_depth_prepass(uint32_t region)
+{
+	const DrawRange &range = alpha_draw_ranges[ALPHA_OPAQUE];
+	if (0 == range.count)
+		return;
+	PROFILE_GPU_BEGIN("depth_prepass");
+	glUseProgram(depth_programs[render_path]);
+	glUniformMatrix4fv(DEPTH_VIEW_PROJ_MATRIX_UNIFORM[render_path], 1, GL_FALSE, glm::value_ptr(view_proj));
+	if (PATH_DRAW_ATTRIBUTE == render_path)
+		glUniform1ui(DEPTH_SLOT_OFFSET_UNIFORM[render_path], region * num_instances);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	if (PATH_INSTANCED != render_path && has_multi_draw_indirect) {
+		if (gpu_culling && has_indirect_parameters) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, compact_indirect_buffers[region]);
+			glBindBuffer(GL_PARAMETER_BUFFER_ARB, compact_indirect_buffers[region]);
+			glMultiDrawElementsIndirectCountARB(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)GPU_CULL_HEADER_SIZE, 0, range.count, sizeof(DrawElementsIndirectCommand));
+		} else {
+			const size_t offset = sizeof(DrawElementsIndirectCommand) * (region * draw_commands.size() + range.first);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+			glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)offset, range.count, sizeof(DrawElementsIndirectCommand));
+		}
+		++draw_call_counter;
+	} else {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+		auto draw_call_it = std::next(ordered_draw_calls.begin(), range.first);
+		for (uint32_t draw_idx = range.first; draw_idx < range.first + range.count; ++draw_idx, ++draw_call_it) {
+			const DrawCall &dc = draw_call_it->second;
+			const GLuint visible = gpu_culling ? 1 : group_visible[draw_instance_group[draw_idx]];
+			if (0 == visible)
+				continue;
+			if (gpu_culling)
+				glDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)(sizeof(DrawElementsIndirectCommand) * (region * draw_commands.size() + draw_idx)));
+			else
+				glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLE_STRIP, dc.num_vertices, GL_UNSIGNED_SHORT, (void *)dc.index_offset, visible, dc.base_vertex, get_base_instance(region, draw_idx));
 			++draw_call_counter;
 		}
 	}
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glUseProgram(programs[render_path]);
+	PROFILE_GPU_END();
+}
+
+
+//! Is the visibility buffer used with the current render path?
+static
+bool use_visibility_buffer()
+{
+	return visibility_buffer && uses_draw_parameters(render_path);
+}
+
+
+//! Draw IDs of visible opaque instances into the visibility buffer (a single call), then shade all covered pixels.
+//! The visibility buffer framebuffer has to be bound.
+static
+void draw_visibility_buffer(uint32_t region)
+{
+	const DrawRange &range = alpha_draw_ranges[ALPHA_OPAQUE];
+	if (0 == range.count)
+		return;
+
+	// Commands aren't compacted, so draw IDs match `vis_draw_buffer` and `texid_buffer`
+	PROFILE_GPU_BEGIN("visibility");
+	const GLuint background[4] = { 0, 0, 0, 0 };
+	const GLenum id_buffers[] = { GL_NONE, GL_COLOR_ATTACHMENT1 };
+	const GLenum color_buffers[] = { GL_COLOR_ATTACHMENT0, GL_NONE };
+	glDrawBuffers(2, id_buffers);
+	glClearBufferuiv(GL_COLOR, 1, background);
+	glUseProgram(vis_program);
+	glUniformMatrix4fv(VIS_VIEW_PROJ_MATRIX_UNIFORM, 1, GL_FALSE, glm::value_ptr(view_proj));
+	glUniform1ui(VIS_DRAW_ID_OFFSET_UNIFORM, range.first);
+	glUniform1ui(VIS_PRIMITIVE_BITS_UNIFORM, vis_primitive_bits);
+	const size_t offset = sizeof(DrawElementsIndirectCommand) * (region * draw_commands.size() + range.first);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)offset, range.count, sizeof(DrawElementsIndirectCommand));
+	++draw_call_counter;
+	PROFILE_GPU_END();
+
+	PROFILE_GPU_BEGIN("resolve");
+	const int bindless = (PATH_MDI_BINDLESS == render_path) ? 1 : 0;
+	glDrawBuffers(2, color_buffers);
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(resolve_programs[bindless]);
+	glUniformMatrix4fv(RESOLVE_VIEW_PROJ_MATRIX_UNIFORM[bindless], 1, GL_FALSE, glm::value_ptr(view_proj));
+	glUniform1ui(RESOLVE_PRIMITIVE_BITS_UNIFORM[bindless], vis_primitive_bits);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, baked_buffers[0]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, baked_buffers[1]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, baked_buffers[3]);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, texid_buffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, vis_draw_buffer);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, vis_ids);
+	glActiveTexture(GL_TEXTURE0);
+	if (bindless) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, texhandle_buffer);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		++draw_call_counter;
+	} else {
+		// Every pass shades only pixels of draw calls sampling its texture array
+		for (const MultiDrawCall &mdc : multicalls) {
+			if (ALPHA_OPAQUE != mdc.alpha_class)
+				continue;
+			glBindTexture(GL_TEXTURE_2D_ARRAY, resident_texture(mdc.tex_array));
+			glUniform1ui(RESOLVE_TEXTURE_ARRAY_UNIFORM, mdc.tex_array);
+			glDrawArrays(GL_TRIANGLES, 0, 3);
+			++draw_call_counter;
+		}
+	}
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(programs[render_path]);
+	PROFILE_GPU_END();
+}
+
+
+//! Draw visible opaque and alpha-tested instances (without blending, so early depth test rejects hidden fragments).
+//! With the depth pre-pass, opaque instances shade only the fragments, which are left in the depth buffer.
+//! With the visibility buffer, they are shaded by a full-screen pass instead (and the pre-pass is not needed).
+//! @param region Region of `visible_buffer` and `indirect_buffer` (and set of compacted buffers) filled by culling
+static
+void draw_instances(uint32_t region)
+{
+	const bool prepass = depth_prepass && !use_visibility_buffer();
+	if (prepass) {
+		draw_depth_prepass(region);
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+	glUniform1f(ALPHA_CUTOFF_UNIFORM, 0.0f);
+
+	// Opaque commands stay in the baked texture-major order rather than front-to-back. Their order is what
+	// gl_DrawIDARB indexes texture buffers with and what keeps batches of a texture array contiguous, so
+	// resorting them per frame would split every MDI. Overdraw is left to the depth pre-pass instead.
+	if (use_visibility_buffer())
+		draw_visibility_buffer(region);
+	else
+		draw_alpha_class(region, ALPHA_OPAQUE);
+	if (prepass) {
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+	}
+	glUniform1f(ALPHA_CUTOFF_UNIFORM, ALPHA_CUTOFF);
+	draw_alpha_class(region, ALPHA_CUTOUT);
+}
+
+
+//! Draw commands of sort_translucent_instances() with the current render path.
+static
+void draw_sorted_instances()
+{
+	if (sorted_commands.empty())
+		return;
+	if (PATH_MDI_BINDLESS == render_path) {
+		glUniform1ui(DRAW_ID_OFFSET_UNIFORM, 0);
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, sorted_stream.buffer, sorted_offsets[1], sizeof(GLuint) * sorted_commands.size());
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 4, sorted_stream.buffer, sorted_offsets[2], sizeof(GLuint64) * sorted_commands.size());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sorted_stream.buffer);
+		PROFILE_GPU_BEGIN("draw_sorted");
+		glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)sorted_offsets[0], sorted_commands.size(), sizeof(DrawElementsIndirectCommand));
+		PROFILE_GPU_END();
+		++draw_call_counter;
+	} else if (PATH_MDI_PER_ARRAY == render_path) {
+		// Texture arrays change along the sorted order, the whole buffer of indices is indexed from the first command of a batch
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 3, sorted_stream.buffer, sorted_offsets[1], sizeof(GLuint) * sorted_commands.size());
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sorted_stream.buffer);
+		PROFILE_GPU_BEGIN("draw_sorted");
+		for (const MultiDrawCall &mdc : sorted_batches) {
+			glBindTexture(GL_TEXTURE_2D_ARRAY, resident_texture(mdc.tex_array));
+			glUniform1ui(DRAW_ID_OFFSET_UNIFORM, mdc.texid_offset);
+			glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)(sorted_offsets[0] + mdc.indirect_offset), mdc.indirect_count, sizeof(DrawElementsIndirectCommand));
+			++draw_call_counter;
+		}
+		PROFILE_GPU_END();
+	} else if (PATH_DRAW_ATTRIBUTE == render_path) {
+		// Base instances of sorted commands select their own draw data (with absolute slots)
+		glUniform1ui(SLOT_OFFSET_UNIFORM, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, sorted_stream.buffer);
+		glVertexAttribIPointer(ATTRIB_DRAW_DATA, 2, GL_UNSIGNED_INT, sizeof(glm::uvec2), (void *)sorted_offsets[3]);
+		if (has_multi_draw_indirect)
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, sorted_stream.buffer);
+		PROFILE_GPU_BEGIN("draw_sorted");
+		for (const MultiDrawCall &mdc : sorted_batches) {
+			glBindTexture(GL_TEXTURE_2D_ARRAY, resident_texture(mdc.tex_array));
+			if (has_multi_draw_indirect) {
+				glMultiDrawElementsIndirect(GL_TRIANGLE_STRIP, GL_UNSIGNED_SHORT, (void *)(sorted_offsets[0] + mdc.indirect_offset), mdc.indirect_count, sizeof(DrawElementsIndirectCommand));
+				++draw_call_counter;
+				continue;
+			}
+			for (uint32_t i = mdc.texid_offset; i < mdc.texid_offset + mdc.indirect_count; ++i) {
+				const DrawElementsIndirectCommand &cmd = sorted_commands[i];
+				glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLE_STRIP, cmd.count, GL_UNSIGNED_SHORT, (void *)(uintptr_t)(sizeof(uint16_t) * cmd.first_index), 1, cmd.base_vertex, cmd.base_instance);
+				++draw_call_counter;
+			}
+		}
+		PROFILE_GPU_END();
+		glBindBuffer(GL_ARRAY_BUFFER, draw_data_buffer);
+		glVertexAttribIPointer(ATTRIB_DRAW_DATA, 2, GL_UNSIGNED_INT, sizeof(glm::uvec2), NULL);
+	} else {
+		PROFILE_GPU_BEGIN("draw_sorted");
+		for (const MultiDrawCall &mdc : sorted_batches) {
+			glBindTexture(GL_TEXTURE_2D_ARRAY, resident_texture(mdc.tex_array));
+			for (uint32_t i = mdc.texid_offset; i < mdc.texid_offset + mdc.indirect_count; ++i) {
+				const DrawElementsIndirectCommand &cmd = sorted_commands[i];
+				glUniform1f(TEMP_TEX_IDX_UNIFORM, sorted_texture_indices[i]);
+				glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLE_STRIP, cmd.count, GL_UNSIGNED_SHORT, (void *)(uintptr_t)(sizeof(uint16_t) * cmd.first_index), 1, cmd.base_vertex, cmd.base_instance);
+				++draw_call_counter;
+			}
+		}
+		PROFILE_GPU_END();
+	}
+}
+
+
+//! Blend visible translucent instances over the depth of everything drawn by draw_instances().
+//! They are drawn back-to-front, unless they can't be sorted (GPU culling or --no-translucent-sort).
+static
+void draw_translucent_instances(uint32_t region)
+{
+	glEnable(GL_BLEND);
+	glDepthMask(GL_FALSE);
+	glUniform1f(ALPHA_CUTOFF_UNIFORM, 0.0f);
+	if (sort_translucent)
+		draw_sorted_instances();
+	else
+		draw_alpha_class(region, ALPHA_TRANSLUCENT);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_BLEND);
+}
+
+
+//! Copy color of an offscreen framebuffer into the window (and bind the default framebuffer back).
+static
+void present_framebuffer(GLuint fbo, int width, int height)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, window_width, window_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+//! Save the window (back buffer) as a binary PPM image, e.g. for comparing render paths.
+static
+bool write_screenshot(const char *filename)
+{
+	std::vector<uint8_t> pixels(3 * window_width * window_height);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, window_width, window_height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	FILE *out = fopen(filename, "wb");
+	if (!out)
+		return false;
+	fprintf(out, "P6\n%i %i\n255\n", window_width, window_height);
+	for (int y = window_height - 1; y >= 0; --y) // OpenGL starts at the bottom row
+		fwrite(&pixels[3 * y * window_width], 3, window_width, out);
+	return 0 == fclose(out);
+}
+
+
+int render(void)
+{
+	PROFILE_ZONE("render");
+
+	if (bench_camera_file) {
+		const int status = update_benchmark();
+		if (0 != status)
+			return status;
+		if (bench_frame >= BENCH_QUERY_LATENCY)
+			collect_bench_query(bench_frame - BENCH_QUERY_LATENCY);
+		glBeginQuery(GL_TIME_ELAPSED, bench_queries[bench_frame % BENCH_QUERY_LATENCY]);
+		bench_render_start = SDL_GetPerformanceCounter();
+	} else if (autotune_query) {
+		glBeginQuery(GL_TIME_ELAPSED, autotune_query);
+	}
+
+	if (gpu_culling) {
+		const int status = cull_instances_gpu(occlusion_culling ? CULL_PREVIOUSLY_VISIBLE : CULL_FRUSTUM);
+		if (0 != status)
+			return status;
+	} else {
+		cull_instances();
+		if (sort_translucent)
+			sort_translucent_instances(cull_region);
+	}
+	if (use_vertex_pulling())
+		compute_clip_matrices(gpu_culling ? 0 : cull_region);
+
+	if (occlusion_culling) {
+		if ((occlusion_width != window_width || occlusion_height != window_height) && !create_occlusion_targets()) {
+			fprintf(stderr, "ERROR: Framebuffer for occlusion culling is incomplete\n");
+			return 7;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, occlusion_fbo);
+	} else if (use_visibility_buffer()) {
+		if ((vis_width != window_width || vis_height != window_height) && !create_visibility_targets()) {
+			fprintf(stderr, "ERROR: Framebuffer of the visibility buffer is incomplete\n");
+			return 7;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, vis_fbo);
+	}
+
+	PROFILE_GPU_BEGIN("clear");
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	PROFILE_GPU_END();
+
+	glUniformMatrix4fv(VIEW_PROJ_MATRIX_UNIFORM, 1, GL_FALSE, glm::value_ptr(view_proj));
+
+	draw_instances(gpu_culling ? 0 : cull_region);
+	if (occlusion_culling) {
+		// Phase 2: test everything against the depth of phase 1 and draw what was missed
+		build_depth_pyramid();
+		const int status = cull_instances_gpu(CULL_OCCLUSION);
+		if (0 != status)
+			return status;
+		if (use_vertex_pulling())
+			compute_clip_matrices(1);
+		draw_instances(1);
+
+		// Translucent instances of both phases are blended over all opaque ones
+		draw_translucent_instances(0);
+		draw_translucent_instances(1);
+		present_framebuffer(occlusion_fbo, occlusion_width, occlusion_height);
+	} else {
+		draw_translucent_instances(gpu_culling ? 0 : cull_region);
+		if (use_visibility_buffer())
+			present_framebuffer(vis_fbo, vis_width, vis_height);
+	}
+
+	// Streamed regions can be reused once the GPU is done with this frame
+	if (!gpu_culling) {
+		end_stream_frame(visible_stream);
+		if (indirect_buffer)
+			end_stream_frame(command_stream);
+		if (sort_translucent)
+			end_stream_frame(sorted_stream);
+		if (use_vertex_pulling())
+			end_stream_frame(clip_slot_stream);
+	}
 
 	GL_CHECK();
-	SDL_GL_SwapWindow(wnd);
+	if (autotune_query)
+		glEndQuery(GL_TIME_ELAPSED);
+	if (bench_camera_file) {
+		glEndQuery(GL_TIME_ELAPSED);
+		const uint64_t now = SDL_GetPerformanceCounter();
+		bench_samples[bench_frame].cpu_ms = 1000.0f * (now - bench_render_start) / SDL_GetPerformanceFrequency();
+		bench_samples[bench_frame].draw_calls = draw_call_counter;
+		bench_samples[bench_frame].culled_instances = culled_instances;
+		bench_samples[bench_frame].occluded_instances = occluded_instances;
+		bench_samples[bench_frame].occluded_triangles = occluded_triangles;
+		bench_samples[bench_frame].triangles = drawn_triangles;
+
+		// The last frame of every run shows the same view, so images of different runs can be diffed
+		if (bench_screenshot_prefix && BENCH_WARMUP_FRAMES + bench_frames == bench_frame + 1) {
+			char filename[1024];
+			snprintf(filename, sizeof(filename), "%s%02u.ppm", bench_screenshot_prefix, (unsigned)bench_run_idx);
+			if (write_screenshot(filename))
+				fprintf(stderr, "INFO: Screenshot of the last frame written to '%s'\n", filename);
+			else
+				fprintf(stderr, "WARNING: Cannot write screenshot to '%s'\n", filename);
+		}
+	}
+
+	{
+		PROFILE_ZONE("swap");
+		PROFILE_GPU_BEGIN("swap");
+		SDL_GL_SwapWindow(wnd);
+		PROFILE_GPU_END();
+	}
+
+	if (bench_camera_file) {
+		const uint64_t now = SDL_GetPerformanceCounter();
+		bench_samples[bench_frame].frame_ms = 1000.0f * (now - bench_prev_swap) / SDL_GetPerformanceFrequency();
+		bench_samples[bench_frame].latency_ms = 1000.0f * (now - frame_publish_time) / SDL_GetPerformanceFrequency();
+		bench_prev_swap = now;
+		++bench_frame;
+	}
 
 	return 0;
 }
 
 
+static
+void print_stream_stats(const char *name, const StreamBuffer &stream)
+{
+	if (0 == stream.stats.frames)
+		return;
+	fprintf(stderr, "INFO: Stream of %s: %u frames, %u stalls (%.2f ms), peak %ld of %ld bytes, %u overflows\n",
+		name, stream.stats.frames, stream.stats.stalls, stream.stats.stall_ms,
+		(long)stream.stats.peak_bytes, (long)stream.region_size, stream.stats.overflows);
+}
+
+
 void cleanup(void)
 {
+	stop_texture_streaming();
+	stop_job_pool();
+
+	if (trace_file)
+		write_profiler_trace();
+	profiler_shutdown();
+
+	if (meshlet_stats && 0 < meshlets_tested) {
+		fprintf(stderr, "INFO: Meshlets of visible instances over %u frames: %.0f per frame, %.1f%% outside of the frustum, %.1f%% back-facing\n",
+			meshlet_frames, (double)meshlets_tested / meshlet_frames, 100.0 * meshlets_outside / meshlets_tested, 100.0 * meshlets_backfacing / meshlets_tested);
+	}
+
+	if (record_camera_file) {
+		if (save_camera_path(recorded_camera, record_camera_file))
+			fprintf(stderr, "INFO: Recorded %u camera keys to '%s'\n", (unsigned)recorded_camera.keys.size(), record_camera_file);
+		else
+			fprintf(stderr, "ERROR: Cannot save camera path to '%s'\n", record_camera_file);
+	}
+
 	// Release GPU allocated memory
 	if (has_bindless_textures) {
-		for (GLuint64 bindless_texture : tex_handles)
-			glMakeTextureHandleNonResidentARB(bindless_texture);
+		for (size_t i = 1; i < tex_handles.size(); ++i)
+			if (texture_resident[i])
+				glMakeTextureHandleNonResidentARB(tex_handles[i]);
+		if (placeholder_handle)
+			glMakeTextureHandleNonResidentARB(placeholder_handle);
 		glDeleteBuffers(1, &texhandle_buffer);
 	}
 	glDeleteTextures(textures.size(), textures.data());
+	glDeleteTextures(1, &placeholder_texture);
 	glDeleteVertexArrays(1, &baked_vao);
 	glDeleteBuffers(4, baked_buffers);
 	glDeleteBuffers(1, &instance_buffer);
-	glDeleteBuffers(1, &indirect_buffer);
+	glDeleteTextures(1, &instance_texture);
+	print_stream_stats("visible instances", visible_stream);
+	print_stream_stats("indirect commands", command_stream);
+	print_stream_stats("sorted translucent instances", sorted_stream);
+	destroy_stream_buffer(visible_stream);
+	destroy_stream_buffer(command_stream);
+	destroy_stream_buffer(sorted_stream);
+	visible_buffer = indirect_buffer = 0;
+	glDeleteTextures(1, &visible_texture);
+	glDeleteBuffers(1, &draw_data_buffer);
+	if (gpu_culling) {
+		if (verify_gpu_culling)
+			fprintf(stderr, "INFO: GPU culling matched the CPU reference in %u frames\n", gpu_cull_verified);
+		glDeleteProgram(cull_program);
+		glDeleteProgram(emit_program);
+		glDeleteBuffers(1, &bounds_buffer);
+		glDeleteBuffers(1, &groups_buffer);
+		glDeleteBuffers(1, &lod_ranges_buffer);
+		glDeleteBuffers(1, &group_visible_buffer);
+		glDeleteBuffers(1, &command_template_buffer);
+		glDeleteBuffers(CULL_PHASES, compact_indirect_buffers);
+		glDeleteBuffers(CULL_PHASES, compact_texid_buffers);
+		glDeleteBuffers(CULL_PHASES, compact_texhandle_buffers);
+		glDeleteBuffers(CULL_FRAMES, gpu_cull_stats);
+	}
+	if (occlusion_culling) {
+		glDeleteProgram(pyramid_program);
+		glDeleteBuffers(1, &last_visible_buffer);
+		glDeleteBuffers(1, &group_triangles_buffer);
+		glDeleteFramebuffers(1, &occlusion_fbo);
+		glDeleteRenderbuffers(1, &occlusion_color);
+		glDeleteTextures(1, &occlusion_depth);
+		glDeleteTextures(1, &depth_pyramid);
+	}
 	glDeleteBuffers(1, &texid_buffer);
+	glDeleteBuffers(1, &texid_array_buffer);
+	for (int path = 0; path < NUM_RENDER_PATHS; ++path) {
+		glDeleteProgram(programs[path]);
+		glDeleteProgram(depth_programs[path]);
+	}
+	if (vertex_pulling) {
+		glDeleteProgram(clip_program);
+		glDeleteBuffers(1, &clip_buffer);
+		glDeleteBuffers(1, &clip_slots_buffer);
+		print_stream_stats("visible slots", clip_slot_stream);
+		destroy_stream_buffer(clip_slot_stream);
+	}
+	if (visibility_buffer || bench_visibility) {
+		glDeleteProgram(vis_program);
+		glDeleteProgram(resolve_programs[0]);
+		glDeleteProgram(resolve_programs[1]);
+		glDeleteBuffers(1, &vis_draw_buffer);
+		glDeleteFramebuffers(1, &vis_fbo);
+		glDeleteRenderbuffers(1, &vis_color);
+		glDeleteTextures(1, &vis_ids);
+		glDeleteRenderbuffers(1, &vis_depth);
+	}
+	if (bench_camera_file)
+		glDeleteQueries(BENCH_QUERY_LATENCY, bench_queries);
 
 	stop_opengl_log();
 }
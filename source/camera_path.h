@@ -0,0 +1,42 @@
+/*
+ * Recorded camera paths used for reproducible captures and benchmarks.
+ */
+#ifndef _CAMERA_PATH_INCLUDED
+#define _CAMERA_PATH_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+//! Camera state captured at a single fixed update tick.
+struct CameraKey {
+	glm::vec3 position;
+	float yaw;
+	float pitch;
+};
+
+//! Sequence of camera states, one per fixed update tick, together with the viewport they were seen through.
+struct CameraPath {
+	int width, height; //!< Window size during recording
+	float fovy, near_plane, far_plane; //!< Projection parameters (as passed to glm::perspective)
+	uint64_t tick_micros; //!< Duration of a single fixed update tick
+	std::vector<CameraKey> keys;
+
+	CameraPath() : width(800), height(600), fovy(45.0f), near_plane(1.0f), far_plane(4000.0f), tick_micros(16666) {}
+
+	//! Duration of the whole path in microseconds.
+	uint64_t duration() const { return keys.empty() ? 0 : (keys.size() - 1) * tick_micros; }
+};
+
+
+//! Load camera path from a CSV file (see save_camera_path() for the format).
+bool load_camera_path(CameraPath &path, const char *filename);
+
+//! Save camera path as a CSV file: optional "viewport" and "tick" lines followed by "x;y;z;yaw;pitch" lines.
+bool save_camera_path(const CameraPath &path, const char *filename);
+
+//! Get the camera state at given time (interpolated between ticks, wraps around at the end of the path).
+CameraKey sample_camera_path(const CameraPath &path, uint64_t time_micros);
+
+
+#endif
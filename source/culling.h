@@ -0,0 +1,57 @@
+/*
+ * View-frustum culling of bounding spheres.
+ *
+ * This module intentionally doesn't depend on OpenGL, so the kernels can be
+ * exercised (and compared against the scalar reference) without a GPU.
+ */
+#ifndef _CULLING_INCLUDED
+#define _CULLING_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+//! How many spheres are tested at once by the SIMD kernel (8 with AVX, 4 with SSE, 1 otherwise).
+extern const uint32_t CULLING_LANES;
+
+//! Bounding spheres in SoA layout, so SIMD kernels can load them directly.
+//! The arrays are padded, so the kernels may safely read past the last sphere.
+struct BoundingSpheres {
+	std::vector<float> x, y, z, radius;
+	uint32_t count;
+
+	BoundingSpheres() : count(0) {}
+};
+
+//! Everything the spheres are tested against.
+struct CullingFrustum {
+	glm::vec4 planes[6]; //!< Normalized planes pointing inside
+	glm::vec3 camera; //!< Position of the camera used for distance culling
+	float max_distance; //!< Spheres which are entirely further away from the camera are culled
+};
+
+//! Use as `max_distance` to disable distance culling (it's still safe to square it).
+static const float CULL_DISTANCE_UNLIMITED = 1.0e18f;
+
+//! Convert spheres stored as vec4(center, radius).
+void assign_bounding_spheres(BoundingSpheres &spheres, const glm::vec4 *data, uint32_t count);
+
+//! Extract the frustum from OpenGL clip-space matrix.
+CullingFrustum make_culling_frustum(const glm::mat4 &clip_from_world, const glm::vec3 &camera, float max_distance);
+
+//! Test spheres [first, first + count) against the frustum and write indices of the visible ones to `visible`.
+//! @returns Number of visible spheres (the output is compacted, `visible` has to hold at least `count` indices).
+uint32_t cull_spheres(const CullingFrustum &frustum, const BoundingSpheres &spheres, uint32_t first, uint32_t count, uint32_t *visible);
+
+//! Reference implementation of cull_spheres() processing one sphere at a time.
+uint32_t cull_spheres_scalar(const CullingFrustum &frustum, const BoundingSpheres &spheres, uint32_t first, uint32_t count, uint32_t *visible);
+
+//! Test a single sphere (center, radius) against the frustum (including the distance).
+bool is_sphere_visible(const CullingFrustum &frustum, const glm::vec4 &sphere);
+
+//! Test an axis-aligned box [lo, hi] against the frustum (including the distance).
+//! @returns False, if the box is entirely outside.
+bool is_box_visible(const CullingFrustum &frustum, const glm::vec3 &lo, const glm::vec3 &hi);
+
+
+#endif
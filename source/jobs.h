@@ -0,0 +1,19 @@
+/*
+ * Minimal pool of worker threads for data-parallel loops.
+ */
+#ifndef _JOBS_INCLUDED
+#define _JOBS_INCLUDED
+#include <stdint.h>
+#include <functional>
+
+
+//! Start given number of worker threads (0 = one per hardware thread, except the calling one).
+void start_job_pool(unsigned num_workers);
+void stop_job_pool();
+
+//! Call `job(begin, end)` for batches of [0, count) on the workers and the calling thread.
+//! Returns once all batches are done. Jobs must not call parallel_for() themselves.
+void parallel_for(uint32_t count, uint32_t batch_size, const std::function<void(uint32_t begin, uint32_t end)> &job);
+
+
+#endif
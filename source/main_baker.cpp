@@ -5,17 +5,28 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <string>
 #include <vector>
 #include <unordered_set>
 #include <unordered_map>
 #include <algorithm>
+#include <atomic>
+#include <math.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include "renderware.h"
+#include "culling.h"
+#include "occlusion.h"
+#include "pvs.h"
+#include "meshlet.h"
+#include "morton.h"
+#include "simplify.h"
+#include "jobs.h"
 #include <map>
+#include <tuple>
 #include <GL/glew.h>
 
 
@@ -140,10 +151,19 @@ std::map<uint64_t, DrawCall> ordered_draw_calls;
 
 struct Instance {
 	int id;
+	uint32_t cluster; //!< Index of the spatial cluster within all placements of the model
 	uint32_t num_instances;
 	uint32_t base_instance;
 };
 
+//! Box around all instances of a spatial cluster (stored in "clusters.blob").
+struct InstanceCluster {
+	glm::vec3 lo;
+	uint32_t base_instance;
+	glm::vec3 hi;
+	uint32_t num_instances;
+};
+
 
 //! Structure representing a file entry in the IMG archive (loaded from DIR file)
 struct DirectoryEntry {
@@ -173,6 +193,7 @@ struct ItemPlacementEntry {
 	std::string model_name;
 	int interior;
 	int id; //!< Unique object ID (max 6500)
+	glm::vec2 lod_range; //!< Camera distances the placement is drawn at (see link_lod_models())
 };
 
 
@@ -189,9 +210,17 @@ struct TextureBucket {
 //! Map holding created textures that where bucketized by their key.
 std::map<uint16_t, TextureBucket> texture_buckets;
 
+//! How materials sampling a texture are drawn (2 bits of sort keys, so the renderer draws the classes in this order).
+enum AlphaClass {
+	ALPHA_OPAQUE = 0, //!< Without blending and alpha test
+	ALPHA_CUTOUT = 1, //!< Alpha test only, texels are either (almost) opaque or (almost) transparent (fences, DXT1 with 1-bit alpha)
+	ALPHA_TRANSLUCENT = 2 //!< Blended without writing depth (glass, smoke)
+};
+
 struct TextureRef {
 	uint32_t index; // Index to the texture within the bucket (within natives[])
 	uint16_t bucket_key; // Key to the `texture_buckets` map
+	uint8_t alpha_class; // See AlphaClass
 };
 std::unordered_map<std::string, TextureRef> named_textures;
 
@@ -210,6 +239,7 @@ struct MeshTableEntry {
 	uint32_t num_splits; //!< Number of material splits      // TODO: This might be uint16_t or even uint8_t!
 	uint32_t base_vertex; //!< Offset into index buffer
 	uint32_t offset; //!< Byte offset into index buffer
+	glm::vec4 bounds; //!< Bounding sphere in object space (center, radius)
 };
 
 //! Ordered container for item definitions that will be serialized to "meshtable".
@@ -223,6 +253,38 @@ struct MaterialSplit {
 
 std::map<uint32_t, std::vector<MaterialSplit> > material_splits;
 
+// Occluders are low-poly buildings big enough to hide other objects, the renderer rasterizes them on the CPU
+const float OCCLUDER_MIN_RADIUS = 20.0f; //!< Smaller instances don't hide much
+const uint32_t OCCLUDER_MAX_TRIANGLES = 512; //!< Per model (the detailed ones would be too expensive)
+const uint32_t OCCLUDER_TRIANGLE_BUDGET = 32768; //!< Total over all occluder instances
+const float CLUSTER_CELL_SIZE = 256.0f; //!< Placements of a model within a cell of this grid are drawn (and culled) together
+const float PVS_CELL_SIZE = 128.0f; //!< Width of view cells (unless the map needs more than PVS_MAX_CELLS)
+const uint32_t PVS_MAX_CELLS = 64; //!< Per axis of the grid
+const float PVS_LAYERS[] = { -20.0f, 30.0f, 300.0f }; //!< Heights of view cells (street level and aerial views)
+const uint32_t PVS_VIEW_SIZE = 128; //!< Resolution of cube faces rasterized from every sample point
+const float PVS_VIEW_DISTANCE = 4000.0f; //!< Far plane of the renderer
+const uint32_t MESH_LOD_LEVELS = 3; //!< Simplified levels of every mesh (at most)
+const float MESH_LOD_ERROR_BUDGET = 0.05f; //!< Largest error of the last level (relative to the radius of the mesh)
+const float MESH_LOD_MIN_REDUCTION = 0.8f; //!< Levels have to drop at least 20% of triangles of the previous one
+const float MESH_LOD_ATTRIBUTE_SCALE = 0.1f; //!< Error of changing UVs or colors by 1 (relative to the radius of the mesh)
+const float HLOD_CELL_SIZE = 512.0f; //!< Far-field placements within a cell of this grid are merged into a single proxy
+const float HLOD_DISTANCE = 1000.0f; //!< Proxies replace their placements beyond this distance from the camera
+const float HLOD_MAX_ERROR = 0.02f; //!< Largest simplification error of proxies (relative to HLOD_CELL_SIZE)
+const uint32_t HLOD_ATLAS_SIZE = 128; //!< Every proxy has its own RGBA layers of this size (as many as its triangles need)
+const uint32_t HLOD_CHART_SIZE = 4; //!< Texels per side of the square of the atlas covered by a single proxy triangle
+const uint32_t HLOD_LAYER_TRIANGLES = (HLOD_ATLAS_SIZE / HLOD_CHART_SIZE) * (HLOD_ATLAS_SIZE / HLOD_CHART_SIZE);
+const uint32_t HLOD_MAX_TRIANGLES = 16 * HLOD_LAYER_TRIANGLES; //!< Every proxy triangle has its own 3 vertices, which 16-bit indices reach
+const uint32_t HLOD_ERROR_RELAXATIONS = 3; //!< Times the error budget of a proxy is doubled, while it has too many triangles
+const uint16_t HLOD_ATLAS_BUCKET = (7 << 8) | (3 << 4) | 3; //!< Texture bucket of atlases (format 7 isn't used by TXDs, 128x128)
+const int HLOD_FIRST_ID = 7000; //!< Proxies are models with IDs above all item definitions (within 13 bits of sort keys)
+const float LOD_UNLIMITED_DISTANCE = 1.0e18f; //!< Far end of distance ranges of models drawn regardless of the distance
+const uint8_t ALPHA_CUTOUT_MIN = 8; //!< Texels with lower alpha are treated as fully transparent
+const uint8_t ALPHA_OPAQUE_MIN = 248; //!< Texels with higher alpha are treated as fully opaque
+const float ALPHA_CUTOUT_MAX_BLENDED = 0.05f; //!< Cutout textures may have this fraction of texels in between (filtered edges)
+
+
+
+bool spatial_model_order = false; //!< Lay out instance ranges of models by their centroids (--spatial-model-order)
 
 
 //! Check, if given string starts with given prefix.
@@ -232,6 +294,13 @@ bool starts_with(const std::string &haystack, const std::string &needle) {
 }
 
 
+//! LOD models are named after their high-detail counterparts with the first 3 characters replaced by "LOD".
+bool is_lod_model(const std::string &model_name)
+{
+	return starts_with(model_name, "lod") || starts_with(model_name, "LOD");
+}
+
+
 size_t fwrite_compressed(const void *data, size_t element_size, size_t element_count, FILE *file)
 {
 #if defined(BAKE_WITH_LZHAM)
@@ -324,6 +393,19 @@ bool read_dff_mesh(uint32_t id, const std::string &filename)
 					baked_vert_uv.push_back(uv);
 				}
 
+				// Bounding sphere around the center of AABB is good enough for culling
+				glm::vec3 aabb_min = baked_vert_pos[mesh.base_vertex];
+				glm::vec3 aabb_max = aabb_min;
+				for (size_t v = mesh.base_vertex; v < baked_vert_pos.size(); ++v) {
+					aabb_min = glm::min(aabb_min, baked_vert_pos[v]);
+					aabb_max = glm::max(aabb_max, baked_vert_pos[v]);
+				}
+				const glm::vec3 center = 0.5f * (aabb_min + aabb_max);
+				float radius = 0.0f;
+				for (size_t v = mesh.base_vertex; v < baked_vert_pos.size(); ++v)
+					radius = std::max(radius, glm::length(baked_vert_pos[v] - center));
+				mesh.bounds = glm::vec4(center, radius);
+
 				// Load optimized indices from 'Bin Mesh PLG' chunk
 				material_splits[id].reserve(mesh.num_splits);
 				for (size_t b = 0; b < geo.splits.size(); ++b) {
@@ -350,6 +432,50 @@ bool read_dff_mesh(uint32_t id, const std::string &filename)
 }
 
 
+//! Decode the first mip level of a texture to 8-bit channels (compressed textures to BGRA, palettes to RGBA).
+static
+rw::NativeTexture decode_texels(const rw::NativeTexture &tex, bool &swap_red_blue)
+{
+	rw::NativeTexture texels(tex);
+	swap_red_blue = false;
+	if (texels.dxtCompression) {
+		texels.decompressDxt();
+		swap_red_blue = true;
+	} else if (texels.rasterFormat & (rw::RASTER_PAL8 | rw::RASTER_PAL4)) {
+		texels.convertTo32Bit();
+		swap_red_blue = true;
+	}
+	return texels;
+}
+
+
+//! Scan alpha of the first mip level to find out how the texture has to be drawn (DXT1 decodes to alpha of 0 or 255).
+static
+AlphaClass get_alpha_class(const rw::NativeTexture &tex)
+{
+	if (!tex.hasAlpha)
+		return ALPHA_OPAQUE;
+	bool swap_red_blue = false;
+	const rw::NativeTexture texels = decode_texels(tex, swap_red_blue);
+	const uint32_t num_texels = texels.width[0] * texels.height[0];
+	const uint32_t bytes_per_texel = num_texels ? texels.dataSizes[0] / num_texels : 0;
+	if (4 != bytes_per_texel)
+		return ALPHA_OPAQUE;
+
+	uint32_t transparent = 0, blended = 0;
+	for (uint32_t i = 0; i < num_texels; ++i) {
+		const uint8_t alpha = texels.texels[0][4 * i + 3];
+		if (alpha < ALPHA_CUTOUT_MIN)
+			++transparent;
+		else if (alpha <= ALPHA_OPAQUE_MIN)
+			++blended;
+	}
+	if (0 == transparent && 0 == blended)
+		return ALPHA_OPAQUE;
+	return (blended <= ALPHA_CUTOUT_MAX_BLENDED * num_texels) ? ALPHA_CUTOUT : ALPHA_TRANSLUCENT;
+}
+
+
 bool read_txd(const std::string &filename)
 {
 	fprintf(stderr, "Loading TXD: '%s'\n", filename.c_str());
@@ -398,6 +524,7 @@ bool read_txd(const std::string &filename)
 		TextureRef &ref = named_textures[tex.name];
 		ref.bucket_key = tex_group_key;
 		ref.index = bucket.natives.size() - 1;
+		ref.alpha_class = get_alpha_class(tex);
 	}
 
 	return true;
@@ -571,12 +698,6 @@ bool add_item_definition_objs(ItemDefinitionEntry &item)
 	if (item.model_name.length() == 0 || item.model_name == "")
 		return false;
 
-	// HACK: Skip LODs (distance greater than 900)
-	if (item.draw_distance[0] >= 900)
-		return false;
-	if (starts_with(item.model_name, "lod") || starts_with(item.model_name, "LOD"))
-		return false;
-
 	// HACK: Don't load interiors
 	//if (item.flags & IDFLAG_INTERIOR)
 	//	return false;
@@ -597,12 +718,6 @@ bool add_item_definition_tobj(ItemDefinitionEntry &item)
 	if (item.model_name.length() == 0 || item.model_name == "")
 		return false;
 
-	// HACK: Skip LODs (distance greater than 900)
-	if (item.draw_distance[0] >= 900)
-		return false;
-	if (starts_with(item.model_name, "lod") || starts_with(item.model_name, "LOD"))
-		return false;
-
 	// HACK: Don't load interiors
 	//if (item.flags & IDFLAG_INTERIOR)
 	//	return false;
@@ -850,6 +965,674 @@ int extract_img()
 }
 
 
+//! Split triangles of every material split of every mesh into meshlets and write them to "meshlets.blob".
+void bake_meshlets()
+{
+	std::vector<MeshletRange> ranges;
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> indices;
+	uint32_t num_cones = 0;
+	for (const auto &pair : mesh_table) {
+		const MeshTableEntry &mesh = pair.second;
+		MeshletRange range = { pair.first, (uint32_t)meshlets.size(), 0 };
+		size_t first = mesh.offset / sizeof(uint16_t);
+		const std::vector<MaterialSplit> &splits = material_splits[pair.first];
+		for (size_t split_idx = 0; split_idx < splits.size(); ++split_idx) {
+			// Unroll the triangle strip, every other triangle has its winding flipped
+			std::vector<uint32_t> triangles;
+			for (size_t i = 2; i < splits[split_idx].num_indices; ++i) {
+				const uint32_t a = baked_indices[first + i - 2], b = baked_indices[first + i - 1], c = baked_indices[first + i];
+				if (a == b || b == c || a == c)
+					continue;
+				triangles.push_back((i & 1) ? b : a);
+				triangles.push_back((i & 1) ? a : b);
+				triangles.push_back(c);
+			}
+			build_meshlets(&baked_vert_pos[mesh.base_vertex], triangles.data(), triangles.size() / 3, split_idx, meshlets, indices);
+			first += splits[split_idx].num_indices;
+		}
+		range.num_meshlets = meshlets.size() - range.first_meshlet;
+		ranges.push_back(range);
+	}
+	for (const Meshlet &meshlet : meshlets)
+		num_cones += (meshlet.cone.w < 1.0f) ? 1 : 0;
+
+	// Indices are relative to the base vertex of the mesh, just like in "meshes.blob"
+	std::vector<uint16_t> local_indices(indices.begin(), indices.end());
+	FILE *blob = fopen("meshlets.blob", "wb");
+	uint32_t num_meshes = ranges.size();
+	uint32_t num_meshlets = meshlets.size();
+	uint32_t num_indices = local_indices.size();
+	fwrite(&num_meshes, sizeof(uint32_t), 1, blob);
+	fwrite(&num_meshlets, sizeof(uint32_t), 1, blob);
+	fwrite(&num_indices, sizeof(uint32_t), 1, blob);
+	fwrite_compressed(ranges.data(), sizeof(MeshletRange), num_meshes, blob);
+	fwrite_compressed(meshlets.data(), sizeof(Meshlet), num_meshlets, blob);
+	fwrite_compressed(local_indices.data(), sizeof(uint16_t), num_indices, blob);
+	fclose(blob);
+	fprintf(stderr, "INFO: Baked %u meshlets of %u meshes (%.1f triangles per meshlet, %u with normal cones)\n",
+		num_meshlets, num_meshes, num_meshlets ? num_indices / 3.0 / num_meshlets : 0.0, num_cones);
+}
+
+
+//! Generate simplified LOD levels of all meshes on all workers and write them to "meshlods.blob".
+//! Every level halves the triangles of the previous one within a growing part of the error budget,
+//! material splits are simplified separately, so they keep their textures.
+void bake_mesh_lods()
+{
+	struct MeshLods {
+		std::vector<MeshLod> lods;
+		std::vector<uint32_t> indices;
+		uint32_t num_triangles; //!< Of the original mesh
+	};
+	std::vector<uint32_t> ids;
+	for (const auto &pair : mesh_table)
+		ids.push_back(pair.first);
+	std::vector<MeshLods> results(ids.size());
+
+	parallel_for(ids.size(), 4, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t m = begin; m < end; ++m) {
+			const MeshTableEntry &mesh = mesh_table.at(ids[m]);
+			const std::vector<MaterialSplit> &splits = material_splits.at(ids[m]);
+			MeshLods &result = results[m];
+
+			// Unroll triangle strips of all splits, every other triangle has its winding flipped
+			std::vector<std::vector<uint32_t> > split_triangles(splits.size());
+			size_t first = mesh.offset / sizeof(uint16_t);
+			uint32_t num_vertices = 0;
+			for (size_t split_idx = 0; split_idx < splits.size(); ++split_idx) {
+				for (size_t i = 2; i < splits[split_idx].num_indices; ++i) {
+					const uint32_t a = baked_indices[first + i - 2], b = baked_indices[first + i - 1], c = baked_indices[first + i];
+					if (a == b || b == c || a == c)
+						continue;
+					split_triangles[split_idx].push_back((i & 1) ? b : a);
+					split_triangles[split_idx].push_back((i & 1) ? a : b);
+					split_triangles[split_idx].push_back(c);
+					num_vertices = std::max(num_vertices, std::max(a, std::max(b, c)) + 1);
+				}
+				first += splits[split_idx].num_indices;
+				result.num_triangles += split_triangles[split_idx].size() / 3;
+			}
+
+			const float radius = mesh.bounds.w;
+			const SimplifyMesh input = { &baked_vert_pos[mesh.base_vertex], &baked_vert_rgba[mesh.base_vertex], &baked_vert_uv[mesh.base_vertex],
+				num_vertices, MESH_LOD_ATTRIBUTE_SCALE * radius };
+			uint32_t prev_triangles = result.num_triangles;
+			float prev_error = 0.0f;
+			for (uint32_t level = 1; level <= MESH_LOD_LEVELS; ++level) {
+				const float max_error = MESH_LOD_ERROR_BUDGET * radius * (float)(1 << (level - 1)) / (float)(1 << (MESH_LOD_LEVELS - 1));
+				uint32_t num_triangles = 0;
+				float error = 0.0f;
+				for (std::vector<uint32_t> &triangles : split_triangles) {
+					error = std::max(error, simplify_triangles(input, triangles, triangles.size() / 6, max_error));
+					num_triangles += triangles.size() / 3;
+				}
+				if (num_triangles > MESH_LOD_MIN_REDUCTION * prev_triangles)
+					break;
+
+				// Errors of the levels add up, since each one simplifies the previous one
+				prev_error += error;
+				prev_triangles = num_triangles;
+				for (size_t split_idx = 0; split_idx < splits.size(); ++split_idx) {
+					const MeshLod lod = { (uint32_t)result.indices.size(), (uint32_t)split_triangles[split_idx].size() / 3, (uint32_t)split_idx, level, prev_error };
+					result.lods.push_back(lod);
+					result.indices.insert(result.indices.end(), split_triangles[split_idx].begin(), split_triangles[split_idx].end());
+				}
+			}
+		}
+	});
+
+	// Indices are relative to the base vertex of the mesh, just like in "meshes.blob"
+	std::vector<MeshLodRange> ranges;
+	std::vector<MeshLod> lods;
+	std::vector<uint16_t> indices;
+	uint64_t level_triangles[MESH_LOD_LEVELS + 1] = {}, original_triangles[MESH_LOD_LEVELS + 1] = {};
+	for (size_t m = 0; m < ids.size(); ++m) {
+		const MeshLods &result = results[m];
+		if (result.lods.empty())
+			continue;
+		MeshLodRange range = { ids[m], (uint32_t)lods.size(), (uint32_t)result.lods.size() };
+		ranges.push_back(range);
+		for (MeshLod lod : result.lods) {
+			lod.first_index += indices.size();
+			lods.push_back(lod);
+			level_triangles[lod.level] += lod.num_triangles;
+			if (0 == lod.split)
+				original_triangles[lod.level] += result.num_triangles;
+		}
+		indices.insert(indices.end(), result.indices.begin(), result.indices.end());
+	}
+
+	FILE *blob = fopen("meshlods.blob", "wb");
+	uint32_t num_meshes = ranges.size();
+	uint32_t num_lods = lods.size();
+	uint32_t num_indices = indices.size();
+	fwrite(&num_meshes, sizeof(uint32_t), 1, blob);
+	fwrite(&num_lods, sizeof(uint32_t), 1, blob);
+	fwrite(&num_indices, sizeof(uint32_t), 1, blob);
+	fwrite_compressed(ranges.data(), sizeof(MeshLodRange), num_meshes, blob);
+	fwrite_compressed(lods.data(), sizeof(MeshLod), num_lods, blob);
+	fwrite_compressed(indices.data(), sizeof(uint16_t), num_indices, blob);
+	fclose(blob);
+	fprintf(stderr, "INFO: Baked LOD levels of %u out of %u meshes\n", num_meshes, (uint32_t)ids.size());
+	for (uint32_t level = 1; level <= MESH_LOD_LEVELS; ++level) {
+		if (0 < original_triangles[level])
+			fprintf(stderr, "INFO:   level %u: %llu -> %llu triangles (%.1f%%)\n", level, (unsigned long long)original_triangles[level],
+				(unsigned long long)level_triangles[level], 100.0 * level_triangles[level] / original_triangles[level]);
+	}
+}
+
+
+//! Link LOD models to their high-detail counterparts (by names without the first 3 characters) and set
+//! the range of camera distances of all placements. High-detail models are drawn up to their own draw
+//! distance and their LOD models from there up to the draw distance of the LOD model.
+void link_lod_models()
+{
+	auto lower_suffix = [](const std::string &name) {
+		std::string suffix = (name.size() > 3) ? name.substr(3) : std::string();
+		for (char &c : suffix)
+			c = tolower(c);
+		return suffix;
+	};
+	std::unordered_map<std::string, int> hd_models;
+	for (const auto &pair : item_definitions)
+		if (!is_lod_model(pair.second.model_name))
+			hd_models[lower_suffix(pair.second.model_name)] = pair.first;
+
+	uint32_t num_linked = 0, num_orphans = 0;
+	for (auto &pair : item_placements) {
+		const ItemDefinitionEntry &def = item_definitions[pair.first];
+		const float far_distance = (def.flags & IDFLAG_NO_DRAW_DISTANCE) ? LOD_UNLIMITED_DISTANCE : def.draw_distance[0];
+		glm::vec2 range(0.0f, far_distance);
+
+		// LOD models without their high-detail model are drawn at all distances up to their own
+		if (is_lod_model(def.model_name)) {
+			const auto hd = hd_models.find(lower_suffix(def.model_name));
+			if (hd_models.end() != hd) {
+				range.x = std::min(item_definitions[hd->second].draw_distance[0], far_distance);
+				++num_linked;
+			} else {
+				++num_orphans;
+			}
+		}
+		for (ItemPlacementEntry &ipl : pair.second)
+			ipl.lod_range = range;
+	}
+	fprintf(stderr, "INFO: Linked %u LOD models to their high-detail models (%u without one)\n", num_linked, num_orphans);
+}
+
+
+//! Compute the mean color of a texture as the renderer would sample it (RGBA).
+glm::vec4 get_average_color(const rw::NativeTexture &tex)
+{
+	bool swap_red_blue = false;
+	const rw::NativeTexture texels = decode_texels(tex, swap_red_blue);
+	const uint32_t num_texels = texels.width[0] * texels.height[0];
+	const uint32_t bytes_per_texel = num_texels ? texels.dataSizes[0] / num_texels : 0;
+	if (bytes_per_texel < 3)
+		return glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
+	glm::dvec4 sum(0.0);
+	for (uint32_t i = 0; i < num_texels; ++i) {
+		const uint8_t *texel = texels.texels[0] + i * bytes_per_texel;
+		sum += glm::dvec4(texel[0], texel[1], texel[2], (4 == bytes_per_texel) ? texel[3] : 255);
+	}
+	glm::vec4 color = glm::vec4(sum / (255.0 * num_texels));
+	if (swap_red_blue)
+		std::swap(color.r, color.b);
+	return color;
+}
+
+
+//! Append a triangle to a strip joined to previous triangles with degenerate ones.
+//! Triangles of the strip are unrolled with every other one flipped, so the winding stays the same.
+static
+void append_strip_triangle(std::vector<uint16_t> &strip, uint16_t a, uint16_t b, uint16_t c)
+{
+	if (!strip.empty()) {
+		if (strip.size() & 1)
+			strip.push_back(strip.back());
+		strip.push_back(strip.back());
+		strip.push_back(a);
+	}
+	strip.push_back(a);
+	strip.push_back(b);
+	strip.push_back(c);
+}
+
+
+//! Merge far-field placements (drawn beyond HLOD_DISTANCE) of every cell into a simplified proxy model with
+//! its own atlas of colors, which replaces them beyond HLOD_DISTANCE. Has to run before upload_meshes().
+//! Placements keep being drawn until the proxy appears, so there are no holes during the swap.
+void bake_hlod_proxies()
+{
+	if (!item_definitions.empty() && item_definitions.rbegin()->first >= HLOD_FIRST_ID) {
+		fprintf(stderr, "WARNING: Item definitions use IDs reserved for HLOD proxies, skipping them\n");
+		return;
+	}
+
+	// Far-field members of cells and mean colors of their textures (rwtools isn't meant for threads)
+	std::map<std::pair<int, int>, std::vector<ItemPlacementEntry *> > cells;
+	std::unordered_map<std::string, glm::vec4> texture_colors;
+	uint32_t num_members = 0;
+	for (auto &pair : item_placements) {
+		const ItemDefinitionEntry &def = item_definitions[pair.first];
+		if (mesh_table.end() == mesh_table.find(pair.first) || (def.flags & (IDFLAG_VISIBLE_THROUGH | IDFLAG_ALPHA_TRANSPARENCY_2)))
+			continue;
+		for (ItemPlacementEntry &ipl : pair.second) {
+			if (ipl.lod_range.y <= HLOD_DISTANCE || 0 != ipl.interior)
+				continue;
+			cells[std::make_pair((int)floorf(ipl.position.x / HLOD_CELL_SIZE), (int)floorf(ipl.position.y / HLOD_CELL_SIZE))].push_back(&ipl);
+			++num_members;
+		}
+		for (const MaterialSplit &split : material_splits[pair.first]) {
+			const auto ref = named_textures.find(split.mat_name);
+			if (named_textures.end() != ref && texture_colors.end() == texture_colors.find(split.mat_name))
+				texture_colors[split.mat_name] = get_average_color(texture_buckets[ref->second.bucket_key].natives[ref->second.index]);
+		}
+	}
+
+	struct Proxy {
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec4> colors;
+		std::vector<uint32_t> triangles;
+		uint32_t source_triangles;
+	};
+	std::vector<std::vector<ItemPlacementEntry *> > members;
+	for (auto &cell : cells)
+		members.push_back(cell.second);
+	std::vector<Proxy> proxies(members.size());
+
+	parallel_for(members.size(), 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t cell = begin; cell < end; ++cell) {
+			Proxy &proxy = proxies[cell];
+
+			// Merge triangles of all members in world space, vertices sharing their position are welded
+			std::map<std::tuple<float, float, float>, uint32_t> welded;
+			std::vector<glm::vec4> color_sums;
+			for (const ItemPlacementEntry *ipl : members[cell]) {
+				const MeshTableEntry &mesh = mesh_table.at(ipl->id);
+				size_t first = mesh.offset / sizeof(uint16_t);
+				for (const MaterialSplit &split : material_splits.at(ipl->id)) {
+					const auto color = texture_colors.find(split.mat_name);
+					const glm::vec4 split_color = (texture_colors.end() != color) ? color->second : glm::vec4(0.5f, 0.5f, 0.5f, 1.0f);
+					for (size_t i = 2; i < split.num_indices; ++i) {
+						const uint32_t a = baked_indices[first + i - 2], b = baked_indices[first + i - 1], c = baked_indices[first + i];
+						if (a == b || b == c || a == c)
+							continue;
+						uint32_t triangle[3];
+						const uint32_t corners[3] = { (i & 1) ? b : a, (i & 1) ? a : b, c };
+						for (int k = 0; k < 3; ++k) {
+							const glm::vec3 p = glm::vec3(ipl->world_from_object * glm::vec4(baked_vert_pos[mesh.base_vertex + corners[k]], 1.0f));
+							auto it = welded.find(std::make_tuple(p.x, p.y, p.z));
+							if (welded.end() == it) {
+								it = welded.insert(std::make_pair(std::make_tuple(p.x, p.y, p.z), (uint32_t)proxy.positions.size())).first;
+								proxy.positions.push_back(p);
+								color_sums.push_back(glm::vec4(0.0f));
+							}
+							triangle[k] = it->second;
+						}
+						if (triangle[0] == triangle[1] || triangle[1] == triangle[2] || triangle[0] == triangle[2])
+							continue;
+
+						// Vertices get mean colors of their triangles' textures (weighted by area)
+						const float area = glm::length(glm::cross(proxy.positions[triangle[1]] - proxy.positions[triangle[0]], proxy.positions[triangle[2]] - proxy.positions[triangle[0]]));
+						for (int k = 0; k < 3; ++k) {
+							color_sums[triangle[k]] += area * glm::vec4(glm::vec3(split_color), 1.0f);
+							proxy.triangles.push_back(triangle[k]);
+						}
+					}
+					first += split.num_indices;
+				}
+			}
+			for (const glm::vec4 &sum : color_sums)
+				proxy.colors.push_back((sum.w > 0.0f) ? glm::vec4(glm::vec3(sum) / sum.w, 1.0f) : glm::vec4(0.5f, 0.5f, 0.5f, 1.0f));
+			proxy.source_triangles = proxy.triangles.size() / 3;
+
+			// Colors are baked into the atlas, so only positions matter for the simplification
+			const std::vector<glm::u8vec4> no_colors(proxy.positions.size(), glm::u8vec4(0));
+			const std::vector<glm::vec4> no_uvs(proxy.positions.size(), glm::vec4(0.0f));
+			const SimplifyMesh input = { proxy.positions.data(), no_colors.data(), no_uvs.data(), (uint32_t)proxy.positions.size(), 0.0f };
+			float max_error = HLOD_MAX_ERROR * HLOD_CELL_SIZE;
+			simplify_triangles(input, proxy.triangles, HLOD_LAYER_TRIANGLES, max_error);
+
+			// The atlas grows with the triangles, but borders never move, so the budget is relaxed if they don't fit
+			// 16-bit indices. Cells, which still don't fit, keep their members (dropping triangles would leave holes).
+			for (uint32_t i = 0; i < HLOD_ERROR_RELAXATIONS && proxy.triangles.size() > 3 * HLOD_MAX_TRIANGLES; ++i) {
+				max_error *= 2.0f;
+				simplify_triangles(input, proxy.triangles, HLOD_LAYER_TRIANGLES, max_error);
+			}
+			if (proxy.triangles.size() > 3 * HLOD_MAX_TRIANGLES)
+				proxy.triangles.clear();
+		}
+	});
+
+	// Every proxy triangle gets its own square of the atlas with colors interpolated from its vertices.
+	// Each layer of the atlas is a material split of the proxy.
+	TextureBucket &bucket = texture_buckets[HLOD_ATLAS_BUCKET];
+	uint32_t num_baked = 0, num_skipped = 0, num_source_triangles = 0, num_proxy_triangles = 0;
+	for (size_t c = 0; c < proxies.size(); ++c) {
+		const Proxy &proxy = proxies[c];
+		if (proxy.triangles.empty()) {
+			num_skipped += (0 < proxy.source_triangles) ? 1 : 0;
+			continue;
+		}
+		const int id = HLOD_FIRST_ID + (int)c;
+		char name[32];
+		snprintf(name, sizeof(name), "hlod_%u", (uint32_t)c);
+		const uint32_t num_triangles = proxy.triangles.size() / 3;
+		const uint32_t num_layers = (num_triangles + HLOD_LAYER_TRIANGLES - 1) / HLOD_LAYER_TRIANGLES;
+
+		MeshTableEntry mesh = {};
+		mesh.id = id;
+		mesh.num_splits = num_layers;
+		mesh.base_vertex = baked_vert_pos.size();
+		mesh.offset = sizeof(uint16_t) * baked_indices.size();
+		glm::vec3 lo(1.0e30f), hi(-1.0e30f);
+		rw::NativeTexture atlas;
+		std::vector<uint16_t> strip;
+		for (uint32_t t = 0; t < num_triangles; ++t) {
+			const uint32_t chart = t % HLOD_LAYER_TRIANGLES;
+			if (0 == chart) {
+				char layer_name[32];
+				snprintf(layer_name, sizeof(layer_name), "%s_%u", name, t / HLOD_LAYER_TRIANGLES);
+				atlas = rw::NativeTexture();
+				atlas.name = layer_name;
+				atlas.rasterFormat = rw::RASTER_8888;
+				atlas.depth = 32;
+				atlas.hasAlpha = true;
+				atlas.mipmapCount = 1;
+				atlas.width.push_back(HLOD_ATLAS_SIZE);
+				atlas.height.push_back(HLOD_ATLAS_SIZE);
+				atlas.dataSizes.push_back(HLOD_ATLAS_SIZE * HLOD_ATLAS_SIZE * 4);
+				atlas.texels.push_back(new uint8_t[atlas.dataSizes[0]]);
+				memset(atlas.texels[0], 0, atlas.dataSizes[0]);
+				strip.clear();
+			}
+			const uint32_t x0 = (chart % (HLOD_ATLAS_SIZE / HLOD_CHART_SIZE)) * HLOD_CHART_SIZE;
+			const uint32_t y0 = (chart / (HLOD_ATLAS_SIZE / HLOD_CHART_SIZE)) * HLOD_CHART_SIZE;
+			const glm::vec2 corners[3] = {
+				glm::vec2(x0 + 0.5f, y0 + 0.5f),
+				glm::vec2(x0 + HLOD_CHART_SIZE - 0.5f, y0 + 0.5f),
+				glm::vec2(x0 + 0.5f, y0 + HLOD_CHART_SIZE - 0.5f)
+			};
+			glm::vec4 colors[3];
+			for (int k = 0; k < 3; ++k) {
+				const uint32_t v = proxy.triangles[3 * t + k];
+				colors[k] = proxy.colors[v];
+				lo = glm::min(lo, proxy.positions[v]);
+				hi = glm::max(hi, proxy.positions[v]);
+				baked_vert_pos.push_back(proxy.positions[v]);
+				baked_vert_rgba.push_back(glm::u8vec4(glm::clamp(colors[k], 0.0f, 1.0f) * 255.0f));
+				baked_vert_uv.push_back(glm::vec4(corners[k] / (float)HLOD_ATLAS_SIZE, 0.0f, 0.0f));
+			}
+			const uint16_t first = (uint16_t)(3 * t);
+			append_strip_triangle(strip, first, first + 1, first + 2);
+
+			// Bilinear filtering only ever reads texels of the triangle's own square
+			for (uint32_t y = 0; y < HLOD_CHART_SIZE; ++y) {
+				for (uint32_t x = 0; x < HLOD_CHART_SIZE; ++x) {
+					float u = x / (float)(HLOD_CHART_SIZE - 1), v = y / (float)(HLOD_CHART_SIZE - 1);
+					if (u + v > 1.0f) {
+						const float sum = u + v;
+						u /= sum;
+						v /= sum;
+					}
+					const glm::vec4 color = (1.0f - u - v) * colors[0] + u * colors[1] + v * colors[2];
+					uint8_t *texel = atlas.texels[0] + 4 * ((y0 + y) * HLOD_ATLAS_SIZE + x0 + x);
+					for (int k = 0; k < 4; ++k)
+						texel[k] = (uint8_t)(glm::clamp(color[k], 0.0f, 1.0f) * 255.0f);
+				}
+			}
+
+			// The layer is full, or this is the last triangle
+			if (HLOD_LAYER_TRIANGLES - 1 == chart || num_triangles - 1 == t) {
+				baked_indices.insert(baked_indices.end(), strip.begin(), strip.end());
+				MaterialSplit split = {};
+				split.mat_name = atlas.name;
+				split.num_indices = strip.size();
+				material_splits[id].push_back(split);
+				bucket.natives.push_back(atlas);
+				TextureRef &ref = named_textures[atlas.name];
+				ref.bucket_key = HLOD_ATLAS_BUCKET;
+				ref.index = bucket.natives.size() - 1;
+				ref.alpha_class = ALPHA_OPAQUE;
+			}
+		}
+		const glm::vec3 center = 0.5f * (lo + hi);
+		mesh.bounds = glm::vec4(center, glm::length(hi - center));
+		mesh_table[id] = mesh;
+
+		// Members are drawn until the proxy replaces them (the renderer tests distances from centers of bounding spheres)
+		float far_distance = HLOD_DISTANCE;
+		for (ItemPlacementEntry *ipl : members[c]) {
+			const glm::vec3 member_center = glm::vec3(ipl->world_from_object * glm::vec4(glm::vec3(mesh_table[ipl->id].bounds), 1.0f));
+			const float offset = glm::length(member_center - center);
+			far_distance = std::max(far_distance, ipl->lod_range.y + offset);
+			ipl->lod_range.y = std::min(ipl->lod_range.y, HLOD_DISTANCE + offset);
+		}
+
+		ItemDefinitionEntry def = {};
+		def.id = id;
+		def.model_name = name;
+		def.mesh_count = 1;
+		def.draw_distance[0] = far_distance;
+		item_definitions[id] = def;
+
+		ItemPlacementEntry ipl = {};
+		ipl.id = id;
+		ipl.model_name = name;
+		ipl.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+		ipl.scale = glm::vec3(1.0f);
+		ipl.position = center;
+		ipl.world_from_object = glm::mat4(1.0f);
+		ipl.lod_range = glm::vec2(HLOD_DISTANCE, far_distance);
+		item_placements[id].push_back(ipl);
+
+		++num_baked;
+		num_source_triangles += proxy.source_triangles;
+		num_proxy_triangles += num_triangles;
+	}
+	fprintf(stderr, "INFO: Baked %u HLOD proxies (%u atlas layers) replacing %u placements beyond %g units (%u -> %u triangles)\n",
+		num_baked, (uint32_t)bucket.natives.size(), num_members, HLOD_DISTANCE, num_source_triangles, num_proxy_triangles);
+	if (num_skipped)
+		fprintf(stderr, "WARNING: %u cells can't be simplified to %u triangles, their placements are drawn without proxies\n", num_skipped, HLOD_MAX_TRIANGLES);
+}
+
+
+//! Check, if the model can be used as an occluder (it has to be opaque and low-poly).
+//! @returns Triangles of the model (3 indices into `baked_vert_pos` per triangle) or nothing.
+std::vector<uint32_t> occluder_triangles(uint32_t id)
+{
+	std::vector<uint32_t> triangles;
+	const ItemDefinitionEntry &def = item_definitions[id];
+	if (is_lod_model(def.model_name) || (int)id >= HLOD_FIRST_ID) // Only drawn far away, where they overlap their high-detail models
+		return triangles;
+	if (def.flags & (IDFLAG_VISIBLE_THROUGH | IDFLAG_ALPHA_TRANSPARENCY_2 | IDFLAG_NO_SHADOW_MESH | IDFLAG_DONT_CULL | IDFLAG_BREAKABLE | IDFLAG_BREAKABLE_2))
+		return triangles;
+
+	const MeshTableEntry &mesh = mesh_table[id];
+	size_t first = mesh.offset / sizeof(uint16_t);
+	for (const MaterialSplit &split : material_splits[id]) {
+		// Textures with alpha might be see-through (fences, foliage, windows)
+		const auto tex = named_textures.find(split.mat_name);
+		const uint16_t format = (named_textures.end() != tex) ? (tex->second.bucket_key >> 8) & 0x7 : 0;
+		if (4 == format || 5 == format || 6 == format)
+			return std::vector<uint32_t>();
+
+		// Unroll the triangle strip (the winding doesn't matter, occluders are two-sided)
+		for (size_t i = 2; i < split.num_indices; ++i) {
+			const uint32_t a = baked_indices[first + i - 2], b = baked_indices[first + i - 1], c = baked_indices[first + i];
+			if (a == b || b == c || a == c)
+				continue;
+			triangles.push_back(mesh.base_vertex + a);
+			triangles.push_back(mesh.base_vertex + b);
+			triangles.push_back(mesh.base_vertex + c);
+		}
+		first += split.num_indices;
+		if (triangles.size() > 3 * OCCLUDER_MAX_TRIANGLES)
+			return std::vector<uint32_t>();
+	}
+	return triangles;
+}
+
+
+//! Select the biggest opaque low-poly instances within the triangle budget and write them to "occluders.blob".
+void bake_occluders(Occluders &occluders)
+{
+	struct Candidate {
+		float radius;
+		uint32_t id;
+		const ItemPlacementEntry *placement;
+	};
+
+	std::map<uint32_t, std::vector<uint32_t> > model_triangles;
+	std::vector<Candidate> candidates;
+	for (const auto &pair : item_placements) {
+		const float radius = mesh_table[pair.first].bounds.w;
+		if (radius < OCCLUDER_MIN_RADIUS)
+			continue;
+		std::vector<uint32_t> &triangles = model_triangles[pair.first];
+		triangles = occluder_triangles(pair.first);
+		if (triangles.empty())
+			continue;
+		for (const ItemPlacementEntry &ipl : pair.second) {
+			Candidate candidate = { radius, (uint32_t)pair.first, &ipl };
+			candidates.push_back(candidate);
+		}
+	}
+	std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) { return a.radius > b.radius; });
+
+	std::vector<glm::vec3> &vertices = occluders.vertices;
+	std::vector<uint32_t> &indices = occluders.indices;
+	uint32_t num_occluders = 0;
+	for (const Candidate &candidate : candidates) {
+		const std::vector<uint32_t> &triangles = model_triangles[candidate.id];
+		if (indices.size() + triangles.size() > 3 * OCCLUDER_TRIANGLE_BUDGET)
+			continue;
+
+		// Occluders are stored in world space with their own copy of vertices
+		std::map<uint32_t, uint32_t> remap;
+		for (uint32_t v : triangles) {
+			auto it = remap.find(v);
+			if (remap.end() == it) {
+				it = remap.insert(std::make_pair(v, (uint32_t)vertices.size())).first;
+				vertices.push_back(glm::vec3(candidate.placement->world_from_object * glm::vec4(baked_vert_pos[v], 1.0f)));
+			}
+			indices.push_back(it->second);
+		}
+		++num_occluders;
+	}
+
+	FILE *blob = fopen("occluders.blob", "wb");
+	uint32_t num_vertices = vertices.size();
+	uint32_t num_triangles = indices.size() / 3;
+	fwrite(&num_vertices, sizeof(uint32_t), 1, blob);
+	fwrite(&num_triangles, sizeof(uint32_t), 1, blob);
+	fwrite_compressed(vertices.data(), sizeof(glm::vec3), num_vertices, blob);
+	fwrite_compressed(indices.data(), sizeof(uint32_t), indices.size(), blob);
+	fclose(blob);
+	fprintf(stderr, "INFO: Baked %u occluders (%u triangles)\n", num_occluders, num_triangles);
+}
+
+
+//! Compute potentially visible instances for a grid of view cells and write them to "pvs.blob".
+//! Every cell rasterizes the occluders to cube maps around its corners and center and
+//! keeps instances seen from any of them. Bounding spheres are inflated by the distance
+//! between the sample points, so the result is conservative for cameras between them.
+void bake_pvs(const Occluders &occluders, const std::vector<glm::vec4> &bounds)
+{
+	PotentiallyVisibleSets pvs;
+	pvs.num_instances = bounds.size();
+	glm::vec2 lo(1.0e30f), hi(-1.0e30f);
+	for (const glm::vec4 &sphere : bounds) {
+		lo = glm::min(lo, glm::vec2(sphere));
+		hi = glm::max(hi, glm::vec2(sphere));
+	}
+	const glm::vec2 extent = hi - lo;
+	pvs.origin = lo;
+	pvs.cell_size = std::max(PVS_CELL_SIZE, std::max(extent.x, extent.y) / PVS_MAX_CELLS);
+	pvs.cells_x = std::max(1u, (uint32_t)ceilf(extent.x / pvs.cell_size));
+	pvs.cells_y = std::max(1u, (uint32_t)ceilf(extent.y / pvs.cell_size));
+	pvs.layers.assign(PVS_LAYERS, PVS_LAYERS + sizeof(PVS_LAYERS) / sizeof(PVS_LAYERS[0]));
+
+	// Cameras are never further than half of the longest cell edge from a sample point
+	std::vector<BoundingSpheres> layer_spheres(pvs.layers.size() - 1);
+	for (size_t layer = 0; layer < layer_spheres.size(); ++layer) {
+		const float margin = 0.5f * std::max(pvs.cell_size, pvs.layers[layer + 1] - pvs.layers[layer]);
+		std::vector<glm::vec4> inflated(bounds);
+		for (glm::vec4 &sphere : inflated)
+			sphere.w += margin;
+		assign_bounding_spheres(layer_spheres[layer], inflated.data(), inflated.size());
+	}
+
+	const glm::mat4 face_proj = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, PVS_VIEW_DISTANCE);
+	const glm::vec3 face_dirs[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+	const glm::vec3 face_ups[6] = { glm::vec3(0, 0, 1), glm::vec3(0, 0, 1), glm::vec3(0, 0, 1), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0), glm::vec3(0, 1, 0) };
+
+	std::vector<std::vector<uint16_t> > cell_runs(pvs.num_cells());
+	std::atomic<uint64_t> total_visible(0);
+	parallel_for(pvs.num_cells(), 1, [&](uint32_t begin, uint32_t end) {
+		OcclusionBuffer buffer;
+		resize_occlusion_buffer(buffer, occluders, PVS_VIEW_SIZE, PVS_VIEW_SIZE);
+		std::vector<uint8_t> visible(pvs.num_instances);
+		std::vector<uint32_t> candidates(pvs.num_instances);
+		for (uint32_t cell = begin; cell < end; ++cell) {
+			glm::vec3 cell_lo, cell_hi;
+			get_pvs_cell_bounds(pvs, cell, cell_lo, cell_hi);
+			const BoundingSpheres &spheres = layer_spheres[cell / (pvs.cells_x * pvs.cells_y)];
+			std::fill(visible.begin(), visible.end(), 0);
+
+			// 8 corners and the center
+			for (int sample = 0; sample < 9; ++sample) {
+				const glm::vec3 pos = (8 == sample) ? 0.5f * (cell_lo + cell_hi) : glm::vec3((sample & 1) ? cell_hi.x : cell_lo.x, (sample & 2) ? cell_hi.y : cell_lo.y, (sample & 4) ? cell_hi.z : cell_lo.z);
+				for (int face = 0; face < 6; ++face) {
+					const glm::mat4 clip_from_world = face_proj * glm::lookAt(pos, pos + face_dirs[face], face_ups[face]);
+					transform_occluders(buffer, occluders, clip_from_world, 0, occluders.vertices.size());
+					rasterize_occluders(buffer, occluders, 0, buffer.tiles_y);
+
+					const CullingFrustum frustum = make_culling_frustum(clip_from_world, pos, CULL_DISTANCE_UNLIMITED);
+					const uint32_t num_candidates = cull_spheres(frustum, spheres, 0, spheres.count, candidates.data());
+					for (uint32_t i = 0; i < num_candidates; ++i) {
+						const uint32_t idx = candidates[i];
+						if (visible[idx])
+							continue;
+						const glm::vec4 sphere(spheres.x[idx], spheres.y[idx], spheres.z[idx], spheres.radius[idx]);
+						if (!is_sphere_occluded(buffer, clip_from_world, sphere))
+							visible[idx] = 1;
+					}
+				}
+			}
+
+			encode_pvs_runs(visible.data(), pvs.num_instances, cell_runs[cell]);
+			total_visible += std::count(visible.begin(), visible.end(), 1);
+		}
+	});
+
+	for (const std::vector<uint16_t> &runs : cell_runs) {
+		pvs.cell_runs.push_back(pvs.runs.size());
+		pvs.runs.insert(pvs.runs.end(), runs.begin(), runs.end());
+	}
+	pvs.cell_runs.push_back(pvs.runs.size());
+
+	FILE *blob = fopen("pvs.blob", "wb");
+	uint32_t num_layers = pvs.layers.size() - 1;
+	uint32_t num_runs = pvs.runs.size();
+	fwrite(&pvs.num_instances, sizeof(uint32_t), 1, blob);
+	fwrite(&pvs.cells_x, sizeof(uint32_t), 1, blob);
+	fwrite(&pvs.cells_y, sizeof(uint32_t), 1, blob);
+	fwrite(&num_layers, sizeof(uint32_t), 1, blob);
+	fwrite(&num_runs, sizeof(uint32_t), 1, blob);
+	fwrite(&pvs.origin, sizeof(glm::vec2), 1, blob);
+	fwrite(&pvs.cell_size, sizeof(float), 1, blob);
+	fwrite(pvs.layers.data(), sizeof(float), pvs.layers.size(), blob);
+	fwrite_compressed(pvs.cell_runs.data(), sizeof(uint32_t), pvs.cell_runs.size(), blob);
+	fwrite_compressed(pvs.runs.data(), sizeof(uint16_t), pvs.runs.size(), blob);
+	fclose(blob);
+	fprintf(stderr, "INFO: Baked PVS of %ux%ux%u cells (%u runs, %.1f%% of instances visible on average)\n",
+		pvs.cells_x, pvs.cells_y, num_layers, num_runs, 100.0 * total_visible.load() / ((double)pvs.num_instances * pvs.num_cells()));
+}
+
+
 int main(int argc, char *argv[])
 {
 	const char *SECTORS[] = {
@@ -879,6 +1662,13 @@ int main(int argc, char *argv[])
 		"cisland"
 	};
 
+	for (int i = 1; i < argc; ++i) {
+		if (0 == strcmp("--spatial-model-order", argv[i]))
+			spatial_model_order = true;
+		else
+			fprintf(stderr, "WARNING: Unknown argument '%s'\n", argv[i]);
+	}
+
 	if (!parse_ide("generic", "data/maps/generic.ide"))
 		return 1;
 
@@ -925,25 +1715,98 @@ int main(int argc, char *argv[])
 		}
 	}
 	fprintf(stderr, "INFO: LOADING COMPLETED!\n");
+	start_job_pool(0); // HLOD proxies, mesh LODs and PVS are baked on all workers
+	link_lod_models();
+	bake_hlod_proxies();
 	upload_meshes();
+	bake_meshlets();
+	bake_mesh_lods();
 	fprintf(stderr, "INFO: BUFFER UPLOAD COMPLETE!\n");
 	upload_textures();
 	fprintf(stderr, "INFO: TEXTURE UPLOAD COMPLETE!\n");
 
 	// Batch draw calls
 	std::vector<Instance> instances;
+	std::vector<glm::vec4> bounds;
 	{
+		std::vector<glm::vec2> lod_ranges;
+
+		// Instances are laid out in Morton order, so neighbours in the buffer are mostly neighbours in the world
+		glm::vec3 world_lo(1.0e30f), world_hi(-1.0e30f);
+		for (const auto &pair : item_placements) {
+			for (const ItemPlacementEntry &ipl : pair.second) {
+				world_lo = glm::min(world_lo, ipl.position);
+				world_hi = glm::max(world_hi, ipl.position);
+			}
+		}
+		auto centroid_code = [&](const std::vector<const ItemPlacementEntry *> &placements) {
+			glm::vec3 centroid(0.0f);
+			for (const ItemPlacementEntry *ipl : placements)
+				centroid += ipl->position / (float)placements.size();
+			return morton_code(centroid, world_lo, world_hi);
+		};
+
+		// Models stay in the order of IDs, unless they should be laid out by their centroids as well
+		std::vector<std::pair<uint32_t, int> > model_order;
+		for (const auto &pair : item_placements) {
+			uint32_t code = 0;
+			if (spatial_model_order) {
+				std::vector<const ItemPlacementEntry *> placements;
+				for (const ItemPlacementEntry &ipl : pair.second)
+					placements.push_back(&ipl);
+				code = centroid_code(placements);
+			}
+			model_order.push_back(std::make_pair(code, pair.first));
+		}
+		std::stable_sort(model_order.begin(), model_order.end(), [](const std::pair<uint32_t, int> &a, const std::pair<uint32_t, int> &b) { return a.first < b.first; });
+
 		// Start with filling instance buffer
 		std::vector<glm::mat4> xforms;
-		for (const auto &pair : item_placements) {
-			Instance instance = {};
-			instance.id = pair.first;
-			instance.num_instances = pair.second.size();
-			instance.base_instance = xforms.size();
-			instances.push_back(instance);
-
-			for (const ItemPlacementEntry &ipl : pair.second)
-				xforms.push_back(ipl.world_from_object);
+		std::vector<InstanceCluster> clusters;
+		for (const auto &model : model_order) {
+			const int id = model.second;
+
+			// Split placements scattered over the whole map into spatial clusters, each getting its own draw calls
+			std::map<std::pair<int, int>, std::vector<const ItemPlacementEntry *> > cells;
+			for (const ItemPlacementEntry &ipl : item_placements[id])
+				cells[std::make_pair((int)floorf(ipl.position.x / CLUSTER_CELL_SIZE), (int)floorf(ipl.position.y / CLUSTER_CELL_SIZE))].push_back(&ipl);
+
+			std::vector<std::pair<uint32_t, std::vector<const ItemPlacementEntry *> > > ordered_cells;
+			for (auto &cell : cells) {
+				std::stable_sort(cell.second.begin(), cell.second.end(), [&](const ItemPlacementEntry *a, const ItemPlacementEntry *b) {
+					return morton_code(a->position, world_lo, world_hi) < morton_code(b->position, world_lo, world_hi);
+				});
+				ordered_cells.push_back(std::make_pair(centroid_code(cell.second), cell.second));
+			}
+			std::stable_sort(ordered_cells.begin(), ordered_cells.end(), [](const std::pair<uint32_t, std::vector<const ItemPlacementEntry *> > &a, const std::pair<uint32_t, std::vector<const ItemPlacementEntry *> > &b) {
+				return a.first < b.first;
+			});
+
+			const glm::vec4 &mesh_bounds = mesh_table[id].bounds;
+			uint32_t cluster_idx = 0;
+			for (const auto &cell : ordered_cells) {
+				Instance instance = {};
+				instance.id = id;
+				instance.cluster = cluster_idx++;
+				instance.num_instances = cell.second.size();
+				instance.base_instance = xforms.size();
+				instances.push_back(instance);
+
+				InstanceCluster cluster = { glm::vec3(1.0e30f), instance.base_instance, glm::vec3(-1.0e30f), instance.num_instances };
+				for (const ItemPlacementEntry *ipl : cell.second) {
+					xforms.push_back(ipl->world_from_object);
+					lod_ranges.push_back(ipl->lod_range);
+
+					// Transform the bounding sphere (the radius is scaled by the largest axis scale)
+					const glm::mat4 &m = ipl->world_from_object;
+					const float scale = std::max(glm::length(glm::vec3(m[0])), std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+					const glm::vec4 sphere(glm::vec3(m * glm::vec4(glm::vec3(mesh_bounds), 1.0f)), scale * mesh_bounds.w);
+					bounds.push_back(sphere);
+					cluster.lo = glm::min(cluster.lo, glm::vec3(sphere) - sphere.w);
+					cluster.hi = glm::max(cluster.hi, glm::vec3(sphere) + sphere.w);
+				}
+				clusters.push_back(cluster);
+			}
 		}
 
 		// Write all instance matrices to "instances.blob"
@@ -952,7 +1815,31 @@ int main(int argc, char *argv[])
 		fwrite(&num_instances, sizeof(uint32_t), 1, blob);
 		fwrite_compressed(xforms.data(), sizeof(glm::mat4), xforms.size(), blob);
 		fclose(blob);
+
+		// Write world-space bounding spheres of all instances to "bounds.blob" (in the same order)
+		blob = fopen("bounds.blob", "wb");
+		fwrite(&num_instances, sizeof(uint32_t), 1, blob);
+		fwrite_compressed(bounds.data(), sizeof(glm::vec4), bounds.size(), blob);
+		fclose(blob);
+
+		// Write camera distance ranges of all instances to "lods.blob" (in the same order)
+		blob = fopen("lods.blob", "wb");
+		fwrite(&num_instances, sizeof(uint32_t), 1, blob);
+		fwrite_compressed(lod_ranges.data(), sizeof(glm::vec2), lod_ranges.size(), blob);
+		fclose(blob);
+
+		// Write boxes of all spatial clusters to "clusters.blob" (in the same order as instances)
+		blob = fopen("clusters.blob", "wb");
+		uint32_t num_clusters = clusters.size();
+		fwrite(&num_clusters, sizeof(uint32_t), 1, blob);
+		fwrite_compressed(clusters.data(), sizeof(InstanceCluster), clusters.size(), blob);
+		fclose(blob);
+		fprintf(stderr, "INFO: Split %u instances of %u models into %u clusters\n", num_instances, (uint32_t)item_placements.size(), num_clusters);
 	}
+	Occluders occluders;
+	bake_occluders(occluders);
+	bake_pvs(occluders, bounds);
+	stop_job_pool();
 	// Then sort the draw calls to reduce state switches and enable instancing
 	for (const Instance &instance : instances) {
 		const ItemDefinitionEntry &def = item_definitions[instance.id]; // The Item Definition of object that will be drawn
@@ -975,11 +1862,13 @@ int main(int argc, char *argv[])
 			uint16_t slice_index = ref.index / MAX_ARRAY_TEXTURE_LAYERS; // Index to the slice (array texture) containg the texture to render
 			uint16_t texture_id = ref.index % MAX_ARRAY_TEXTURE_LAYERS; // The index of the texture to render within the slice (texture array) => gl_DrawId / u_TempTextureIdx
 
-			// TTTT TTTTTTTT SSSSSSSS ---IIIII IIIIIIII -MMMMMMM
+			// --AATTTT TTTTTTTT SSSSSSSS ---IIIII IIIIIIII CCCCCCCC CCCCCCCC MMMMMMMM
 			uint64_t sort_key = 0
-				| (((uint64_t)ref.bucket_key & 0xFFF) << 32)  // 12-bit bucket key
-				| (((uint64_t)slice_index & 0xFF) << 24)  // 8-bit slice key (texture array within bucket)
-				| (((uint64_t)def.id & 0xFFF) << 8)  // Item definition ID
+				| (((uint64_t)ref.alpha_class & 0x3) << 60)  // 2-bit alpha class (opaque, cutout and translucent draw calls form contiguous ranges)
+				| (((uint64_t)ref.bucket_key & 0xFFF) << 48)  // 12-bit bucket key
+				| (((uint64_t)slice_index & 0xFF) << 40)  // 8-bit slice key (texture array within bucket)
+				| (((uint64_t)def.id & 0x1FFF) << 24)  // 13-bit item definition ID
+				| (((uint64_t)instance.cluster & 0xFFFF) << 8)  // 16-bit spatial cluster of the model
 				| ((uint64_t)mat_split_idx & 0xFF)  // Mesh/Material split index
 				;
 
@@ -309,6 +309,294 @@ int rebake_instances(const char *out_filename, const char *in_filename)
 }
 
 
+//! Function for rebaking "bounds.blob" files.
+int rebake_bounds(const char *out_filename, const char *in_filename)
+{
+	FILE *in_blob = fopen(in_filename, "rb");
+	if (!in_blob)
+		return -1; // Couldn't open input file for reading
+
+	FILE *out_blob = fopen(out_filename, "wb");
+	if (!out_blob) {
+		fclose(in_blob);
+		return -2; // Couldn't open output file for writing
+	}
+
+	// Read file header
+	uint32_t num_instances = 0;
+	fread(&num_instances, sizeof(num_instances), 1, in_blob);
+	printf("VERBOSE: num_instances=%u\n", num_instances);
+	uint32_t num_instances2 = SWAP_ENDIANNESS_4BYTES(num_instances);
+	fwrite(&num_instances2, sizeof(num_instances2), 1, out_blob);
+
+	// Every bounding sphere is a vec4 (center, radius)
+	for (uint32_t i = 0; i < 4 * num_instances; i++) {
+		uint32_t value = 0;
+		fread(&value, sizeof(uint32_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_4BYTES(value);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	fclose(in_blob);
+	fclose(out_blob);
+	printf("INFO: Finished processing bounds\n");
+	return 0;
+}
+
+
+//! Function for rebaking "clusters.blob" files.
+int rebake_clusters(const char *out_filename, const char *in_filename)
+{
+	FILE *in_blob = fopen(in_filename, "rb");
+	if (!in_blob)
+		return -1; // Couldn't open input file for reading
+
+	FILE *out_blob = fopen(out_filename, "wb");
+	if (!out_blob) {
+		fclose(in_blob);
+		return -2; // Couldn't open output file for writing
+	}
+
+	// Read file header
+	uint32_t num_clusters = 0;
+	fread(&num_clusters, sizeof(num_clusters), 1, in_blob);
+	printf("VERBOSE: num_clusters=%u\n", num_clusters);
+	uint32_t num_clusters2 = SWAP_ENDIANNESS_4BYTES(num_clusters);
+	fwrite(&num_clusters2, sizeof(num_clusters2), 1, out_blob);
+
+	// Every cluster is vec3 lo, uint32_t base_instance, vec3 hi, uint32_t count
+	for (uint32_t i = 0; i < 8 * num_clusters; i++) {
+		uint32_t value = 0;
+		fread(&value, sizeof(uint32_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_4BYTES(value);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	fclose(in_blob);
+	fclose(out_blob);
+	printf("INFO: Finished processing clusters\n");
+	return 0;
+}
+
+
+//! Function for rebaking "lods.blob" files.
+int rebake_lods(const char *out_filename, const char *in_filename)
+{
+	FILE *in_blob = fopen(in_filename, "rb");
+	if (!in_blob)
+		return -1; // Couldn't open input file for reading
+
+	FILE *out_blob = fopen(out_filename, "wb");
+	if (!out_blob) {
+		fclose(in_blob);
+		return -2; // Couldn't open output file for writing
+	}
+
+	// Read file header
+	uint32_t num_ranges = 0;
+	fread(&num_ranges, sizeof(num_ranges), 1, in_blob);
+	printf("VERBOSE: num_ranges=%u\n", num_ranges);
+	uint32_t num_ranges2 = SWAP_ENDIANNESS_4BYTES(num_ranges);
+	fwrite(&num_ranges2, sizeof(num_ranges2), 1, out_blob);
+
+	// Every range is vec2 (nearest and farthest camera distance)
+	for (uint32_t i = 0; i < 2 * num_ranges; i++) {
+		uint32_t value = 0;
+		fread(&value, sizeof(uint32_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_4BYTES(value);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	fclose(in_blob);
+	fclose(out_blob);
+	printf("INFO: Finished processing LOD ranges\n");
+	return 0;
+}
+
+
+//! Function for rebaking "meshlets.blob" files.
+int rebake_meshlets(const char *out_filename, const char *in_filename)
+{
+	FILE *in_blob = fopen(in_filename, "rb");
+	if (!in_blob)
+		return -1; // Couldn't open input file for reading
+
+	FILE *out_blob = fopen(out_filename, "wb");
+	if (!out_blob) {
+		fclose(in_blob);
+		return -2; // Couldn't open output file for writing
+	}
+
+	// Read file header
+	uint32_t num_meshes = 0, num_meshlets = 0, num_indices = 0;
+	fread(&num_meshes, sizeof(num_meshes), 1, in_blob);
+	fread(&num_meshlets, sizeof(num_meshlets), 1, in_blob);
+	fread(&num_indices, sizeof(num_indices), 1, in_blob);
+	printf("VERBOSE: num_meshes=%u num_meshlets=%u num_indices=%u\n", num_meshes, num_meshlets, num_indices);
+	uint32_t num_meshes2 = SWAP_ENDIANNESS_4BYTES(num_meshes);
+	uint32_t num_meshlets2 = SWAP_ENDIANNESS_4BYTES(num_meshlets);
+	uint32_t num_indices2 = SWAP_ENDIANNESS_4BYTES(num_indices);
+	fwrite(&num_meshes2, sizeof(num_meshes2), 1, out_blob);
+	fwrite(&num_meshlets2, sizeof(num_meshlets2), 1, out_blob);
+	fwrite(&num_indices2, sizeof(num_indices2), 1, out_blob);
+
+	// Ranges have 3 uint32_t, meshlets 2 vec4 and 4 uint32_t
+	for (uint32_t i = 0; i < 3 * num_meshes + 12 * num_meshlets; i++) {
+		uint32_t value = 0;
+		fread(&value, sizeof(uint32_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_4BYTES(value);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	// Indices are 16-bit
+	for (uint32_t i = 0; i < num_indices; i++) {
+		uint16_t index = 0;
+		fread(&index, sizeof(uint16_t), 1, in_blob);
+		index = SWAP_ENDIANNESS_2BYTES(index);
+		fwrite(&index, sizeof(uint16_t), 1, out_blob);
+	}
+
+	fclose(in_blob);
+	fclose(out_blob);
+	printf("INFO: Finished processing meshlets\n");
+	return 0;
+}
+
+
+//! Function for rebaking "meshlods.blob" files.
+int rebake_meshlods(const char *out_filename, const char *in_filename)
+{
+	FILE *in_blob = fopen(in_filename, "rb");
+	if (!in_blob)
+		return -1; // Couldn't open input file for reading
+
+	FILE *out_blob = fopen(out_filename, "wb");
+	if (!out_blob) {
+		fclose(in_blob);
+		return -2; // Couldn't open output file for writing
+	}
+
+	// Read file header
+	uint32_t num_meshes = 0, num_lods = 0, num_indices = 0;
+	fread(&num_meshes, sizeof(num_meshes), 1, in_blob);
+	fread(&num_lods, sizeof(num_lods), 1, in_blob);
+	fread(&num_indices, sizeof(num_indices), 1, in_blob);
+	printf("VERBOSE: num_meshes=%u num_lods=%u num_indices=%u\n", num_meshes, num_lods, num_indices);
+	uint32_t num_meshes2 = SWAP_ENDIANNESS_4BYTES(num_meshes);
+	uint32_t num_lods2 = SWAP_ENDIANNESS_4BYTES(num_lods);
+	uint32_t num_indices2 = SWAP_ENDIANNESS_4BYTES(num_indices);
+	fwrite(&num_meshes2, sizeof(num_meshes2), 1, out_blob);
+	fwrite(&num_lods2, sizeof(num_lods2), 1, out_blob);
+	fwrite(&num_indices2, sizeof(num_indices2), 1, out_blob);
+
+	// Ranges have 3 uint32_t, LODs 4 uint32_t and a float
+	for (uint32_t i = 0; i < 3 * num_meshes + 5 * num_lods; i++) {
+		uint32_t value = 0;
+		fread(&value, sizeof(uint32_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_4BYTES(value);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	// Indices are 16-bit
+	for (uint32_t i = 0; i < num_indices; i++) {
+		uint16_t index = 0;
+		fread(&index, sizeof(uint16_t), 1, in_blob);
+		index = SWAP_ENDIANNESS_2BYTES(index);
+		fwrite(&index, sizeof(uint16_t), 1, out_blob);
+	}
+
+	fclose(in_blob);
+	fclose(out_blob);
+	printf("INFO: Finished processing mesh LODs\n");
+	return 0;
+}
+
+
+//! Function for rebaking "occluders.blob" files.
+int rebake_occluders(const char *out_filename, const char *in_filename)
+{
+	FILE *in_blob = fopen(in_filename, "rb");
+	if (!in_blob)
+		return -1; // Couldn't open input file for reading
+
+	FILE *out_blob = fopen(out_filename, "wb");
+	if (!out_blob) {
+		fclose(in_blob);
+		return -2; // Couldn't open output file for writing
+	}
+
+	// Read file header
+	uint32_t num_vertices = 0, num_triangles = 0;
+	fread(&num_vertices, sizeof(num_vertices), 1, in_blob);
+	fread(&num_triangles, sizeof(num_triangles), 1, in_blob);
+	printf("VERBOSE: num_vertices=%u num_triangles=%u\n", num_vertices, num_triangles);
+	uint32_t num_vertices2 = SWAP_ENDIANNESS_4BYTES(num_vertices);
+	uint32_t num_triangles2 = SWAP_ENDIANNESS_4BYTES(num_triangles);
+	fwrite(&num_vertices2, sizeof(num_vertices2), 1, out_blob);
+	fwrite(&num_triangles2, sizeof(num_triangles2), 1, out_blob);
+
+	// Vertices are vec3, followed by 3 uint32_t indices per triangle
+	for (uint32_t i = 0; i < 3 * num_vertices + 3 * num_triangles; i++) {
+		uint32_t value = 0;
+		fread(&value, sizeof(uint32_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_4BYTES(value);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	fclose(in_blob);
+	fclose(out_blob);
+	printf("INFO: Finished processing occluders\n");
+	return 0;
+}
+
+
+//! Function for rebaking "pvs.blob" files.
+int rebake_pvs(const char *out_filename, const char *in_filename)
+{
+	FILE *in_blob = fopen(in_filename, "rb");
+	if (!in_blob)
+		return -1; // Couldn't open input file for reading
+
+	FILE *out_blob = fopen(out_filename, "wb");
+	if (!out_blob) {
+		fclose(in_blob);
+		return -2; // Couldn't open output file for writing
+	}
+
+	// Read file header
+	uint32_t header[5] = {}; // num_instances, cells_x, cells_y, num_layers, num_runs
+	fread(header, sizeof(uint32_t), 5, in_blob);
+	const uint32_t num_layers = header[3], num_runs = header[4];
+	const uint32_t num_cells = header[1] * header[2] * num_layers;
+	printf("VERBOSE: num_instances=%u cells=%ux%ux%u num_runs=%u\n", header[0], header[1], header[2], num_layers, num_runs);
+	for (int i = 0; i < 5; i++) {
+		uint32_t value = SWAP_ENDIANNESS_4BYTES(header[i]);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	// Grid origin, cell size and layer heights are floats, followed by the first run of every cell
+	for (uint32_t i = 0; i < 3 + num_layers + 1 + num_cells + 1; i++) {
+		uint32_t value = 0;
+		fread(&value, sizeof(uint32_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_4BYTES(value);
+		fwrite(&value, sizeof(uint32_t), 1, out_blob);
+	}
+
+	// Runs are 16-bit
+	for (uint32_t i = 0; i < num_runs; i++) {
+		uint16_t value = 0;
+		fread(&value, sizeof(uint16_t), 1, in_blob);
+		value = SWAP_ENDIANNESS_2BYTES(value);
+		fwrite(&value, sizeof(uint16_t), 1, out_blob);
+	}
+
+	fclose(in_blob);
+	fclose(out_blob);
+	printf("INFO: Finished processing PVS\n");
+	return 0;
+}
+
+
 //! Function for rebaking "drawables.blob" files.
 int rebake_drawables(const char *out_filename, const char *in_filename)
 {
@@ -382,6 +670,69 @@ int main(int argc, char *argv[])
 		return 3;
 	}
 
+	// Bounding spheres are optional (older bakes don't have them)
+	status = rebake_bounds("bounds.ps3.blob", "bounds.blob");
+	if (-1 == status)
+		fprintf(stderr, "WARNING: 'bounds.blob' not found, skipping\r\n");
+	else if (0 != status) {
+		fprintf(stderr, "ERROR: 'bounds.blob' conversion failed with status=%i\r\n", status);
+		return 5;
+	}
+
+	// Spatial clusters are optional as well
+	status = rebake_clusters("clusters.ps3.blob", "clusters.blob");
+	if (-1 == status)
+		fprintf(stderr, "WARNING: 'clusters.blob' not found, skipping\r\n");
+	else if (0 != status) {
+		fprintf(stderr, "ERROR: 'clusters.blob' conversion failed with status=%i\r\n", status);
+		return 8;
+	}
+
+	// Draw distances of LOD models too
+	status = rebake_lods("lods.ps3.blob", "lods.blob");
+	if (-1 == status)
+		fprintf(stderr, "WARNING: 'lods.blob' not found, skipping\r\n");
+	else if (0 != status) {
+		fprintf(stderr, "ERROR: 'lods.blob' conversion failed with status=%i\r\n", status);
+		return 10;
+	}
+
+	// And meshlets
+	status = rebake_meshlets("meshlets.ps3.blob", "meshlets.blob");
+	if (-1 == status)
+		fprintf(stderr, "WARNING: 'meshlets.blob' not found, skipping\r\n");
+	else if (0 != status) {
+		fprintf(stderr, "ERROR: 'meshlets.blob' conversion failed with status=%i\r\n", status);
+		return 9;
+	}
+
+	// And simplified LOD levels of meshes
+	status = rebake_meshlods("meshlods.ps3.blob", "meshlods.blob");
+	if (-1 == status)
+		fprintf(stderr, "WARNING: 'meshlods.blob' not found, skipping\r\n");
+	else if (0 != status) {
+		fprintf(stderr, "ERROR: 'meshlods.blob' conversion failed with status=%i\r\n", status);
+		return 11;
+	}
+
+	// So are the occluders
+	status = rebake_occluders("occluders.ps3.blob", "occluders.blob");
+	if (-1 == status)
+		fprintf(stderr, "WARNING: 'occluders.blob' not found, skipping\r\n");
+	else if (0 != status) {
+		fprintf(stderr, "ERROR: 'occluders.blob' conversion failed with status=%i\r\n", status);
+		return 6;
+	}
+
+	// So are the potentially visible sets
+	status = rebake_pvs("pvs.ps3.blob", "pvs.blob");
+	if (-1 == status)
+		fprintf(stderr, "WARNING: 'pvs.blob' not found, skipping\r\n");
+	else if (0 != status) {
+		fprintf(stderr, "ERROR: 'pvs.blob' conversion failed with status=%i\r\n", status);
+		return 7;
+	}
+
 	status = rebake_drawables("drawables.ps3.blob", "drawables.blob");
 	if (0 != status) {
 		fprintf(stderr, "ERROR: 'drawables.blob' conversion failed with status=%i\r\n", status);
@@ -1,8 +1,20 @@
 /*
  * Super primitive "game" framework.
  * It works without dynamic polymorphism! Yey!
+ *
+ * All callbacks return a status: zero keeps the application running, negative value
+ * means that the application wants to quit gracefully and positive one is an error code.
+ *
+ * The simulation (fixed_update() and post_update()) hands every frame over to render() through
+ * one of FRAME_PACKETS packets. If the application sets `threaded_rendering`, render() runs on its
+ * own thread, which owns the OpenGL context, and the main thread simulates the next frame meanwhile.
+ * It waits until the render thread takes the previous packet, so it is never more than a frame ahead.
 */
 #include <stdlib.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 #include <SDL.h>
 
 extern int initialize(int argc, char *argv[]);
@@ -10,6 +22,10 @@ extern int fixed_update(uint64_t delta_micros);
 extern int post_update(uint64_t delta_micros);
 extern int render(void);
 extern void cleanup(void);
+extern void publish_frame(uint32_t slot); //!< Copy the simulated frame into given packet
+extern void acquire_frame(uint32_t slot); //!< Prepare render() of given packet
+extern void bind_render_context(bool bind);
+extern bool threaded_rendering;
 
 static const uint64_t MICROS_PER_FRAME = 16666ULL; // 60 Hz
 static const uint64_t MICROSECONDS_IN_SECOND = 1000000ULL;
@@ -19,6 +35,15 @@ static uint64_t _prev_update_time; //!< Previous application update time in micr
 static uint64_t _prev_real_time;
 static int _status;
 
+static const uint32_t FRAME_PACKETS = 2; //!< One is simulated, while the other one is rendered
+static std::thread _render_thread;
+static std::mutex _frame_mutex;
+static std::condition_variable _frame_cv;
+static uint64_t _published_frames = 0; //!< Guarded by `_frame_mutex`
+static uint64_t _acquired_frames = 0; //!< Guarded by `_frame_mutex`
+static bool _render_quit = false; //!< Guarded by `_frame_mutex`
+static int _render_status = 0; //!< Guarded by `_frame_mutex`
+
 
 static
 void terminate(void)
@@ -28,6 +53,50 @@ void terminate(void)
 }
 
 
+static
+void render_loop(void)
+{
+	bind_render_context(true);
+	std::unique_lock<std::mutex> lock(_frame_mutex);
+	while (true) {
+		_frame_cv.wait(lock, [] { return _render_quit || _acquired_frames < _published_frames; });
+		if (_acquired_frames == _published_frames)
+			break;
+
+		// The simulation may start filling the other packet right away
+		const uint32_t slot = _acquired_frames++ % FRAME_PACKETS;
+		lock.unlock();
+		_frame_cv.notify_all();
+		acquire_frame(slot);
+		const int status = render();
+		lock.lock();
+		if (status != 0) {
+			_render_status = status;
+			break;
+		}
+	}
+	lock.unlock();
+	_frame_cv.notify_all();
+	bind_render_context(false);
+}
+
+
+//! Publish the simulated frame for the render thread, once it took the previous one.
+static
+void hand_off_frame(void)
+{
+	std::unique_lock<std::mutex> lock(_frame_mutex);
+	_frame_cv.wait(lock, [] { return _render_status != 0 || _acquired_frames == _published_frames; });
+	if (_render_status != 0) {
+		_status = _render_status;
+		return;
+	}
+	publish_frame(_published_frames++ % FRAME_PACKETS);
+	lock.unlock();
+	_frame_cv.notify_all();
+}
+
+
 static
 void frame(void)
 {
@@ -47,8 +116,15 @@ void frame(void)
 	if (_status == 0)
 		_status = post_update(app_time_diff);
 
-	if (_status == 0)
+	if (_status != 0)
+		return;
+	if (threaded_rendering) {
+		hand_off_frame();
+	} else {
+		publish_frame(0);
+		acquire_frame(0);
 		_status = render();
+	}
 }
 
 
@@ -60,8 +136,23 @@ int main(int argc, char *argv[])
 	
 	TIMER_RESOLUTION = SDL_GetPerformanceFrequency() / MICROSECONDS_IN_SECOND;
 	_prev_real_time = SDL_GetPerformanceCounter();
+	if (_status == 0 && threaded_rendering) {
+		bind_render_context(false);
+		_render_thread = std::thread(render_loop);
+	}
 	while (_status == 0)
 		frame();
 
-	return _status;
+	// Everything is cleaned up on the main thread again
+	if (_render_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_frame_mutex);
+			_render_quit = true;
+		}
+		_frame_cv.notify_all();
+		_render_thread.join();
+		bind_render_context(true);
+	}
+
+	return (_status < 0) ? 0 : _status;
 }
@@ -0,0 +1,32 @@
+/*
+ * CPU tests of the culling kernels and the baking code.
+ *
+ * No GPU, window or baked data is needed. Returns non-zero if any check failed.
+ */
+#include "tests.h"
+
+
+int main()
+{
+	struct {
+		const char *name;
+		int (*run)();
+	} tests[] = {
+		{ "culling", test_culling },
+		{ "occlusion", test_occlusion },
+		{ "meshlet", test_meshlet },
+		{ "morton", test_morton },
+		{ "simplify", test_simplify },
+	};
+
+	int failures = 0;
+	for (const auto &test : tests) {
+		const int test_failures = test.run();
+		if (test_failures)
+			fprintf(stderr, "ERROR: Test '%s' failed %i checks\n", test.name, test_failures);
+		else
+			fprintf(stderr, "INFO: Test '%s' passed\n", test.name);
+		failures += test_failures;
+	}
+	return failures ? 1 : 0;
+}
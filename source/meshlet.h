@@ -0,0 +1,44 @@
+/*
+ * Partitioning of meshes into small clusters of triangles (meshlets) with bounds for coarse culling.
+ *
+ * Every meshlet has a bounding sphere and a cone around normals of its triangles,
+ * so whole meshlets can be rejected outside of the frustum or facing away from the camera.
+ * Like culling.h, this module doesn't depend on OpenGL.
+ */
+#ifndef _MESHLET_INCLUDED
+#define _MESHLET_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+static const uint32_t MESHLET_MAX_VERTICES = 64;
+static const uint32_t MESHLET_MAX_TRIANGLES = 124;
+
+//! Cluster of triangles within a material split of a mesh (as stored in "meshlets.blob").
+struct Meshlet {
+	glm::vec4 sphere; //!< Bounding sphere in object space (center, radius)
+	glm::vec4 cone; //!< Average normal and sine of the widest angle of normals from it (1 = never back-facing)
+	uint32_t first_index; //!< Into the index buffer of meshlets (3 indices per triangle)
+	uint32_t num_triangles;
+	uint32_t num_vertices;
+	uint32_t split; //!< Material split of the mesh
+};
+
+//! Meshlets of a single mesh.
+struct MeshletRange {
+	uint32_t id; //!< Item definition ID
+	uint32_t first_meshlet;
+	uint32_t num_meshlets;
+};
+
+//! Greedily split counter-clockwise triangles (3 indices into `positions` each) into meshlets of
+//! consecutive triangles. Appends meshlets to `meshlets` and their triangles to `indices`.
+void build_meshlets(const glm::vec3 *positions, const uint32_t *triangles, uint32_t num_triangles, uint32_t split,
+	std::vector<Meshlet> &meshlets, std::vector<uint32_t> &indices);
+
+//! @returns True, if all triangles of the meshlet face away from the camera (in object space).
+bool is_meshlet_backfacing(const Meshlet &meshlet, const glm::vec3 &camera);
+
+
+#endif
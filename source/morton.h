@@ -0,0 +1,18 @@
+/*
+ * Morton codes (Z-order) of positions, used to lay out instances, so neighbours in buffers are mostly
+ * neighbours in the world. Like culling.h, this module doesn't depend on OpenGL.
+ */
+#ifndef _MORTON_INCLUDED
+#define _MORTON_INCLUDED
+#include <stdint.h>
+#include <glm/glm.hpp>
+
+
+//! Spread the lowest 10 bits of `v`, so there are two zero bits between each of them.
+uint32_t expand_morton_bits(uint32_t v);
+
+//! 30-bit Morton code of a position quantized within the box [lo, hi] (X in the highest bit of every triple).
+uint32_t morton_code(const glm::vec3 &pos, const glm::vec3 &lo, const glm::vec3 &hi);
+
+
+#endif
@@ -0,0 +1,50 @@
+/*
+ * Software occlusion culling with a low-resolution depth buffer of baked occluders.
+ *
+ * Like culling.h, this module doesn't depend on OpenGL. The result doesn't depend
+ * on the number of threads, since every pixel keeps the nearest depth regardless
+ * of the order in which the triangles were rasterized.
+ */
+#ifndef _OCCLUSION_INCLUDED
+#define _OCCLUSION_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+//! Size of the square tiles, which keep their farthest depth for quick rejection.
+static const uint32_t OCCLUSION_TILE_SIZE = 8;
+
+//! Low-poly occluder geometry in world space (as read from "occluders.blob").
+struct Occluders {
+	std::vector<glm::vec3> vertices;
+	std::vector<uint32_t> indices; //!< 3 per triangle
+};
+
+//! Depth buffer holding the nearest window-space depth [0, 1] of rasterized occluders.
+struct OcclusionBuffer {
+	uint32_t width, height; //!< Multiples of OCCLUSION_TILE_SIZE
+	uint32_t tiles_x, tiles_y;
+	std::vector<float> depth; //!< Row-major, 1.0 where no occluder was rasterized
+	std::vector<float> tile_farthest; //!< Farthest depth within every tile
+	std::vector<glm::vec4> screen; //!< Transformed occluder vertices (pixels, depth, clip-space w)
+
+	OcclusionBuffer() : width(0), height(0), tiles_x(0), tiles_y(0) {}
+};
+
+//! Allocate the buffer for given occluders (the size is rounded up to whole tiles).
+void resize_occlusion_buffer(OcclusionBuffer &buffer, const Occluders &occluders, uint32_t width, uint32_t height);
+
+//! Transform occluder vertices [first, end) to window space of the buffer.
+void transform_occluders(OcclusionBuffer &buffer, const Occluders &occluders, const glm::mat4 &clip_from_world, uint32_t first, uint32_t end);
+
+//! Clear tile rows [first_row, end_row) and rasterize all transformed occluders into them.
+//! Disjoint ranges of rows can be rasterized in parallel.
+void rasterize_occluders(OcclusionBuffer &buffer, const Occluders &occluders, uint32_t first_row, uint32_t end_row);
+
+//! Test the box around given sphere (center, radius) against the rasterized occluders.
+//! @returns True, if the sphere is entirely hidden (spheres crossing the near plane never are).
+bool is_sphere_occluded(const OcclusionBuffer &buffer, const glm::mat4 &clip_from_world, const glm::vec4 &sphere);
+
+
+#endif
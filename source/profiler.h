@@ -0,0 +1,73 @@
+/*
+ * Tiny hot-path profiler with CPU zones, GPU timer queries and Chrome trace export.
+ *
+ * Everything here compiles to nothing, unless ENABLE_PROFILER is defined
+ * (it is defined in Debug configuration or with `premake5 --with-profiler`).
+ * The traces can be opened in chrome://tracing or https://ui.perfetto.dev
+ */
+#ifndef _PROFILER_INCLUDED
+#define _PROFILER_INCLUDED
+#include <stdint.h>
+
+
+//! Number of log2 buckets of zone duration histograms (the first one holds zones shorter than 1 us).
+static const int PROFILER_HISTOGRAM_BUCKETS = 20;
+
+//! Statistics of all recorded occurrences of a zone which are still kept in the ring buffer.
+struct ProfileStats {
+	uint32_t count;
+	double mean_us, min_us, max_us;
+	uint32_t histogram[PROFILER_HISTOGRAM_BUCKETS]; //!< histogram[i] counts zones taking [2^(i-1), 2^i) microseconds
+};
+
+
+#if defined(ENABLE_PROFILER)
+
+#define PROFILER_CONCAT_IMPL(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+
+//! Measure CPU time spent until the end of the current scope. The name has to be a string literal.
+#define PROFILE_ZONE(name) ProfileZone PROFILER_CONCAT(_profile_zone_, __LINE__)(name)
+//! Measure GPU time of commands issued between begin and end (those can't be nested).
+#define PROFILE_GPU_BEGIN(name) profiler_gpu_begin(name)
+#define PROFILE_GPU_END() profiler_gpu_end()
+//! Has to be called once per frame by the thread owning the OpenGL context.
+#define PROFILE_FRAME() profiler_frame()
+
+void profiler_init();
+void profiler_shutdown();
+void profiler_frame();
+void profiler_gpu_begin(const char *name);
+void profiler_gpu_end();
+void profiler_record(const char *name, uint64_t start_ns, uint64_t end_ns);
+uint64_t profiler_now();
+
+//! Compute statistics of given zone (GPU zones are prefixed with "gpu:").
+bool profiler_zone_stats(const char *name, ProfileStats &stats);
+//! Write all zones kept in the ring buffer as Chrome's trace event JSON.
+bool profiler_write_trace(const char *filename);
+
+struct ProfileZone {
+	const char *name;
+	uint64_t start;
+
+	ProfileZone(const char *zone_name) : name(zone_name), start(profiler_now()) {}
+	~ProfileZone() { profiler_record(name, start, profiler_now()); }
+};
+
+#else
+
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_GPU_BEGIN(name) ((void)0)
+#define PROFILE_GPU_END() ((void)0)
+#define PROFILE_FRAME() ((void)0)
+
+static inline void profiler_init() {}
+static inline void profiler_shutdown() {}
+static inline bool profiler_zone_stats(const char *, ProfileStats &) { return false; }
+static inline bool profiler_write_trace(const char *) { return false; }
+
+#endif
+
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Precomputed potentially visible sets (PVS) of instances for a grid of view cells.
+ *
+ * The baker splits the map into columns of cells on a 2D grid, which are further
+ * split into height layers (street level and aerial views). Every cell stores
+ * a run-length encoded bitset of instances, which may be seen from within the cell.
+ * Like culling.h, this module doesn't depend on OpenGL.
+ */
+#ifndef _PVS_INCLUDED
+#define _PVS_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+//! Returned by find_pvs_cell() for positions outside of the grid (everything is potentially visible).
+static const uint32_t PVS_NO_CELL = 0xFFFFFFFF;
+
+//! Visibility of all instances for every cell (as read from "pvs.blob").
+struct PotentiallyVisibleSets {
+	uint32_t num_instances;
+	glm::vec2 origin; //!< Minimum corner of the grid
+	float cell_size;
+	uint32_t cells_x, cells_y;
+	std::vector<float> layers; //!< Ascending heights splitting the cells vertically (one more than there are layers)
+	std::vector<uint32_t> cell_runs; //!< The first run of every cell, followed by the total number of runs
+	std::vector<uint16_t> runs; //!< Alternating lengths of hidden and visible instances (starting with hidden ones)
+
+	PotentiallyVisibleSets() : num_instances(0), cell_size(0.0f), cells_x(0), cells_y(0) {}
+	uint32_t num_cells() const { return layers.empty() ? 0 : cells_x * cells_y * (uint32_t)(layers.size() - 1); }
+};
+
+//! Find the cell containing given position.
+//! @returns Index of the cell or PVS_NO_CELL.
+uint32_t find_pvs_cell(const PotentiallyVisibleSets &pvs, const glm::vec3 &position);
+
+//! Get the box covered by given cell.
+void get_pvs_cell_bounds(const PotentiallyVisibleSets &pvs, uint32_t cell, glm::vec3 &lo, glm::vec3 &hi);
+
+//! Append runs of a bitset (one byte per instance, non-zero for visible ones) to `runs`.
+//! Runs longer than 65535 instances are split with an empty run of the opposite kind.
+void encode_pvs_runs(const uint8_t *visible, uint32_t count, std::vector<uint16_t> &runs);
+
+//! Expand the bitset of given cell to `visible` (one byte per instance, 1 for visible ones).
+void decode_pvs_cell(const PotentiallyVisibleSets &pvs, uint32_t cell, uint8_t *visible);
+
+
+#endif
@@ -17,19 +17,63 @@ static const char *GLSL_VERTEX_SHADER =
         "// This is the 'fast path' which cuts the number                  \n"
         "// of draw calls to minimum (below 40).                           \n"
         "#extension GL_ARB_shader_draw_parameters : require                \n"
+        "#if HAS_VERTEX_PULLING                                            \n"
+        "#extension GL_ARB_shader_storage_buffer_object : require          \n"
+        "#endif                                                            \n"
         "\n"
         "flat out uint DrawID;                                             \n"
+        "flat out uint InstanceIndex; // written to the visibility buffer  \n"
+        "uniform uint u_DrawIDOffset; // where the MDI starts in TextureIndices\n"
         "#endif                                                            \n"
         "\n"
         "uniform mat4 u_WorldFromObject; // world                          \n"
         "uniform mat4 u_ClipFromWorld;   // projection * view              \n"
         "\n"
+        "#if HAS_VERTEX_PULLING                                            \n"
+        "// Vertices are pulled by gl_VertexID (including the base vertex) \n"
+        "// and ClipFromObject was computed once per visible instance slot \n"
+        "layout(std430, binding=8) readonly buffer Positions {             \n"
+        "       float positions[]; // tightly packed vec3                  \n"
+        "};                                                                \n"
+        "layout(std430, binding=9) readonly buffer Colors {                \n"
+        "       uint colors[]; // RGBA8                                    \n"
+        "};                                                                \n"
+        "layout(std430, binding=10) readonly buffer TexCoords {            \n"
+        "       vec4 uvs[];                                                \n"
+        "};                                                                \n"
+        "layout(std430, binding=11) readonly buffer ClipFromObjects {      \n"
+        "       mat4 clip_from_objects[]; // indexed by slots of instances \n"
+        "};                                                                \n"
+        "#else                                                             \n"
         "layout(location=0) in vec4 in_Position;                           \n"
-        "layout(location=1) in vec3 in_Normal;                             \n"
         "layout(location=2) in vec4 in_Color;                              \n"
         "layout(location=3) in vec4 in_TexCoord;                           \n"
+        "#endif                                                            \n"
+        "layout(location=1) in vec3 in_Normal;                             \n"
+        "\n"
+        "#if HAS_DRAW_ATTRIBUTE                                            \n"
+        "// Without draw parameters, the base instance of every draw       \n"
+        "// selects its draw data: first slot of its visible instances     \n"
+        "// and texture layer (the attribute advances once per draw)       \n"
+        "layout(location=13) in uvec2 in_DrawData;                         \n"
+        "layout(binding=4) uniform usamplerBuffer u_VisibleInstances;      \n"
+        "uniform uint u_SlotOffset; // region of the visible buffer        \n"
+        "flat out float TextureLayer;                                      \n"
+        "#else                                                             \n"
+        "// Only indices of visible instances are streamed in,              \n"
+        "// their matrices are fetched from a buffer texture.              \n"
+        "layout(location=12) in uint in_InstanceIndex;                     \n"
+        "#endif                                                            \n"
+        "#if HAS_MATRIX_ATTRIBUTES                                         \n"
+        "// Too many instances for a buffer texture, so their matrices     \n"
+        "// are instanced attributes (culling is disabled then)            \n"
+        "layout(location=4) in mat4 in_WorldFromObject;                    \n"
+        "#else                                                             \n"
+        "layout(binding=1) uniform samplerBuffer u_WorldFromObjects;       \n"
+        "#endif                                                            \n"
         "\n"
-        "layout(location=12) in mat4 in_WorldFromObject;                   \n"
+        "// The depth pre-pass and the color pass must agree on every bit  \n"
+        "invariant gl_Position;                                            \n"
         "\n"
         "out vec3 v_Normal;                                                \n"
         "out vec4 v_Color;                                                 \n"
@@ -38,19 +82,65 @@ static const char *GLSL_VERTEX_SHADER =
         "\n"
         "void main()                                                       \n"
         "{                                                                 \n"
-        "       mat4 ClipFromObject = u_ClipFromWorld * in_WorldFromObject;\n"
+        "#if HAS_DRAW_ATTRIBUTE                                            \n"
+        "       uint in_InstanceIndex = texelFetch(u_VisibleInstances, int(u_SlotOffset + in_DrawData.x) + gl_InstanceID).r;\n"
+        "       TextureLayer = float(in_DrawData.y);                       \n"
+        "#endif                                                            \n"
+        "#if HAS_VERTEX_PULLING                                            \n"
+        "       uint v = uint(gl_VertexID);                                \n"
+        "       vec4 in_Position = vec4(positions[3u * v], positions[3u * v + 1u], positions[3u * v + 2u], 1.0);\n"
+        "       vec4 in_Color = unpackUnorm4x8(colors[v]);                 \n"
+        "       vec4 in_TexCoord = uvs[v];                                 \n"
+        "       gl_Position = clip_from_objects[gl_BaseInstanceARB + gl_InstanceID] * in_Position;\n"
+        "#else                                                             \n"
+        "#if HAS_MATRIX_ATTRIBUTES                                         \n"
+        "       mat4 WorldFromObject = in_WorldFromObject;                 \n"
+        "#else                                                             \n"
+        "       int row = 4 * int(in_InstanceIndex);                       \n"
+        "       mat4 WorldFromObject = mat4(                               \n"
+        "               texelFetch(u_WorldFromObjects, row + 0),           \n"
+        "               texelFetch(u_WorldFromObjects, row + 1),           \n"
+        "               texelFetch(u_WorldFromObjects, row + 2),           \n"
+        "               texelFetch(u_WorldFromObjects, row + 3));          \n"
+        "#endif                                                            \n"
+        "       mat4 ClipFromObject = u_ClipFromWorld * WorldFromObject;   \n"
         "       gl_Position = ClipFromObject * in_Position;                \n"
+        "#endif                                                            \n"
         "       v_Normal = normalize(in_Normal);                           \n"
         "       v_Color = in_Color;                                        \n"
         "       v_TexCoord0 = in_TexCoord.xy;                              \n"
         "       v_TexCoord1 = in_TexCoord.zw;                              \n"
         "\n"
         "#if HAS_SHADER_DRAW_PARAMETERS                                    \n"
-        "       DrawID = gl_DrawIDARB;                                     \n"
+        "       DrawID = u_DrawIDOffset + gl_DrawIDARB;                    \n"
+        "       InstanceIndex = in_InstanceIndex;                          \n"
         "#endif                                                            \n"
         "}\n";
 
 
+// Fragment shader of the depth pre-pass (used with GLSL_VERTEX_SHADER), which writes only the depth
+static const char *GLSL_DEPTH_FRAGMENT_SHADER =
+        "void main()                                                       \n"
+        "{                                                                 \n"
+        "}\n";
+
+
+// Fragment shader of the visibility buffer (used with GLSL_VERTEX_SHADER and draw parameters), which keeps
+// the instance and the triangle covering every pixel. GLSL_RESOLVE_FRAGMENT_SHADER shades them later.
+static const char *GLSL_VISIBILITY_FRAGMENT_SHADER =
+        "flat in uint DrawID;                                                                                \n"
+        "flat in uint InstanceIndex;                                                                         \n"
+        "uniform uint u_PrimitiveBits; // low bits of the second ID taken by gl_PrimitiveID                  \n"
+        "\n"
+        "layout (location=1) out uvec2 f_Visibility;                                                         \n"
+        "\n"
+        "void main()                                                                                         \n"
+        "{                                                                                                   \n"
+        "       // Zero is left for pixels, which aren't covered by anything                                 \n"
+        "       f_Visibility = uvec2(InstanceIndex + 1u, (DrawID << u_PrimitiveBits) | uint(gl_PrimitiveID));\n"
+        "}\n";
+
+
 static const char *GLSL_FRAGMENT_SHADER =
         "#if HAS_SHADER_DRAW_PARAMETERS && HAS_BINDLESS_TEXTURE                                 \n"
         "// If the GPU driver supports bindless textures, then we can achive 1 draw call!       \n"
@@ -69,12 +159,18 @@ static const char *GLSL_FRAGMENT_SHADER =
         "};                                                                                     \n"
         "\n"
         "flat in uint DrawID;                                                                   \n"
+        "#elif HAS_DRAW_ATTRIBUTE                                                               \n"
+        "// Without draw parameters, the texture layer comes with the draw data                 \n"
+        "flat in float TextureLayer;                                                            \n"
         "#else                                                                                  \n"
         "// This is the slow path, where we use following uniform                               \n"
         "// to pass the texture index for each instanced draw call.                             \n"
         "uniform float u_TempTextureIdx;                                                        \n"
         "#endif                                                                                 \n"
         "\n"
+        "// Texels of alpha-tested materials below this are discarded (0 for other passes)      \n"
+        "uniform float u_AlphaCutoff;                                                           \n"
+        "\n"
         "in vec3 v_Normal;                                                                      \n"
         "in vec4 v_Color;                                                                       \n"
         "in vec2 v_TexCoord0;                                                                   \n"
@@ -92,10 +188,442 @@ static const char *GLSL_FRAGMENT_SHADER =
         "               // This results in about 31 draw calls :)                               \n"
         "               f_Color = texture(u_Texture0, vec3(v_TexCoord0, indices[DrawID]));      \n"
         "       #endif                                                                          \n"
+        "#elif HAS_DRAW_ATTRIBUTE                                                               \n"
+        "       // This results in about 31 draw calls without draw parameters :)               \n"
+        "       f_Color = texture(u_Texture0, vec3(v_TexCoord0, TextureLayer));                 \n"
         "#else                                                                                  \n"
         "       // This results in 13k draw calls :(                                            \n"
         "       f_Color = texture(u_Texture0, vec3(v_TexCoord0, u_TempTextureIdx));             \n"
         "#endif                                                                                 \n"
+        "       if (f_Color.a < u_AlphaCutoff)                                                  \n"
+        "               discard;                                                                \n"
+        "}\n";
+
+
+static const char *GLSL_CULL_COMPUTE_SHADER =
+        "// GPU culling, pass 1: one work group per instance group (range of instances culled together).\n"
+        "// Visible instances are compacted within the range of their group with a prefix sum.\n"
+        "// With occlusion culling this runs twice per frame: phase 1 draws what was visible in the last\n"
+        "// frame, phase 2 tests everything against the depth pyramid and draws what was missed.\n"
+        "layout(local_size_x = 256) in;                                                  \n"
+        "\n"
+        "#define PHASE_FRUSTUM 0                                                         \n"
+        "#define PHASE_PREVIOUSLY_VISIBLE 1                                              \n"
+        "#define PHASE_OCCLUSION 2                                                       \n"
+        "\n"
+        "layout(std430, binding=0) readonly buffer Bounds {                              \n"
+        "       vec4 bounds[]; // center, radius                                         \n"
+        "};                                                                              \n"
+        "layout(std430, binding=1) readonly buffer Groups {                              \n"
+        "       uvec2 groups[]; // base instance, instance count                         \n"
+        "};                                                                              \n"
+        "layout(std430, binding=2) writeonly buffer VisibleInstances {                   \n"
+        "       uint visible[];                                                          \n"
+        "};                                                                              \n"
+        "layout(std430, binding=3) writeonly buffer GroupCounts {                        \n"
+        "       uint group_visible[];                                                    \n"
+        "};                                                                              \n"
+        "layout(std430, binding=4) buffer Stats {                                        \n"
+        "       uint draw_count;                                                         \n"
+        "       uint visible_instances;                                                  \n"
+        "       uint occluded_instances;                                                 \n"
+        "       uint occluded_triangles;                                                 \n"
+        "};                                                                              \n"
+        "layout(std430, binding=5) buffer LastVisible {                                  \n"
+        "       uint last_visible[]; // 1 if the instance passed the occlusion test in the last frame\n"
+        "};                                                                              \n"
+        "layout(std430, binding=6) readonly buffer GroupTriangles {                      \n"
+        "       uint group_triangles[]; // triangles drawn per instance of the group     \n"
+        "};                                                                              \n"
+        "layout(std430, binding=7) readonly buffer LodRanges {                           \n"
+        "       vec2 lod_ranges[]; // distances from the camera the instance is drawn at (HD or LOD model)\n"
+        "};                                                                              \n"
+        "#if HAS_CLIP_SLOTS                                                              \n"
+        "layout(std430, binding=8) writeonly buffer ClipSlots {                          \n"
+        "       uint clip_slots[]; // visible slots of the phase, listed for the clip matrix pass\n"
+        "};                                                                              \n"
+        "#endif                                                                          \n"
+        "layout(binding=2) uniform sampler2D u_DepthPyramid; // farthest depth, level 0 has the size of the viewport\n"
+        "\n"
+        "uniform vec4 u_Planes[6];                                                       \n"
+        "uniform vec4 u_Camera; // position, max distance                                \n"
+        "uniform mat4 u_ClipFromWorld;                                                   \n"
+        "uniform uint u_Phase;                                                           \n"
+        "uniform uint u_VisibleOffset; // where the region of this phase starts in VisibleInstances\n"
+        "\n"
+        "shared uint scan[256];                                                          \n"
+        "shared uint occluded;                                                           \n"
+        "shared uint list_start; // of this group in the list of all visible instances   \n"
+        "\n"
+        "bool is_visible(vec4 sphere)                                                    \n"
+        "{                                                                               \n"
+        "       for (int p = 0; p < 6; ++p)                                              \n"
+        "               if (dot(u_Planes[p].xyz, sphere.xyz) + u_Planes[p].w <= -sphere.w)\n"
+        "                       return false;                                            \n"
+        "       vec3 d = sphere.xyz - u_Camera.xyz;                                      \n"
+        "       float reach = u_Camera.w + sphere.w;                                     \n"
+        "       return dot(d, d) < reach * reach;                                        \n"
+        "}\n"
+        "\n"
+        "bool is_lod_selected(uint instance)                                             \n"
+        "{                                                                               \n"
+        "       vec2 range = lod_ranges[instance];                                       \n"
+        "       vec3 d = bounds[instance].xyz - u_Camera.xyz;                            \n"
+        "       float distance_sq = dot(d, d);                                           \n"
+        "       return distance_sq >= range.x * range.x && distance_sq < range.y * range.y;\n"
+        "}\n"
+        "\n"
+        "// Project the box around the sphere and compare its nearest depth with the farthest depth\n"
+        "// of the covered pyramid texels (at most 2x2 texels at the chosen level).      \n"
+        "bool is_occluded(vec4 sphere)                                                   \n"
+        "{                                                                               \n"
+        "       vec3 lo = vec3(1.0), hi = vec3(-1.0);                                    \n"
+        "       for (int i = 0; i < 8; ++i) {                                            \n"
+        "               vec3 corner = sphere.xyz + sphere.w * vec3((i & 1) != 0 ? 1.0 : -1.0, (i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);\n"
+        "               vec4 clip = u_ClipFromWorld * vec4(corner, 1.0);                 \n"
+        "               if (clip.w <= 0.0)                                               \n"
+        "                       return false; // Crosses the camera plane                \n"
+        "               vec3 ndc = clip.xyz / clip.w;                                    \n"
+        "               lo = min(lo, ndc);                                               \n"
+        "               hi = max(hi, ndc);                                               \n"
+        "       }                                                                        \n"
+        "       if (lo.z <= -1.0)                                                        \n"
+        "               return false; // Crosses the near plane                          \n"
+        "\n"
+        "       vec2 size = vec2(textureSize(u_DepthPyramid, 0));                        \n"
+        "       vec2 rect_min = clamp(lo.xy * 0.5 + 0.5, 0.0, 1.0) * size;               \n"
+        "       vec2 rect_max = clamp(hi.xy * 0.5 + 0.5, 0.0, 1.0) * size;               \n"
+        "       vec2 extent = rect_max - rect_min;                                       \n"
+        "       int max_level = textureQueryLevels(u_DepthPyramid) - 1;                  \n"
+        "       int level = clamp(int(ceil(log2(max(max(extent.x, extent.y), 1.0)))), 0, max_level);\n"
+        "\n"
+        "       ivec2 last = textureSize(u_DepthPyramid, level) - 1;                     \n"
+        "       ivec2 a = min(ivec2(rect_min) >> level, last);                           \n"
+        "       ivec2 b = min(ivec2(rect_max) >> level, last);                           \n"
+        "       float farthest = max(                                                    \n"
+        "               max(texelFetch(u_DepthPyramid, a, level).r, texelFetch(u_DepthPyramid, ivec2(b.x, a.y), level).r),\n"
+        "               max(texelFetch(u_DepthPyramid, ivec2(a.x, b.y), level).r, texelFetch(u_DepthPyramid, b, level).r));\n"
+        "       return lo.z * 0.5 + 0.5 > farthest;                                      \n"
+        "}\n"
+        "\n"
+        "void main()                                                                     \n"
+        "{                                                                               \n"
+        "       uvec2 group = groups[gl_WorkGroupID.x];                                  \n"
+        "       uint lane = gl_LocalInvocationID.x;                                      \n"
+        "       uint total = 0u;                                                         \n"
+        "       if (0u == lane)                                                          \n"
+        "               occluded = 0u;                                                   \n"
+        "       for (uint chunk = 0u; chunk < group.y; chunk += 256u) {                  \n"
+        "               uint i = chunk + lane;                                           \n"
+        "               bool vis = (i < group.y) && is_visible(bounds[group.x + i]) && is_lod_selected(group.x + i);\n"
+        "               if (PHASE_PREVIOUSLY_VISIBLE == u_Phase) {                       \n"
+        "                       vis = vis && (0u != last_visible[group.x + i]);          \n"
+        "               } else if (PHASE_OCCLUSION == u_Phase && i < group.y) {          \n"
+        "                       // Draw only instances which weren't drawn in phase 1 already\n"
+        "                       bool drawn = vis && (0u != last_visible[group.x + i]);   \n"
+        "                       bool unoccluded = vis && !is_occluded(bounds[group.x + i]);\n"
+        "                       if (vis && !unoccluded)                                  \n"
+        "                               atomicAdd(occluded, 1u);                         \n"
+        "                       last_visible[group.x + i] = unoccluded ? 1u : 0u;        \n"
+        "                       vis = unoccluded && !drawn;                              \n"
+        "               }                                                                \n"
+        "               scan[lane] = vis ? 1u : 0u;                                      \n"
+        "               barrier();                                                       \n"
+        "\n"
+        "               // Inclusive Hillis-Steele scan                                  \n"
+        "               for (uint offset = 1u; offset < 256u; offset <<= 1) {            \n"
+        "                       uint prev = (lane >= offset) ? scan[lane - offset] : 0u; \n"
+        "                       barrier();                                               \n"
+        "                       scan[lane] += prev;                                      \n"
+        "                       barrier();                                               \n"
+        "               }                                                                \n"
+        "\n"
+        "               if (vis)                                                         \n"
+        "                       visible[u_VisibleOffset + group.x + total + scan[lane] - 1u] = group.x + i;\n"
+        "               total += scan[255];                                              \n"
+        "               barrier();                                                       \n"
+        "       }                                                                        \n"
+        "\n"
+        "       if (0u == lane) {                                                        \n"
+        "               group_visible[gl_WorkGroupID.x] = total;                         \n"
+        "               list_start = atomicAdd(visible_instances, total);                \n"
+        "               if (0u < occluded) {                                             \n"
+        "                       atomicAdd(occluded_instances, occluded);                 \n"
+        "                       atomicAdd(occluded_triangles, occluded * group_triangles[gl_WorkGroupID.x]);\n"
+        "               }                                                                \n"
+        "       }                                                                        \n"
+        "#if HAS_CLIP_SLOTS                                                              \n"
+        "       barrier();                                                               \n"
+        "       for (uint j = lane; j < total; j += 256u)                                \n"
+        "               clip_slots[u_VisibleOffset + list_start + j] = u_VisibleOffset + group.x + j;\n"
+        "#endif                                                                          \n"
+        "}\n";
+
+
+static const char *GLSL_EMIT_COMPUTE_SHADER =
+        "// GPU culling, pass 2: one invocation per draw call.                           \n"
+        "// Writes commands with patched instance counts in the original order (for batched MDI)\n"
+        "// and appends non-empty ones to a compacted list consumed by glMultiDrawElementsIndirectCountARB.\n"
+        "layout(local_size_x = 64) in;                                                   \n"
+        "\n"
+        "struct Command {                                                                \n"
+        "       uint count;                                                              \n"
+        "       uint instance_count;                                                     \n"
+        "       uint first_index;                                                        \n"
+        "       uint base_vertex;                                                        \n"
+        "       uint base_instance;                                                      \n"
+        "};                                                                              \n"
+        "\n"
+        "layout(std430, binding=0) readonly buffer Templates {                           \n"
+        "       Command templates[]; // instance_count holds index of the instance group \n"
+        "};                                                                              \n"
+        "layout(std430, binding=1) readonly buffer GroupCounts {                         \n"
+        "       uint group_visible[];                                                    \n"
+        "};                                                                              \n"
+        "layout(std430, binding=2) writeonly buffer Commands {                           \n"
+        "       Command commands[];                                                      \n"
+        "};                                                                              \n"
+        "layout(std430, binding=3) buffer CompactCommands {                              \n"
+        "       uint draw_count;                                                         \n"
+        "       uint visible_instances;                                                  \n"
+        "       uint occluded_instances;                                                 \n"
+        "       uint occluded_triangles;                                                 \n"
+        "       uvec4 clip_dispatch; // indirect dispatch of the clip matrix pass (x, y, z)\n"
+        "       Command compact_commands[];                                              \n"
+        "};                                                                              \n"
+        "layout(std430, binding=4) readonly buffer TextureIndices {                      \n"
+        "       int indices[];                                                           \n"
+        "};                                                                              \n"
+        "layout(std430, binding=5) writeonly buffer CompactTextureIndices {              \n"
+        "       int compact_indices[];                                                   \n"
+        "};                                                                              \n"
+        "#if HAS_BINDLESS_TEXTURE                                                        \n"
+        "layout(std430, binding=6) readonly buffer TextureHandles {                      \n"
+        "       uvec2 handles[];                                                         \n"
+        "};                                                                              \n"
+        "layout(std430, binding=7) writeonly buffer CompactTextureHandles {              \n"
+        "       uvec2 compact_handles[];                                                 \n"
+        "};                                                                              \n"
+        "#endif                                                                          \n"
+        "\n"
+        "uniform uint u_NumCommands;                                                     \n"
+        "uniform uint u_CommandOffset; // where the region of this phase starts in Commands\n"
+        "uniform uint u_InstanceOffset; // the same for VisibleInstances of the cull pass\n"
+        "uniform uint u_NumCompacted; // only opaque commands (first in the order) are compacted\n"
+        "\n"
+        "void main()                                                                     \n"
+        "{                                                                               \n"
+        "       uint i = gl_GlobalInvocationID.x;                                        \n"
+        "       if (0u == i) // the cull pass is done with the counter already           \n"
+        "               clip_dispatch = uvec4((visible_instances + 63u) / 64u, 1u, 1u, 0u);\n"
+        "       if (i >= u_NumCommands)                                                  \n"
+        "               return;                                                          \n"
+        "\n"
+        "       Command cmd = templates[i];                                              \n"
+        "       cmd.instance_count = group_visible[cmd.instance_count];                  \n"
+        "       cmd.base_instance += u_InstanceOffset;                                   \n"
+        "       commands[u_CommandOffset + i] = cmd;                                     \n"
+        "       if (0u < cmd.instance_count && i < u_NumCompacted) {                     \n"
+        "               uint slot = atomicAdd(draw_count, 1u);                           \n"
+        "               compact_commands[slot] = cmd;                                    \n"
+        "               compact_indices[slot] = indices[i];                              \n"
+        "#if HAS_BINDLESS_TEXTURE                                                        \n"
+        "               compact_handles[slot] = handles[i];                              \n"
+        "#endif                                                                          \n"
+        "       }                                                                        \n"
+        "}\n";
+
+
+static const char *GLSL_DEPTH_PYRAMID_SHADER =
+        "// Depth pyramid for occlusion culling: every texel keeps the farthest depth of its footprint.\n"
+        "// Level 0 is a copy of the depth buffer, odd-sized levels fold the extra row/column into the last texel.\n"
+        "layout(local_size_x = 8, local_size_y = 8) in;                                  \n"
+        "\n"
+        "layout(binding=2) uniform sampler2D u_Source; // depth buffer or the previous level\n"
+        "layout(r32f, binding=0) writeonly uniform image2D u_Destination;                \n"
+        "uniform int u_SourceLevel;                                                      \n"
+        "uniform int u_Scale; // 1 copies the depth buffer, 2 reduces the previous level \n"
+        "\n"
+        "void main()                                                                     \n"
+        "{                                                                               \n"
+        "       ivec2 dst = ivec2(gl_GlobalInvocationID.xy);                             \n"
+        "       ivec2 size = imageSize(u_Destination);                                   \n"
+        "       if (any(greaterThanEqual(dst, size)))                                    \n"
+        "               return;                                                          \n"
+        "\n"
+        "       ivec2 last = textureSize(u_Source, u_SourceLevel) - 1;                   \n"
+        "       ivec2 begin = min(dst * u_Scale, last);                                  \n"
+        "       ivec2 end = min(begin + u_Scale - 1, last);                              \n"
+        "       if (dst.x == size.x - 1)                                                 \n"
+        "               end.x = last.x;                                                  \n"
+        "       if (dst.y == size.y - 1)                                                 \n"
+        "               end.y = last.y;                                                  \n"
+        "\n"
+        "       float depth = 0.0;                                                       \n"
+        "       for (int y = begin.y; y <= end.y; ++y)                                   \n"
+        "               for (int x = begin.x; x <= end.x; ++x)                           \n"
+        "                       depth = max(depth, texelFetch(u_Source, ivec2(x, y), u_SourceLevel).r);\n"
+        "       imageStore(u_Destination, dst, vec4(depth));                             \n"
+        "}\n";
+
+
+static const char *GLSL_CLIP_MATRICES_COMPUTE_SHADER =
+        "// Vertex pulling: ClipFromObject of every visible instance slot, computed once per frame, so vertex\n"
+        "// shaders don't multiply matrices. Slots of visible instances are listed by culling, so culled ones\n"
+        "// aren't computed (the list is counted by GPU culling and the pass is dispatched indirectly then).\n"
+        "layout(local_size_x = 64) in;                                                   \n"
+        "\n"
+        "layout(std430, binding=0) readonly buffer VisibleInstances {                    \n"
+        "       uint visible[];                                                          \n"
+        "};                                                                              \n"
+        "layout(std430, binding=1) writeonly buffer ClipFromObjects {                    \n"
+        "       mat4 clip_from_objects[];                                                \n"
+        "};                                                                              \n"
+        "layout(std430, binding=2) readonly buffer VisibleSlots {                        \n"
+        "       uint slots[]; // slots of visible instances in VisibleInstances          \n"
+        "};                                                                              \n"
+        "#if HAS_SLOT_COUNT                                                              \n"
+        "layout(std430, binding=3) readonly buffer CullHeader {                          \n"
+        "       uint draw_count;                                                         \n"
+        "       uint num_slots;                                                          \n"
+        "};                                                                              \n"
+        "#else                                                                           \n"
+        "uniform uint u_NumSlots;                                                        \n"
+        "#define num_slots u_NumSlots                                                    \n"
+        "#endif                                                                          \n"
+        "\n"
+        "layout(binding=1) uniform samplerBuffer u_WorldFromObjects;                     \n"
+        "uniform mat4 u_ClipFromWorld;                                                   \n"
+        "uniform uint u_SlotOffset; // where the list of this region starts              \n"
+        "\n"
+        "void main()                                                                     \n"
+        "{                                                                               \n"
+        "       uint i = gl_GlobalInvocationID.x;                                        \n"
+        "       if (i >= num_slots)                                                      \n"
+        "               return;                                                          \n"
+        "       uint slot = slots[u_SlotOffset + i];                                     \n"
+        "       int row = 4 * int(visible[slot]);                                        \n"
+        "       mat4 WorldFromObject = mat4(                                             \n"
+        "               texelFetch(u_WorldFromObjects, row + 0),                         \n"
+        "               texelFetch(u_WorldFromObjects, row + 1),                         \n"
+        "               texelFetch(u_WorldFromObjects, row + 2),                         \n"
+        "               texelFetch(u_WorldFromObjects, row + 3));                        \n"
+        "       clip_from_objects[slot] = u_ClipFromWorld * WorldFromObject;             \n"
+        "}\n";
+
+// Vertex shader of full-screen passes: a single triangle covering the viewport (drawn with 3 vertices)
+static const char *GLSL_FULLSCREEN_VERTEX_SHADER =
+        "void main()                                                                                 \n"
+        "{                                                                                           \n"
+        "       vec2 position = vec2(float((gl_VertexID & 1) << 2), float((gl_VertexID & 2) << 1)) - 1.0;\n"
+        "       gl_Position = vec4(position, 0.0, 1.0);                                              \n"
+        "}\n";
+
+
+static const char *GLSL_RESOLVE_FRAGMENT_SHADER =
+        "// Resolve of the visibility buffer: every covered pixel fetches vertices of its triangle from the baked      \n"
+        "// buffers, interpolates texture coordinates and samples the texture once (no overdraw is shaded).            \n"
+        "// Without bindless textures, this runs once per texture array and skips pixels of the other arrays.          \n"
+        "#if HAS_BINDLESS_TEXTURE                                                                                      \n"
+        "#extension GL_ARB_bindless_texture : require                                                                  \n"
+        "\n"
+        "layout(std430, binding=4) readonly buffer TextureHandles {                                                    \n"
+        "       sampler2DArray textures[];                                                                             \n"
+        "};                                                                                                            \n"
+        "#else                                                                                                         \n"
+        "layout(binding=0) uniform sampler2DArray u_Texture0;                                                          \n"
+        "uniform uint u_TextureArray;                                                                                  \n"
+        "#endif                                                                                                        \n"
+        "\n"
+        "layout(std430, binding=0) readonly buffer Indices {                                                           \n"
+        "       uint indices[]; // pairs of 16-bit strip indices                                                       \n"
+        "};                                                                                                            \n"
+        "layout(std430, binding=1) readonly buffer Positions {                                                         \n"
+        "       float positions[]; // tightly packed vec3                                                              \n"
+        "};                                                                                                            \n"
+        "layout(std430, binding=2) readonly buffer TexCoords {                                                         \n"
+        "       vec4 uvs[];                                                                                            \n"
+        "};                                                                                                            \n"
+        "layout(std430, binding=3) readonly buffer TextureIndices {                                                    \n"
+        "       int layers[];                                                                                          \n"
+        "};                                                                                                            \n"
+        "layout(std430, binding=5) readonly buffer DrawCalls {                                                         \n"
+        "       uvec4 draws[]; // first index, base vertex and texture array                                           \n"
+        "};                                                                                                            \n"
+        "\n"
+        "layout(binding=1) uniform samplerBuffer u_WorldFromObjects;                                                   \n"
+        "layout(binding=3) uniform usampler2D u_Visibility;                                                            \n"
+        "uniform mat4 u_ClipFromWorld;                                                                                 \n"
+        "uniform uint u_PrimitiveBits;                                                                                 \n"
+        "\n"
+        "layout (location=0) out vec4 f_Color;                                                                         \n"
+        "\n"
+        "uint fetch_index(uint i)                                                                                      \n"
+        "{                                                                                                             \n"
+        "       return (indices[i >> 1] >> ((i & 1u) << 4)) & 0xFFFFu;                                                 \n"
+        "}\n"
+        "\n"
+        "vec4 fetch_position(uint v)                                                                                   \n"
+        "{                                                                                                             \n"
+        "       return vec4(positions[3u * v], positions[3u * v + 1u], positions[3u * v + 2u], 1.0);                   \n"
+        "}\n"
+        "\n"
+        "// Perspective-correct barycentrics of a point (in normalized device coordinates) within a triangle           \n"
+        "vec3 get_barycentrics(vec4 c0, vec4 c1, vec4 c2, vec2 p)                                                      \n"
+        "{                                                                                                             \n"
+        "       vec3 inv_w = 1.0 / vec3(c0.w, c1.w, c2.w);                                                             \n"
+        "       vec2 e0 = c0.xy * inv_w.x;                                                                             \n"
+        "       vec2 e1 = c1.xy * inv_w.y - e0;                                                                        \n"
+        "       vec2 e2 = c2.xy * inv_w.z - e0;                                                                        \n"
+        "       vec2 d = p - e0;                                                                                       \n"
+        "       float area = e1.x * e2.y - e2.x * e1.y;                                                                \n"
+        "       float b1 = (d.x * e2.y - e2.x * d.y) / area;                                                           \n"
+        "       float b2 = (e1.x * d.y - d.x * e1.y) / area;                                                           \n"
+        "       vec3 b = vec3(1.0 - b1 - b2, b1, b2) * inv_w;                                                          \n"
+        "       return b / (b.x + b.y + b.z);                                                                          \n"
+        "}\n"
+        "\n"
+        "void main()                                                                                                   \n"
+        "{                                                                                                             \n"
+        "       uvec2 id = texelFetch(u_Visibility, ivec2(gl_FragCoord.xy), 0).xy;                                     \n"
+        "       if (0u == id.x)                                                                                        \n"
+        "               discard;                                                                                       \n"
+        "       uint draw = id.y >> u_PrimitiveBits;                                                                   \n"
+        "       uint primitive = id.y & ((1u << u_PrimitiveBits) - 1u);                                                \n"
+        "       uvec4 dc = draws[draw];                                                                                \n"
+        "#if !HAS_BINDLESS_TEXTURE                                                                                     \n"
+        "       if (dc.z != u_TextureArray)                                                                            \n"
+        "               discard;                                                                                       \n"
+        "#endif                                                                                                        \n"
+        "\n"
+        "       // Triangle `primitive` of the strip (its winding doesn't matter here)                                 \n"
+        "       uint first = dc.x + primitive;                                                                         \n"
+        "       uint v0 = fetch_index(first) + dc.y;                                                                   \n"
+        "       uint v1 = fetch_index(first + 1u) + dc.y;                                                              \n"
+        "       uint v2 = fetch_index(first + 2u) + dc.y;                                                              \n"
+        "       int row = 4 * int(id.x - 1u);                                                                          \n"
+        "       mat4 WorldFromObject = mat4(                                                                           \n"
+        "               texelFetch(u_WorldFromObjects, row + 0),                                                       \n"
+        "               texelFetch(u_WorldFromObjects, row + 1),                                                       \n"
+        "               texelFetch(u_WorldFromObjects, row + 2),                                                       \n"
+        "               texelFetch(u_WorldFromObjects, row + 3));                                                      \n"
+        "       mat4 ClipFromObject = u_ClipFromWorld * WorldFromObject;                                               \n"
+        "       vec4 c0 = ClipFromObject * fetch_position(v0);                                                         \n"
+        "       vec4 c1 = ClipFromObject * fetch_position(v1);                                                         \n"
+        "       vec4 c2 = ClipFromObject * fetch_position(v2);                                                         \n"
+        "\n"
+        "       // Barycentrics of the neighbouring pixels give derivatives for the mipmap selection                   \n"
+        "       vec2 pixel = 2.0 / vec2(textureSize(u_Visibility, 0));                                                 \n"
+        "       vec2 p = gl_FragCoord.xy * pixel - 1.0;                                                                \n"
+        "       mat3x2 uv = mat3x2(uvs[v0].xy, uvs[v1].xy, uvs[v2].xy);                                                \n"
+        "       vec2 uv0 = uv * get_barycentrics(c0, c1, c2, p);                                                       \n"
+        "       vec2 uv_dx = uv * get_barycentrics(c0, c1, c2, p + vec2(pixel.x, 0.0)) - uv0;                          \n"
+        "       vec2 uv_dy = uv * get_barycentrics(c0, c1, c2, p + vec2(0.0, pixel.y)) - uv0;                          \n"
+        "#if HAS_BINDLESS_TEXTURE                                                                                      \n"
+        "       f_Color = textureGrad(textures[draw], vec3(uv0, layers[draw]), uv_dx, uv_dy);                          \n"
+        "#else                                                                                                         \n"
+        "       f_Color = textureGrad(u_Texture0, vec3(uv0, layers[draw]), uv_dx, uv_dy);                              \n"
+        "#endif                                                                                                        \n"
         "}\n";
 
 
@@ -0,0 +1,55 @@
+/*
+ * Quadric error mesh simplification for generating LOD levels of baked meshes.
+ *
+ * Edges are collapsed onto one of their vertices, so simplified triangles keep
+ * indexing the original vertex buffer and no vertex attributes are interpolated.
+ * Like culling.h, this module doesn't depend on OpenGL.
+ */
+#ifndef _SIMPLIFY_INCLUDED
+#define _SIMPLIFY_INCLUDED
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+
+//! Simplified triangles of a material split at a single LOD level (as stored in "meshlods.blob").
+struct MeshLod {
+	uint32_t first_index; //!< Into the index buffer of LODs (3 indices per triangle)
+	uint32_t num_triangles;
+	uint32_t split; //!< Material split of the mesh
+	uint32_t level; //!< 1 for the first simplified level (0 is the original mesh in "meshes.blob")
+	float error; //!< Estimated deviation from the original surface of the whole level (object space)
+};
+
+//! LOD levels of a single mesh (all splits of a level are stored next to each other).
+struct MeshLodRange {
+	uint32_t id; //!< Item definition ID
+	uint32_t first_lod;
+	uint32_t num_lods;
+};
+
+//! Vertex data of a mesh to simplify.
+struct SimplifyMesh {
+	const glm::vec3 *positions;
+	const glm::u8vec4 *colors;
+	const glm::vec4 *uvs; //!< Two sets of texture coordinates
+	uint32_t num_vertices;
+	float attribute_scale; //!< Distance, which is as bad as a UV or color difference of 1
+};
+
+//! Collapse edges of counter-clockwise triangles (3 indices into vertices of `mesh` each) until
+//! no more than `target_triangles` are left, or the next collapse would exceed `max_error`.
+//! Border vertices and UV / color seams (vertices sharing their position) never move.
+//! @returns Largest error of performed collapses (distance in object space).
+float simplify_triangles(const SimplifyMesh &mesh, std::vector<uint32_t> &triangles, uint32_t target_triangles, float max_error);
+
+//! Distance from the camera, beyond which the error of a level covers less than `max_pixels`.
+static inline
+float get_lod_switch_distance(float error, float max_pixels, float viewport_height, float fovy)
+{
+	return error * viewport_height / (2.0f * tanf(0.5f * fovy) * max_pixels);
+}
+
+
+#endif
@@ -0,0 +1,40 @@
+/*
+ * Parallel LSD radix sort of 32-bit keys (with 32-bit values) on the job pool.
+ *
+ * The renderer sorts depths of visible translucent instances every frame, so the
+ * sort has to stay well below a millisecond for tens of thousands of them.
+ * Like culling.h, this module doesn't depend on OpenGL.
+ */
+#ifndef _SORT_INCLUDED
+#define _SORT_INCLUDED
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+
+static const uint32_t RADIX_SORT_BITS = 8; //!< Digit sorted by a single pass (4 passes for 32-bit keys)
+static const uint32_t RADIX_SORT_BUCKETS = 1 << RADIX_SORT_BITS;
+static const uint32_t RADIX_SORT_CHUNK = 8192; //!< Keys histogrammed and scattered by a single job
+static const uint32_t RADIX_SORT_MIN_PARALLEL = 4 * RADIX_SORT_CHUNK; //!< Smaller arrays are sorted on the calling thread
+
+//! Buffers reused by radix_sort() between calls, so sorting every frame doesn't allocate.
+struct RadixSortScratch {
+	std::vector<uint32_t> keys, values;
+	std::vector<uint32_t> offsets; //!< Per chunk and bucket
+};
+
+//! Map a float to an unsigned integer with the same ordering (including negative numbers).
+static inline
+uint32_t float_to_sortable(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+//! Stable sort of `values` by ascending `keys` (both are sorted in place).
+//! Large arrays are histogrammed and scattered on the workers, so it must not be called from a job.
+void radix_sort(uint32_t *keys, uint32_t *values, uint32_t count, RadixSortScratch &scratch);
+
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Persistently mapped ring buffers for data written by the CPU every frame.
+ *
+ * Every stream buffer is split into STREAM_FRAMES regions and each frame sub-allocates from its own
+ * one. The region is fenced once the frame's draws are submitted, so the CPU waits only if the GPU
+ * is still reading it from STREAM_FRAMES frames ago (which is counted as a stall). Unlike updates
+ * with glBufferSubData() or orphaning with glBufferData(), writes never synchronize with the driver.
+ * Without GL_ARB_buffer_storage, allocations go to a staging copy uploaded by stream_flush().
+ */
+#ifndef _STREAM_INCLUDED
+#define _STREAM_INCLUDED
+#include <stdint.h>
+#include <vector>
+#include <GL/glew.h>
+
+
+static const uint32_t STREAM_FRAMES = 3; //!< Regions of every stream buffer (frames in flight)
+
+//! Counters of a stream buffer since it was created.
+struct StreamStats {
+	uint32_t frames;
+	uint32_t stalls; //!< Frames, which had to wait until the GPU released their region
+	double stall_ms; //!< Total time spent waiting
+	GLsizeiptr peak_bytes; //!< Most bytes allocated by a single frame
+	uint32_t overflows; //!< Allocations, which didn't fit into the rest of their region
+};
+
+struct StreamBuffer {
+	GLuint buffer;
+	uint8_t *mapped; //!< The whole buffer (NULL without GL_ARB_buffer_storage)
+	std::vector<uint8_t> staging; //!< Allocations of the current region, if the buffer isn't mapped
+	GLsizeiptr region_size;
+	GLsizeiptr alignment; //!< Of every allocation
+	GLsizeiptr used; //!< Bytes allocated from the current region
+	uint32_t region; //!< Region of the current frame
+	GLsync fences[STREAM_FRAMES];
+	StreamStats stats;
+};
+
+//! Create buffer of STREAM_FRAMES regions (mapped for the whole lifetime, if `persistent` is set).
+//! @param alignment Of every allocation (e.g. GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT to bind them as SSBO ranges)
+//! @returns False, if the buffer can't be mapped
+bool create_stream_buffer(StreamBuffer &stream, GLsizeiptr region_size, GLsizeiptr alignment, bool persistent);
+void destroy_stream_buffer(StreamBuffer &stream);
+
+//! Move to the next region (waiting until the GPU is done with it) and allocate from its beginning.
+void begin_stream_frame(StreamBuffer &stream);
+
+//! Allocate write-only memory in the region of the current frame.
+//! @param offset Receives offset of the allocation in `buffer` (to bind it, or as indirect offset)
+//! @returns NULL, if the region is full
+void *stream_alloc(StreamBuffer &stream, GLsizeiptr size, GLintptr *offset);
+
+//! Upload allocations of the current frame, which have to be visible to the following draws
+//! (does nothing with persistent mapping, where the writes are coherent).
+void stream_flush(StreamBuffer &stream);
+
+//! Fence the region of the current frame after the last command reading it.
+void end_stream_frame(StreamBuffer &stream);
+
+
+#endif
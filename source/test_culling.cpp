@@ -0,0 +1,78 @@
+#include "tests.h"
+#include "culling.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+
+//! Spheres (center, radius) around a camera at the origin looking down -Z, with the expected visibility.
+static const struct {
+	glm::vec4 sphere;
+	bool visible;
+} KNOWN_SPHERES[] = {
+	{ glm::vec4(0.0f, 0.0f, -10.0f, 1.0f), true },
+	{ glm::vec4(10.0f, 10.0f, -20.0f, 1.0f), true },
+	{ glm::vec4(0.0f, 0.0f, -45.0f, 1.0f), true },
+	{ glm::vec4(0.0f, 0.0f, -55.0f, 6.0f), true }, // the radius reaches within the distance
+	{ glm::vec4(-11.0f, 0.0f, -10.0f, 2.0f), true }, // crosses the left plane
+	{ glm::vec4(0.0f, 0.0f, -0.5f, 1.0f), true }, // crosses the near plane
+	{ glm::vec4(0.0f, 0.0f, 10.0f, 1.0f), false }, // behind the camera
+	{ glm::vec4(-30.0f, 0.0f, -10.0f, 1.0f), false },
+	{ glm::vec4(30.0f, 0.0f, -10.0f, 1.0f), false },
+	{ glm::vec4(0.0f, -30.0f, -10.0f, 1.0f), false },
+	{ glm::vec4(0.0f, 30.0f, -10.0f, 1.0f), false },
+	{ glm::vec4(25.0f, 0.0f, -20.0f, 1.0f), false },
+	{ glm::vec4(0.0f, 0.0f, -200.0f, 1.0f), false }, // beyond the far plane
+	{ glm::vec4(0.0f, 0.0f, -60.0f, 1.0f), false }, // within the far plane, but too far away
+};
+static const uint32_t NUM_KNOWN_SPHERES = sizeof(KNOWN_SPHERES) / sizeof(KNOWN_SPHERES[0]);
+static const float KNOWN_MAX_DISTANCE = 50.0f;
+
+
+//! SIMD and scalar kernels have to agree with each other and with the expected visibility,
+//! for ranges starting at every lane and ending anywhere within the last batch.
+int test_culling()
+{
+	int failures = 0;
+
+	// Repeated, so the ranges are longer than a few batches even with AVX
+	const uint32_t REPEATS = 3;
+	std::vector<glm::vec4> data;
+	for (uint32_t r = 0; r < REPEATS; ++r)
+		for (uint32_t i = 0; i < NUM_KNOWN_SPHERES; ++i)
+			data.push_back(KNOWN_SPHERES[i].sphere);
+	BoundingSpheres spheres;
+	assign_bounding_spheres(spheres, data.data(), data.size());
+
+	const glm::mat4 clip_from_world = glm::perspective(glm::radians(90.0f), 1.0f, 1.0f, 100.0f);
+	const CullingFrustum frustum = make_culling_frustum(clip_from_world, glm::vec3(0.0f), KNOWN_MAX_DISTANCE);
+
+	std::vector<uint32_t> simd(data.size()), scalar(data.size());
+	for (uint32_t first = 0; first <= CULLING_LANES; ++first) {
+		for (uint32_t count = 0; first + count <= data.size(); count += (count < 2 * CULLING_LANES) ? 1 : 5) {
+			const uint32_t num_simd = cull_spheres(frustum, spheres, first, count, simd.data());
+			const uint32_t num_scalar = cull_spheres_scalar(frustum, spheres, first, count, scalar.data());
+			TEST_CHECK(num_simd == num_scalar);
+			if (num_simd != num_scalar)
+				continue;
+			for (uint32_t i = 0; i < num_simd; ++i)
+				TEST_CHECK(simd[i] == scalar[i]);
+
+			uint32_t expected = 0;
+			for (uint32_t i = first; i < first + count; ++i)
+				expected += KNOWN_SPHERES[i % NUM_KNOWN_SPHERES].visible ? 1 : 0;
+			TEST_CHECK(num_simd == expected);
+			for (uint32_t i = 0; i < num_simd; ++i)
+				TEST_CHECK(KNOWN_SPHERES[simd[i] % NUM_KNOWN_SPHERES].visible);
+		}
+	}
+
+	for (uint32_t i = 0; i < NUM_KNOWN_SPHERES; ++i)
+		TEST_CHECK(is_sphere_visible(frustum, KNOWN_SPHERES[i].sphere) == KNOWN_SPHERES[i].visible);
+
+	// Without distance culling only the far plane limits the range
+	const CullingFrustum unlimited = make_culling_frustum(clip_from_world, glm::vec3(0.0f), CULL_DISTANCE_UNLIMITED);
+	const uint32_t num_simd = cull_spheres(unlimited, spheres, 0, NUM_KNOWN_SPHERES, simd.data());
+	const uint32_t num_scalar = cull_spheres_scalar(unlimited, spheres, 0, NUM_KNOWN_SPHERES, scalar.data());
+	TEST_CHECK(num_simd == num_scalar);
+	TEST_CHECK(num_simd > 0 && NUM_KNOWN_SPHERES - 1 == simd[num_simd - 1]);
+	return failures;
+}
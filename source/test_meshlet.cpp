@@ -0,0 +1,86 @@
+#include "tests.h"
+#include "meshlet.h"
+#include <math.h>
+
+
+//! Tessellate a sphere with counter-clockwise triangles facing outside (in rows around the Z axis).
+static
+void tessellate_sphere(float radius, uint32_t slices, uint32_t stacks, std::vector<glm::vec3> &positions, std::vector<uint32_t> &triangles)
+{
+	const float PI = 3.14159265358979f;
+	for (uint32_t stack = 0; stack <= stacks; ++stack) {
+		const float theta = PI * stack / stacks;
+		for (uint32_t slice = 0; slice <= slices; ++slice) {
+			const float phi = 2.0f * PI * slice / slices;
+			positions.push_back(radius * glm::vec3(sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta)));
+		}
+	}
+	for (uint32_t stack = 0; stack < stacks; ++stack) {
+		for (uint32_t slice = 0; slice < slices; ++slice) {
+			const uint32_t a = stack * (slices + 1) + slice, b = a + 1, c = a + slices + 1, d = c + 1;
+			// Triangles touching the poles would be degenerate
+			if (0 != stack) {
+				const uint32_t triangle[] = { a, c, b };
+				triangles.insert(triangles.end(), triangle, triangle + 3);
+			}
+			if (stacks - 1 != stack) {
+				const uint32_t triangle[] = { b, c, d };
+				triangles.insert(triangles.end(), triangle, triangle + 3);
+			}
+		}
+	}
+}
+
+
+//! Split a finely tessellated sphere into meshlets and view it from all around. A meshlet may be rejected
+//! only if all of its triangles face away from the camera, but some of them have to be rejected.
+int test_meshlet()
+{
+	int failures = 0;
+
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> triangles;
+	tessellate_sphere(10.0f, 128, 64, positions, triangles);
+	const uint32_t num_triangles = triangles.size() / 3;
+
+	std::vector<Meshlet> meshlets;
+	std::vector<uint32_t> indices;
+	build_meshlets(positions.data(), triangles.data(), num_triangles, 0, meshlets, indices);
+	TEST_CHECK(triangles == indices);
+	uint32_t covered = 0;
+	for (const Meshlet &meshlet : meshlets) {
+		TEST_CHECK(meshlet.num_triangles <= MESHLET_MAX_TRIANGLES);
+		TEST_CHECK(meshlet.num_vertices <= MESHLET_MAX_VERTICES);
+		TEST_CHECK(3 * covered == meshlet.first_index);
+		covered += meshlet.num_triangles;
+	}
+	TEST_CHECK(num_triangles == covered);
+
+	const float DISTANCES[] = { 10.5f, 15.0f, 40.0f, 1000.0f };
+	uint32_t num_tested = 0, num_rejected = 0;
+	for (float distance : DISTANCES) {
+		for (int dx = -1; dx <= 1; ++dx) {
+			for (int dy = -1; dy <= 1; ++dy) {
+				for (int dz = -1; dz <= 1; ++dz) {
+					if (0 == dx && 0 == dy && 0 == dz)
+						continue;
+					const glm::vec3 camera = distance * glm::normalize(glm::vec3(dx, dy, dz));
+					for (const Meshlet &meshlet : meshlets) {
+						++num_tested;
+						if (!is_meshlet_backfacing(meshlet, camera))
+							continue;
+						++num_rejected;
+						for (uint32_t t = 0; t < meshlet.num_triangles; ++t) {
+							const uint32_t *triangle = &indices[meshlet.first_index + 3 * t];
+							const glm::vec3 &a = positions[triangle[0]], &b = positions[triangle[1]], &c = positions[triangle[2]];
+							TEST_CHECK(glm::dot(glm::normalize(glm::cross(b - a, c - a)), glm::normalize(camera - a)) <= 1.0e-4f);
+						}
+					}
+				}
+			}
+		}
+	}
+	fprintf(stderr, "INFO: %u of %u meshlets of a sphere were back-facing\n", num_rejected, num_tested);
+	TEST_CHECK(0 < num_rejected && num_rejected < num_tested);
+	return failures;
+}
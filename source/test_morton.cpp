@@ -0,0 +1,42 @@
+#include "tests.h"
+#include "morton.h"
+#include <vector>
+#include <algorithm>
+
+
+//! Codes of known positions interleave quantized coordinates, and sorting a grid by them visits
+//! every octant (and every octant of an octant) in one contiguous run.
+int test_morton()
+{
+	int failures = 0;
+
+	// Coordinates within [0, 1023] are quantized to themselves
+	const glm::vec3 lo(0.0f), hi(1023.0f);
+	TEST_CHECK(0u == morton_code(lo, lo, hi));
+	TEST_CHECK(0x3FFFFFFFu == morton_code(hi, lo, hi));
+	TEST_CHECK(4u == morton_code(glm::vec3(1.0f, 0.0f, 0.0f), lo, hi));
+	TEST_CHECK(2u == morton_code(glm::vec3(0.0f, 1.0f, 0.0f), lo, hi));
+	TEST_CHECK(1u == morton_code(glm::vec3(0.0f, 0.0f, 1.0f), lo, hi));
+	TEST_CHECK(0x24924924u == morton_code(glm::vec3(1023.0f, 0.0f, 0.0f), lo, hi));
+	TEST_CHECK(0x32u == morton_code(glm::vec3(2.0f, 3.0f, 0.0f), lo, hi)); // 010 and 011 interleaved to 011 010
+	TEST_CHECK(morton_code(glm::vec3(-5.0f, 2000.0f, 0.5f), lo, hi) == morton_code(glm::vec3(0.0f, 1023.0f, 0.0f), lo, hi));
+	TEST_CHECK(0u == morton_code(glm::vec3(7.0f), glm::vec3(7.0f), glm::vec3(7.0f))); // empty box
+
+	// Grid of 8x8x8 cells
+	const uint32_t SIZE = 8;
+	std::vector<glm::uvec3> cells;
+	for (uint32_t x = 0; x < SIZE; ++x)
+		for (uint32_t y = 0; y < SIZE; ++y)
+			for (uint32_t z = 0; z < SIZE; ++z)
+				cells.push_back(glm::uvec3(x, y, z));
+	const glm::vec3 grid_hi((float)SIZE);
+	std::stable_sort(cells.begin(), cells.end(), [&](const glm::uvec3 &a, const glm::uvec3 &b) {
+		return morton_code(glm::vec3(a) + 0.5f, lo, grid_hi) < morton_code(glm::vec3(b) + 0.5f, lo, grid_hi);
+	});
+	for (uint32_t octant_size = 2; octant_size <= SIZE; octant_size *= 2) {
+		const uint32_t run = octant_size * octant_size * octant_size;
+		for (size_t i = 0; i < cells.size(); ++i)
+			TEST_CHECK(cells[i] / octant_size == cells[i - i % run] / octant_size);
+	}
+	return failures;
+}
@@ -0,0 +1,65 @@
+#include "tests.h"
+#include "occlusion.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+
+//! Spheres (center, radius) around a wall of 20x20 units 20 units in front of the camera, with the expected occlusion.
+static const struct {
+	glm::vec4 sphere;
+	bool occluded;
+} KNOWN_SPHERES[] = {
+	{ glm::vec4(0.0f, 0.0f, -40.0f, 2.0f), true },
+	{ glm::vec4(5.0f, 5.0f, -30.0f, 1.0f), true },
+	{ glm::vec4(-9.0f, 0.0f, -40.0f, 2.0f), true }, // near the edge, but still within the wall
+	{ glm::vec4(19.0f, 0.0f, -40.0f, 2.0f), false }, // partially beside the wall
+	{ glm::vec4(30.0f, 0.0f, -40.0f, 2.0f), false }, // entirely beside the wall
+	{ glm::vec4(0.0f, 0.0f, -10.0f, 2.0f), false }, // in front of the wall
+	{ glm::vec4(0.0f, 0.0f, -21.0f, 2.0f), false }, // crosses the wall
+	{ glm::vec4(0.0f, 0.0f, -40.0f, 30.0f), false }, // larger than the wall
+	{ glm::vec4(0.0f, 0.0f, -0.5f, 1.0f), false }, // crosses the camera plane
+};
+
+
+//! Rasterize the wall and test boxes around known spheres behind, beside and in front of it.
+//! The result mustn't depend on the winding of the occluder or on how the rows are split between jobs.
+int test_occlusion()
+{
+	int failures = 0;
+
+	const uint32_t WIDTH = 64, HEIGHT = 48;
+	const glm::mat4 clip_from_world = glm::perspective(glm::radians(90.0f), (float)WIDTH / HEIGHT, 1.0f, 1000.0f);
+	const uint32_t WINDINGS[2][6] = {
+		{ 0, 1, 2, 0, 2, 3 }, // counter-clockwise
+		{ 0, 2, 1, 0, 3, 2 }, // clockwise
+	};
+
+	std::vector<float> reference;
+	for (const uint32_t *winding : WINDINGS) {
+		Occluders wall;
+		wall.vertices.push_back(glm::vec3(-10.0f, -10.0f, -20.0f));
+		wall.vertices.push_back(glm::vec3(10.0f, -10.0f, -20.0f));
+		wall.vertices.push_back(glm::vec3(10.0f, 10.0f, -20.0f));
+		wall.vertices.push_back(glm::vec3(-10.0f, 10.0f, -20.0f));
+		wall.indices.assign(winding, winding + 6);
+
+		OcclusionBuffer buffer;
+		resize_occlusion_buffer(buffer, wall, WIDTH, HEIGHT);
+		TEST_CHECK(WIDTH == buffer.width && HEIGHT == buffer.height);
+
+		// Nothing is occluded before rasterization
+		transform_occluders(buffer, wall, clip_from_world, 0, wall.vertices.size());
+		for (const auto &known : KNOWN_SPHERES)
+			TEST_CHECK(!is_sphere_occluded(buffer, clip_from_world, known.sphere));
+
+		// Rows are split unevenly, like between jobs of different sizes
+		rasterize_occluders(buffer, wall, 0, 1);
+		rasterize_occluders(buffer, wall, 1, buffer.tiles_y);
+		if (reference.empty())
+			reference = buffer.depth;
+		TEST_CHECK(reference == buffer.depth);
+
+		for (const auto &known : KNOWN_SPHERES)
+			TEST_CHECK(is_sphere_occluded(buffer, clip_from_world, known.sphere) == known.occluded);
+	}
+	return failures;
+}
@@ -0,0 +1,92 @@
+#include "tests.h"
+#include "simplify.h"
+#include <math.h>
+#include <map>
+#include <tuple>
+
+
+//! Simplify a gently curved grid split by a UV seam (middle column) and a color seam (middle row).
+//! Border and seam vertices must keep being referenced, so the outline and the seams don't move,
+//! while the interior loses triangles within the error budget and without leaving holes or flipping.
+int test_simplify()
+{
+	int failures = 0;
+
+	// Every vertex on a seam has a copy for each side of it, the other vertices are shared
+	const uint32_t SIZE = 32, SEAM = SIZE / 2;
+	std::vector<glm::vec3> positions;
+	std::vector<glm::u8vec4> colors;
+	std::vector<glm::vec4> uvs;
+	std::vector<uint8_t> fixed; //!< 1 for border and seam vertices
+	std::map<std::tuple<uint32_t, uint32_t, uint32_t, uint32_t>, uint32_t> lookup;
+	auto get_vertex = [&](uint32_t x, uint32_t y, uint32_t right, uint32_t top) {
+		const uint32_t side_x = (SEAM == x) ? right : 0, side_y = (SEAM == y) ? top : 0;
+		const auto key = std::make_tuple(x, y, side_x, side_y);
+		const auto it = lookup.find(key);
+		if (lookup.end() != it)
+			return it->second;
+		positions.push_back(glm::vec3(x, y, 0.05f * sinf(0.3f * x) * cosf(0.2f * y)));
+		colors.push_back(side_y ? glm::u8vec4(255, 0, 0, 255) : glm::u8vec4(255));
+		uvs.push_back(glm::vec4(x / (float)SIZE + 0.5f * side_x, y / (float)SIZE, 0.0f, 0.0f));
+		fixed.push_back((0 == x || SIZE == x || 0 == y || SIZE == y || SEAM == x || SEAM == y) ? 1 : 0);
+		lookup[key] = positions.size() - 1;
+		return (uint32_t)positions.size() - 1;
+	};
+	std::vector<uint32_t> triangles;
+	for (uint32_t y = 0; y < SIZE; ++y) {
+		for (uint32_t x = 0; x < SIZE; ++x) {
+			const uint32_t right = (x >= SEAM) ? 1 : 0, top = (y >= SEAM) ? 1 : 0;
+			const uint32_t a = get_vertex(x, y, right, top), b = get_vertex(x + 1, y, right, top);
+			const uint32_t c = get_vertex(x, y + 1, right, top), d = get_vertex(x + 1, y + 1, right, top);
+			const uint32_t quad[] = { a, b, d, a, d, c };
+			triangles.insert(triangles.end(), quad, quad + 6);
+		}
+	}
+	const uint32_t num_vertices = positions.size(), num_triangles = triangles.size() / 3;
+	TEST_CHECK((SIZE + 1) * (SIZE + 1) + 2 * (SIZE + 1) + 1 == num_vertices); // Both seams and their crossing
+	TEST_CHECK(2 * SIZE * SIZE == num_triangles);
+	const std::vector<uint32_t> grid(triangles);
+
+	const float MAX_ERROR = 0.1f;
+	const SimplifyMesh mesh = { positions.data(), colors.data(), uvs.data(), num_vertices, 0.1f };
+	const float error = simplify_triangles(mesh, triangles, num_triangles / 8, MAX_ERROR);
+	TEST_CHECK(0.0f <= error && error <= MAX_ERROR);
+	TEST_CHECK(0 == triangles.size() % 3);
+	TEST_CHECK(triangles.size() / 3 < num_triangles / 2);
+
+	// Triangles still cover the grid exactly once, facing the same way
+	std::vector<uint8_t> used(num_vertices, 0);
+	float area = 0.0f;
+	bool in_range = true, flipped = false;
+	for (size_t t = 0; t < triangles.size(); t += 3) {
+		if (triangles[t] >= num_vertices || triangles[t + 1] >= num_vertices || triangles[t + 2] >= num_vertices) {
+			in_range = false;
+			break;
+		}
+		const glm::vec2 p0(positions[triangles[t]]), p1(positions[triangles[t + 1]]), p2(positions[triangles[t + 2]]);
+		const float twice_area = (p1.x - p0.x) * (p2.y - p0.y) - (p1.y - p0.y) * (p2.x - p0.x);
+		flipped = flipped || twice_area <= 0.0f;
+		area += 0.5f * twice_area;
+		used[triangles[t]] = used[triangles[t + 1]] = used[triangles[t + 2]] = 1;
+	}
+	TEST_CHECK(in_range);
+	TEST_CHECK(!flipped);
+	TEST_CHECK(fabsf(area - SIZE * SIZE) < 0.01f);
+
+	// Fixed vertices are never collapsed away, some of the interior ones are
+	uint32_t lost_fixed = 0, used_interior = 0, num_interior = 0;
+	for (uint32_t v = 0; v < num_vertices && in_range; ++v) {
+		lost_fixed += (fixed[v] && !used[v]) ? 1 : 0;
+		used_interior += (!fixed[v] && used[v]) ? 1 : 0;
+		num_interior += fixed[v] ? 0 : 1;
+	}
+	TEST_CHECK(0 == lost_fixed);
+	TEST_CHECK(used_interior < num_interior);
+
+	// A budget tighter than the bumps of the surface (and the UV differences) can't collapse anything
+	std::vector<uint32_t> strict(grid);
+	TEST_CHECK(0.0f == simplify_triangles(mesh, strict, 0, 0.0f));
+	TEST_CHECK(grid == strict);
+
+	return failures;
+}
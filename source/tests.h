@@ -0,0 +1,28 @@
+/*
+ * Minimal harness of the CPU tests run by vicetests.
+ *
+ * Only modules, which don't depend on OpenGL, are tested. Every test returns the number
+ * of failed checks and carries on after a failure, so a single run reports all of them.
+ */
+#ifndef _TESTS_INCLUDED
+#define _TESTS_INCLUDED
+#include <stdio.h>
+
+
+//! Report a failed condition and count it into `failures` (a local of the test).
+#define TEST_CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			fprintf(stderr, "ERROR: %s:%d: %s\n", __FILE__, __LINE__, #condition); \
+			++failures; \
+		} \
+	} while (0)
+
+int test_culling();
+int test_occlusion();
+int test_meshlet();
+int test_morton();
+int test_simplify();
+
+
+#endif
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string.h>
+#include "camera_path.h"
+
+
+bool load_camera_path(CameraPath &path, const char *filename)
+{
+	FILE *file = fopen(filename, "r");
+	if (!file)
+		return false;
+
+	const size_t BUF_SIZE = 256;
+	char buf[BUF_SIZE] = {};
+	unsigned long long tick_micros = 0;
+	path = CameraPath();
+	while (NULL != fgets(buf, BUF_SIZE, file)) {
+		CameraKey key = {};
+		if (5 == sscanf(buf, "viewport;%i;%i;%f;%f;%f", &path.width, &path.height, &path.fovy, &path.near_plane, &path.far_plane))
+			continue;
+		else if (1 == sscanf(buf, "tick;%llu", &tick_micros))
+			path.tick_micros = tick_micros;
+		else if (5 == sscanf(buf, "%f;%f;%f;%f;%f", &key.position.x, &key.position.y, &key.position.z, &key.yaw, &key.pitch))
+			path.keys.push_back(key);
+		// Everything else (the header) is silently skipped
+	}
+
+	fclose(file);
+	return !path.keys.empty() && 0 < path.tick_micros;
+}
+
+
+bool save_camera_path(const CameraPath &path, const char *filename)
+{
+	FILE *file = fopen(filename, "w");
+	if (!file)
+		return false;
+
+	fprintf(file, "viewport;%i;%i;%g;%g;%g\n", path.width, path.height, path.fovy, path.near_plane, path.far_plane);
+	fprintf(file, "tick;%llu\n", (unsigned long long)path.tick_micros);
+	fprintf(file, "x;y;z;yaw;pitch\n");
+	for (const CameraKey &key : path.keys) // %.9g makes the float -> text -> float round trip exact
+		fprintf(file, "%.9g;%.9g;%.9g;%.9g;%.9g\n", key.position.x, key.position.y, key.position.z, key.yaw, key.pitch);
+
+	fclose(file);
+	return true;
+}
+
+
+CameraKey sample_camera_path(const CameraPath &path, uint64_t time_micros)
+{
+	const uint64_t tick = time_micros / path.tick_micros;
+	const size_t prev = tick % path.keys.size();
+	const size_t next = prev + 1;
+	if (next == path.keys.size())
+		return path.keys[prev]; // There is nothing to interpolate with
+
+	const float t = (time_micros % path.tick_micros) / (float)path.tick_micros;
+	const CameraKey &a = path.keys[prev];
+	const CameraKey &b = path.keys[next];
+	CameraKey key;
+	key.position = glm::mix(a.position, b.position, t);
+	key.yaw = glm::mix(a.yaw, b.yaw, t);
+	key.pitch = glm::mix(a.pitch, b.pitch, t);
+	return key;
+}
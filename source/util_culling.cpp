@@ -0,0 +1,204 @@
+#include "culling.h"
+#if defined(__AVX__)
+	#include <immintrin.h>
+	const uint32_t CULLING_LANES = 8;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	const uint32_t CULLING_LANES = 4;
+#else
+	const uint32_t CULLING_LANES = 1;
+#endif
+
+
+void assign_bounding_spheres(BoundingSpheres &spheres, const glm::vec4 *data, uint32_t count)
+{
+	// Padding spheres are never visible, but the kernels mask them out anyway
+	const size_t padded = count + CULLING_LANES;
+	spheres.x.assign(padded, 0.0f);
+	spheres.y.assign(padded, 0.0f);
+	spheres.z.assign(padded, 0.0f);
+	spheres.radius.assign(padded, -1.0f);
+	spheres.count = count;
+	for (uint32_t i = 0; i < count; ++i) {
+		spheres.x[i] = data[i].x;
+		spheres.y[i] = data[i].y;
+		spheres.z[i] = data[i].z;
+		spheres.radius[i] = data[i].w;
+	}
+}
+
+
+CullingFrustum make_culling_frustum(const glm::mat4 &clip_from_world, const glm::vec3 &camera, float max_distance)
+{
+	// Gribb & Hartmann: planes are sums/differences of the matrix rows (GLM matrices are column-major)
+	CullingFrustum frustum;
+	const glm::mat4 m = glm::transpose(clip_from_world);
+	frustum.planes[0] = m[3] + m[0]; // left
+	frustum.planes[1] = m[3] - m[0]; // right
+	frustum.planes[2] = m[3] + m[1]; // bottom
+	frustum.planes[3] = m[3] - m[1]; // top
+	frustum.planes[4] = m[3] + m[2]; // near
+	frustum.planes[5] = m[3] - m[2]; // far
+	for (int i = 0; i < 6; ++i)
+		frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+	frustum.camera = camera;
+	frustum.max_distance = max_distance;
+	return frustum;
+}
+
+
+uint32_t cull_spheres_scalar(const CullingFrustum &frustum, const BoundingSpheres &spheres, uint32_t first, uint32_t count, uint32_t *visible)
+{
+	const glm::vec4 *planes = frustum.planes;
+	uint32_t num_visible = 0;
+	for (uint32_t i = first; i < first + count; ++i) {
+		bool inside = true;
+		for (int p = 0; p < 6; ++p) {
+			const float distance = planes[p].x * spheres.x[i] + planes[p].y * spheres.y[i] + planes[p].z * spheres.z[i] + planes[p].w;
+			inside = inside && (distance > -spheres.radius[i]);
+		}
+		const float dx = spheres.x[i] - frustum.camera.x;
+		const float dy = spheres.y[i] - frustum.camera.y;
+		const float dz = spheres.z[i] - frustum.camera.z;
+		const float reach = frustum.max_distance + spheres.radius[i];
+		inside = inside && (dx * dx + dy * dy + dz * dz < reach * reach);
+		// Branchless compaction: the index is always written, but kept only if visible
+		visible[num_visible] = i;
+		num_visible += inside ? 1 : 0;
+	}
+	return num_visible;
+}
+
+
+bool is_sphere_visible(const CullingFrustum &frustum, const glm::vec4 &sphere)
+{
+	for (int p = 0; p < 6; ++p)
+		if (glm::dot(glm::vec3(frustum.planes[p]), glm::vec3(sphere)) + frustum.planes[p].w <= -sphere.w)
+			return false;
+	const glm::vec3 offset = glm::vec3(sphere) - frustum.camera;
+	const float reach = frustum.max_distance + sphere.w;
+	return glm::dot(offset, offset) < reach * reach;
+}
+
+
+bool is_box_visible(const CullingFrustum &frustum, const glm::vec3 &lo, const glm::vec3 &hi)
+{
+	// The box is outside, if its corner furthest along the plane normal is behind the plane
+	for (int p = 0; p < 6; ++p) {
+		const glm::vec4 &plane = frustum.planes[p];
+		const glm::vec3 corner(plane.x >= 0.0f ? hi.x : lo.x, plane.y >= 0.0f ? hi.y : lo.y, plane.z >= 0.0f ? hi.z : lo.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+			return false;
+	}
+	const glm::vec3 nearest = glm::clamp(frustum.camera, lo, hi);
+	const glm::vec3 offset = nearest - frustum.camera;
+	return glm::dot(offset, offset) < frustum.max_distance * frustum.max_distance;
+}
+
+
+#if defined(__AVX__)
+
+uint32_t cull_spheres(const CullingFrustum &frustum, const BoundingSpheres &spheres, uint32_t first, uint32_t count, uint32_t *visible)
+{
+	__m256 px[6], py[6], pz[6], pw[6];
+	for (int p = 0; p < 6; ++p) {
+		px[p] = _mm256_set1_ps(frustum.planes[p].x);
+		py[p] = _mm256_set1_ps(frustum.planes[p].y);
+		pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+		pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+	}
+	const __m256 cx = _mm256_set1_ps(frustum.camera.x);
+	const __m256 cy = _mm256_set1_ps(frustum.camera.y);
+	const __m256 cz = _mm256_set1_ps(frustum.camera.z);
+	const __m256 max_distance = _mm256_set1_ps(frustum.max_distance);
+
+	uint32_t num_visible = 0;
+	for (uint32_t i = 0; i < count; i += 8) {
+		const __m256 x = _mm256_loadu_ps(&spheres.x[first + i]);
+		const __m256 y = _mm256_loadu_ps(&spheres.y[first + i]);
+		const __m256 z = _mm256_loadu_ps(&spheres.z[first + i]);
+		const __m256 radius = _mm256_loadu_ps(&spheres.radius[first + i]);
+		const __m256 neg_radius = _mm256_sub_ps(_mm256_setzero_ps(), radius);
+
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p) {
+			__m256 distance = _mm256_add_ps(_mm256_mul_ps(px[p], x), pw[p]);
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(py[p], y));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(pz[p], z));
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, neg_radius, _CMP_GT_OQ));
+		}
+
+		const __m256 dx = _mm256_sub_ps(x, cx);
+		const __m256 dy = _mm256_sub_ps(y, cy);
+		const __m256 dz = _mm256_sub_ps(z, cz);
+		const __m256 distance_sq = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		const __m256 reach = _mm256_add_ps(max_distance, radius);
+		inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance_sq, _mm256_mul_ps(reach, reach), _CMP_LT_OQ));
+
+		const uint32_t mask = (uint32_t)_mm256_movemask_ps(inside);
+		const uint32_t lanes = (count - i < 8) ? count - i : 8;
+		for (uint32_t lane = 0; lane < lanes; ++lane) {
+			visible[num_visible] = first + i + lane;
+			num_visible += (mask >> lane) & 1;
+		}
+	}
+	return num_visible;
+}
+
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+uint32_t cull_spheres(const CullingFrustum &frustum, const BoundingSpheres &spheres, uint32_t first, uint32_t count, uint32_t *visible)
+{
+	__m128 px[6], py[6], pz[6], pw[6];
+	for (int p = 0; p < 6; ++p) {
+		px[p] = _mm_set1_ps(frustum.planes[p].x);
+		py[p] = _mm_set1_ps(frustum.planes[p].y);
+		pz[p] = _mm_set1_ps(frustum.planes[p].z);
+		pw[p] = _mm_set1_ps(frustum.planes[p].w);
+	}
+	const __m128 cx = _mm_set1_ps(frustum.camera.x);
+	const __m128 cy = _mm_set1_ps(frustum.camera.y);
+	const __m128 cz = _mm_set1_ps(frustum.camera.z);
+	const __m128 max_distance = _mm_set1_ps(frustum.max_distance);
+
+	uint32_t num_visible = 0;
+	for (uint32_t i = 0; i < count; i += 4) {
+		const __m128 x = _mm_loadu_ps(&spheres.x[first + i]);
+		const __m128 y = _mm_loadu_ps(&spheres.y[first + i]);
+		const __m128 z = _mm_loadu_ps(&spheres.z[first + i]);
+		const __m128 radius = _mm_loadu_ps(&spheres.radius[first + i]);
+		const __m128 neg_radius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		for (int p = 0; p < 6; ++p) {
+			__m128 distance = _mm_add_ps(_mm_mul_ps(px[p], x), pw[p]);
+			distance = _mm_add_ps(distance, _mm_mul_ps(py[p], y));
+			distance = _mm_add_ps(distance, _mm_mul_ps(pz[p], z));
+			inside = _mm_and_ps(inside, _mm_cmpgt_ps(distance, neg_radius));
+		}
+
+		const __m128 dx = _mm_sub_ps(x, cx);
+		const __m128 dy = _mm_sub_ps(y, cy);
+		const __m128 dz = _mm_sub_ps(z, cz);
+		const __m128 distance_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		const __m128 reach = _mm_add_ps(max_distance, radius);
+		inside = _mm_and_ps(inside, _mm_cmplt_ps(distance_sq, _mm_mul_ps(reach, reach)));
+
+		const uint32_t mask = (uint32_t)_mm_movemask_ps(inside);
+		const uint32_t lanes = (count - i < 4) ? count - i : 4;
+		for (uint32_t lane = 0; lane < lanes; ++lane) {
+			visible[num_visible] = first + i + lane;
+			num_visible += (mask >> lane) & 1;
+		}
+	}
+	return num_visible;
+}
+
+#else
+
+uint32_t cull_spheres(const CullingFrustum &frustum, const BoundingSpheres &spheres, uint32_t first, uint32_t count, uint32_t *visible)
+{
+	return cull_spheres_scalar(frustum, spheres, first, count, visible);
+}
+
+#endif
@@ -1,15 +1,62 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <memory.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
 #include <GL/glew.h>
 #include <Windows.h>
 
+// OpenGL debug log
+//
+// Writing the messages straight from the debug callback (especially with GL_DEBUG_OUTPUT_SYNCHRONOUS)
+// serializes the driver, so the callback only copies the message into a lock-free queue
+// and a background thread filters repeated messages and writes them to the CSV file.
+static const uint32_t LOG_QUEUE_SIZE = 1024; // Has to be a power of two
+static const size_t MAX_LOG_MESSAGE = 256; //!< Longer messages are truncated
+static const uint32_t MAX_LOGGED_REPEATS = 4; //!< Only first few occurrences of each message are written
+static const GLenum DEBUG_SOURCES[] = { GL_DEBUG_SOURCE_API, GL_DEBUG_SOURCE_WINDOW_SYSTEM, GL_DEBUG_SOURCE_SHADER_COMPILER,
+	GL_DEBUG_SOURCE_THIRD_PARTY, GL_DEBUG_SOURCE_APPLICATION, GL_DEBUG_SOURCE_OTHER };
+static const GLenum DEBUG_TYPES[] = { GL_DEBUG_TYPE_ERROR, GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR, GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR,
+	GL_DEBUG_TYPE_PORTABILITY, GL_DEBUG_TYPE_PERFORMANCE, GL_DEBUG_TYPE_MARKER, GL_DEBUG_TYPE_PUSH_GROUP,
+	GL_DEBUG_TYPE_POP_GROUP, GL_DEBUG_TYPE_OTHER };
+static const GLenum DEBUG_SEVERITIES[] = { GL_DEBUG_SEVERITY_NOTIFICATION, GL_DEBUG_SEVERITY_LOW,
+	GL_DEBUG_SEVERITY_MEDIUM, GL_DEBUG_SEVERITY_HIGH }; // From the least severe
+
+//! Slot of the bounded multi-producer queue (the driver may call us from any of its threads).
+//! `sequence` equals the enqueue position once the slot is free and position + 1 once it's filled.
+struct GlLogMessage {
+	std::atomic<uint32_t> sequence;
+	GLenum source, type, severity;
+	GLuint id;
+	char text[MAX_LOG_MESSAGE];
+};
+
+//! How many times was a message with given source, type and ID received.
+struct GlLogRepeats {
+	GLenum source, type, severity;
+	GLuint id;
+	uint32_t count;
+};
+
 static FILE *gl_log_file;
+static GlLogMessage log_queue[LOG_QUEUE_SIZE];
+static std::atomic<uint32_t> log_enqueue_pos(0);
+static uint32_t log_dequeue_pos = 0; //!< Owned by the writer thread
+static std::atomic<uint64_t> log_received(0);
+static std::atomic<uint64_t> log_dropped(0);
+static std::atomic<bool> log_running(false);
+static std::thread log_thread;
+static std::map<uint64_t, GlLogRepeats> log_repeats; //!< Owned by the writer thread
 
 
 #define CASE_STRING(var, caseval)	{ case caseval: var = #caseval; break; }
 
-static void APIENTRY opengl_log_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *usrParam)
+static
+void write_log_line(GLenum source, GLenum type, GLuint id, GLenum severity, const char *message)
 {
 	char *source_str = "";
 	switch (source) {
@@ -43,23 +90,176 @@ static void APIENTRY opengl_log_callback(GLenum source, GLenum type, GLuint id,
 	}
 
 	fprintf(gl_log_file, "%s;%s;%s;%u;%s\n", severity_str, type_str, source_str, id, message);
-	fflush(gl_log_file);
 }
 
 
-void start_opengl_log(const char *filename)
+static void APIENTRY opengl_log_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *usrParam)
+{
+	log_received.fetch_add(1, std::memory_order_relaxed);
+
+	// Claim a free slot (the message is dropped rather than blocking the driver, if the queue is full)
+	uint32_t pos = log_enqueue_pos.load(std::memory_order_relaxed);
+	GlLogMessage *slot;
+	for (;;) {
+		slot = &log_queue[pos & (LOG_QUEUE_SIZE - 1)];
+		const int32_t diff = (int32_t)(slot->sequence.load(std::memory_order_acquire) - pos);
+		if (0 == diff) {
+			if (log_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			log_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = log_enqueue_pos.load(std::memory_order_relaxed);
+		}
+	}
+
+	slot->source = source;
+	slot->type = type;
+	slot->severity = severity;
+	slot->id = id;
+	const size_t text_len = std::min((length < 0) ? strlen(message) : (size_t)length, MAX_LOG_MESSAGE - 1);
+	memcpy(slot->text, message, text_len);
+	slot->text[text_len] = '\0';
+	slot->sequence.store(pos + 1, std::memory_order_release);
+}
+
+
+//! Write all queued messages to the log file.
+//! @returns Number of messages taken from the queue.
+static
+uint32_t drain_opengl_log()
+{
+	uint32_t drained = 0;
+	for (;;) {
+		GlLogMessage &slot = log_queue[log_dequeue_pos & (LOG_QUEUE_SIZE - 1)];
+		if (log_dequeue_pos + 1 != slot.sequence.load(std::memory_order_acquire))
+			break;
+
+		const uint64_t key = ((uint64_t)slot.source << 48) | ((uint64_t)slot.type << 32) | slot.id;
+		GlLogRepeats &repeats = log_repeats[key];
+		if (0 == repeats.count++) {
+			repeats.source = slot.source;
+			repeats.type = slot.type;
+			repeats.severity = slot.severity;
+			repeats.id = slot.id;
+		}
+		if (repeats.count <= MAX_LOGGED_REPEATS)
+			write_log_line(slot.source, slot.type, slot.id, slot.severity, slot.text);
+
+		slot.sequence.store(log_dequeue_pos + LOG_QUEUE_SIZE, std::memory_order_release);
+		++log_dequeue_pos;
+		++drained;
+	}
+
+	if (drained)
+		fflush(gl_log_file);
+	return drained;
+}
+
+
+static
+void opengl_log_thread()
+{
+	while (log_running.load(std::memory_order_acquire)) {
+		if (0 == drain_opengl_log())
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+}
+
+
+//! Start logging debug messages of given severity and above to the CSV file.
+//! Messages are reported asynchronously, see set_opengl_log_mode().
+void start_opengl_log(const char *filename, GLenum min_severity)
 {
 	gl_log_file = fopen(filename, "w");
+	if (!gl_log_file) {
+		fprintf(stderr, "WARNING: Cannot open OpenGL log file '%s'\n", filename);
+		return;
+	}
 	fprintf(gl_log_file, "severity;type;source;id;message\n");
+
+	for (uint32_t i = 0; i < LOG_QUEUE_SIZE; ++i)
+		log_queue[i].sequence.store(i, std::memory_order_relaxed);
+	log_enqueue_pos.store(0);
+	log_dequeue_pos = 0;
+	log_received.store(0);
+	log_dropped.store(0);
+	log_repeats.clear();
+	log_running.store(true);
+	log_thread = std::thread(opengl_log_thread);
+
+	// Let the driver throw away messages we are not interested in, so they don't even reach the callback
+	bool enabled = false;
+	for (GLenum severity : DEBUG_SEVERITIES) {
+		enabled = enabled || (severity == min_severity);
+		glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, severity, 0, NULL, enabled ? GL_TRUE : GL_FALSE);
+	}
 	glDebugMessageCallback(opengl_log_callback, NULL);
-	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glEnable(GL_DEBUG_OUTPUT);
+	glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+}
+
+
+//! Enable or disable the debug output at runtime.
+//! Synchronous output reports messages right from the offending GL call (handy with breakpoints),
+//! but it forces the driver to work in lockstep with our thread.
+void set_opengl_log_mode(bool enabled, bool synchronous)
+{
+	if (enabled)
+		glEnable(GL_DEBUG_OUTPUT);
+	else
+		glDisable(GL_DEBUG_OUTPUT);
+	if (synchronous)
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	else
+		glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+}
+
+
+//! Don't report messages with given IDs (regardless of their source and type).
+void ignore_opengl_messages(const GLuint *ids, GLsizei count)
+{
+	// IDs can be only filtered together with a specific source and type
+	for (GLenum source : DEBUG_SOURCES)
+		for (GLenum type : DEBUG_TYPES)
+			glDebugMessageControl(source, type, GL_DONT_CARE, count, ids, GL_FALSE);
+}
+
+
+//! Total number of debug messages received since the log was started (including dropped ones).
+uint64_t opengl_log_message_count()
+{
+	return log_received.load(std::memory_order_relaxed);
 }
 
 
 void stop_opengl_log()
 {
-	if (gl_log_file)
-		fclose(gl_log_file);
+	if (!gl_log_file)
+		return;
+
+	glDisable(GL_DEBUG_OUTPUT);
+	glDebugMessageCallback(NULL, NULL);
+	log_running.store(false, std::memory_order_release);
+	log_thread.join();
+	drain_opengl_log();
+
+	// Summarize messages which were written only partially
+	uint32_t suppressed = 0;
+	for (const auto &entry : log_repeats) {
+		const GlLogRepeats &repeats = entry.second;
+		if (repeats.count <= MAX_LOGGED_REPEATS)
+			continue;
+		char message[64];
+		sprintf(message, "(%u more occurrences not logged)", repeats.count - MAX_LOGGED_REPEATS);
+		write_log_line(repeats.source, repeats.type, repeats.id, repeats.severity, message);
+		suppressed += repeats.count - MAX_LOGGED_REPEATS;
+	}
+	fprintf(stderr, "INFO: OpenGL log: %llu messages (%u unique, %u repeats not logged, %llu dropped)\n",
+		(unsigned long long)log_received.load(), (uint32_t)log_repeats.size(), suppressed, (unsigned long long)log_dropped.load());
+
+	fclose(gl_log_file);
 	gl_log_file = NULL;
 }
 
@@ -89,13 +289,10 @@ GLuint compile_glsl_source(GLenum type, char *source)
 }
 
 
-GLuint link_glsl(GLuint vertex_shader, GLuint fragment_shader)
+//! Check the link status of given program (which is deleted, if linking failed).
+static
+GLuint check_link_status(GLuint program)
 {
-	GLuint program = glCreateProgram();
-	glAttachShader(program, vertex_shader);
-	glAttachShader(program, fragment_shader);
-	glLinkProgram(program);
-
 	GLint link_status;
 	glGetProgramiv(program, GL_LINK_STATUS, &link_status);
 	if (GL_FALSE == link_status) {
@@ -112,3 +309,22 @@ GLuint link_glsl(GLuint vertex_shader, GLuint fragment_shader)
 
 	return program;
 }
+
+
+GLuint link_glsl(GLuint vertex_shader, GLuint fragment_shader)
+{
+	GLuint program = glCreateProgram();
+	glAttachShader(program, vertex_shader);
+	glAttachShader(program, fragment_shader);
+	glLinkProgram(program);
+	return check_link_status(program);
+}
+
+
+GLuint link_glsl_compute(GLuint compute_shader)
+{
+	GLuint program = glCreateProgram();
+	glAttachShader(program, compute_shader);
+	glLinkProgram(program);
+	return check_link_status(program);
+}
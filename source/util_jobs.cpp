@@ -0,0 +1,110 @@
+#include "jobs.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+
+static std::vector<std::thread> workers;
+static std::mutex job_mutex;
+static std::condition_variable job_cv; //!< Wakes up workers, when there is a new job
+static std::condition_variable done_cv; //!< Wakes up parallel_for(), when all workers are done
+static const std::function<void(uint32_t, uint32_t)> *current_job; //!< Guarded by `job_mutex`
+static uint32_t job_count, job_batch_size; //!< Guarded by `job_mutex`
+static uint64_t job_generation = 0; //!< Guarded by `job_mutex`
+static bool job_quit = false; //!< Guarded by `job_mutex`
+static std::atomic<uint32_t> job_next(0); //!< The first index of the next batch
+static std::atomic<uint32_t> job_active_workers(0);
+
+
+//! Take batches of the current job until there are none left.
+static
+void run_batches(const std::function<void(uint32_t, uint32_t)> &job, uint32_t count, uint32_t batch_size)
+{
+	for (;;) {
+		const uint32_t begin = job_next.fetch_add(batch_size);
+		if (begin >= count)
+			break;
+		job(begin, (count - begin < batch_size) ? count : begin + batch_size);
+	}
+}
+
+
+static
+void worker_thread()
+{
+	uint64_t seen_generation = 0;
+	for (;;) {
+		const std::function<void(uint32_t, uint32_t)> *job;
+		uint32_t count, batch_size;
+		{
+			std::unique_lock<std::mutex> lock(job_mutex);
+			job_cv.wait(lock, [&] { return job_quit || seen_generation != job_generation; });
+			if (job_quit)
+				return;
+			seen_generation = job_generation;
+			job = current_job;
+			count = job_count;
+			batch_size = job_batch_size;
+		}
+
+		run_batches(*job, count, batch_size);
+		if (1 == job_active_workers.fetch_sub(1)) {
+			std::lock_guard<std::mutex> lock(job_mutex);
+			done_cv.notify_one();
+		}
+	}
+}
+
+
+void start_job_pool(unsigned num_workers)
+{
+	if (0 == num_workers) {
+		const unsigned hw_threads = std::thread::hardware_concurrency();
+		num_workers = (hw_threads > 1) ? hw_threads - 1 : 0;
+	}
+
+	job_quit = false;
+	for (unsigned i = 0; i < num_workers; ++i)
+		workers.push_back(std::thread(worker_thread));
+}
+
+
+void stop_job_pool()
+{
+	{
+		std::lock_guard<std::mutex> lock(job_mutex);
+		job_quit = true;
+	}
+	job_cv.notify_all();
+	for (std::thread &worker : workers)
+		worker.join();
+	workers.clear();
+}
+
+
+void parallel_for(uint32_t count, uint32_t batch_size, const std::function<void(uint32_t begin, uint32_t end)> &job)
+{
+	if (workers.empty() || count <= batch_size) {
+		if (0 < count)
+			job(0, count);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(job_mutex);
+		current_job = &job;
+		job_count = count;
+		job_batch_size = batch_size;
+		job_next = 0;
+		job_active_workers = (uint32_t)workers.size();
+		++job_generation;
+	}
+	job_cv.notify_all();
+
+	// The calling thread helps as well, then waits until every worker let go of the job
+	run_batches(job, count, batch_size);
+	std::unique_lock<std::mutex> lock(job_mutex);
+	done_cv.wait(lock, [] { return 0 == job_active_workers.load(); });
+}
@@ -0,0 +1,98 @@
+#include "meshlet.h"
+#include <math.h>
+#include <algorithm>
+
+
+//! Compute bounding sphere and normal cone of the last meshlet.
+static
+void finish_meshlet(const glm::vec3 *positions, Meshlet &meshlet, const std::vector<uint32_t> &indices)
+{
+	const uint32_t *triangles = &indices[meshlet.first_index];
+	glm::vec3 lo(1.0e30f), hi(-1.0e30f), normal_sum(0.0f);
+	for (uint32_t i = 0; i < 3 * meshlet.num_triangles; ++i) {
+		lo = glm::min(lo, positions[triangles[i]]);
+		hi = glm::max(hi, positions[triangles[i]]);
+	}
+	for (uint32_t t = 0; t < meshlet.num_triangles; ++t) {
+		const glm::vec3 &a = positions[triangles[3 * t]], &b = positions[triangles[3 * t + 1]], &c = positions[triangles[3 * t + 2]];
+		const glm::vec3 normal = glm::cross(b - a, c - a);
+		const float length = glm::length(normal);
+		if (length > 0.0f)
+			normal_sum += normal / length;
+	}
+
+	const glm::vec3 center = 0.5f * (lo + hi);
+	float radius = 0.0f;
+	for (uint32_t i = 0; i < 3 * meshlet.num_triangles; ++i)
+		radius = std::max(radius, glm::length(positions[triangles[i]] - center));
+	meshlet.sphere = glm::vec4(center, radius);
+
+	// The cone is useless, if some normals are more than 90 degrees apart from the axis
+	meshlet.cone = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+	const float sum_length = glm::length(normal_sum);
+	if (0.0f == sum_length)
+		return;
+	const glm::vec3 axis = normal_sum / sum_length;
+	float min_cos = 1.0f;
+	for (uint32_t t = 0; t < meshlet.num_triangles; ++t) {
+		const glm::vec3 &a = positions[triangles[3 * t]], &b = positions[triangles[3 * t + 1]], &c = positions[triangles[3 * t + 2]];
+		const glm::vec3 normal = glm::cross(b - a, c - a);
+		const float length = glm::length(normal);
+		if (length > 0.0f)
+			min_cos = std::min(min_cos, glm::dot(axis, normal / length));
+	}
+	if (min_cos > 0.0f)
+		meshlet.cone = glm::vec4(axis, sqrtf(std::max(0.0f, 1.0f - min_cos * min_cos)));
+}
+
+
+void build_meshlets(const glm::vec3 *positions, const uint32_t *triangles, uint32_t num_triangles, uint32_t split,
+	std::vector<Meshlet> &meshlets, std::vector<uint32_t> &indices)
+{
+	std::vector<uint32_t> meshlet_vertices; // Distinct vertices of the current meshlet (at most 64, so linear search is fine)
+	Meshlet meshlet = {};
+	meshlet.first_index = indices.size();
+	meshlet.split = split;
+
+	for (uint32_t t = 0; t < num_triangles; ++t) {
+		const uint32_t *triangle = triangles + 3 * t;
+		uint32_t new_vertices = 0;
+		for (int i = 0; i < 3; ++i)
+			if (meshlet_vertices.end() == std::find(meshlet_vertices.begin(), meshlet_vertices.end(), triangle[i]))
+				++new_vertices;
+
+		if (meshlet.num_triangles == MESHLET_MAX_TRIANGLES || meshlet_vertices.size() + new_vertices > MESHLET_MAX_VERTICES) {
+			meshlet.num_vertices = meshlet_vertices.size();
+			meshlets.push_back(meshlet);
+			finish_meshlet(positions, meshlets.back(), indices);
+			meshlet.first_index = indices.size();
+			meshlet.num_triangles = 0;
+			meshlet_vertices.clear();
+		}
+
+		for (int i = 0; i < 3; ++i) {
+			if (meshlet_vertices.end() == std::find(meshlet_vertices.begin(), meshlet_vertices.end(), triangle[i]))
+				meshlet_vertices.push_back(triangle[i]);
+			indices.push_back(triangle[i]);
+		}
+		++meshlet.num_triangles;
+	}
+
+	if (0 < meshlet.num_triangles) {
+		meshlet.num_vertices = meshlet_vertices.size();
+		meshlets.push_back(meshlet);
+		finish_meshlet(positions, meshlets.back(), indices);
+	}
+}
+
+
+bool is_meshlet_backfacing(const Meshlet &meshlet, const glm::vec3 &camera)
+{
+	// Every point of the sphere has to be within 90 degrees minus the cone angle from the axis,
+	// as seen from the camera. Comparing the nearest point against the farthest distance is conservative.
+	if (meshlet.cone.w >= 1.0f)
+		return false;
+	const glm::vec3 offset = glm::vec3(meshlet.sphere) - camera;
+	const float radius = meshlet.sphere.w;
+	return glm::dot(glm::vec3(meshlet.cone), offset) - radius >= meshlet.cone.w * (glm::length(offset) + radius);
+}
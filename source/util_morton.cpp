@@ -0,0 +1,18 @@
+#include "morton.h"
+
+
+uint32_t expand_morton_bits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+
+uint32_t morton_code(const glm::vec3 &pos, const glm::vec3 &lo, const glm::vec3 &hi)
+{
+	const glm::vec3 t = glm::clamp((pos - lo) / glm::max(hi - lo, glm::vec3(1.0e-6f)), 0.0f, 1.0f) * 1023.0f;
+	return (expand_morton_bits((uint32_t)t.x) << 2) | (expand_morton_bits((uint32_t)t.y) << 1) | expand_morton_bits((uint32_t)t.z);
+}
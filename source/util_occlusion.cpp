@@ -0,0 +1,180 @@
+#include "occlusion.h"
+#include <math.h>
+#include <algorithm>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define OCCLUSION_SSE2 1
+#endif
+
+
+//! Vertices closer to the camera plane than this (clip-space w) are not projected.
+static const float OCCLUSION_NEAR_W = 1.0e-3f;
+
+
+void resize_occlusion_buffer(OcclusionBuffer &buffer, const Occluders &occluders, uint32_t width, uint32_t height)
+{
+	buffer.tiles_x = (width + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE;
+	buffer.tiles_y = (height + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE;
+	buffer.width = buffer.tiles_x * OCCLUSION_TILE_SIZE;
+	buffer.height = buffer.tiles_y * OCCLUSION_TILE_SIZE;
+	buffer.depth.assign(buffer.width * buffer.height, 1.0f);
+	buffer.tile_farthest.assign(buffer.tiles_x * buffer.tiles_y, 1.0f);
+	buffer.screen.resize(occluders.vertices.size());
+}
+
+
+void transform_occluders(OcclusionBuffer &buffer, const Occluders &occluders, const glm::mat4 &clip_from_world, uint32_t first, uint32_t end)
+{
+	const glm::vec2 half_size(0.5f * buffer.width, 0.5f * buffer.height);
+	for (uint32_t i = first; i < end; ++i) {
+		const glm::vec4 clip = clip_from_world * glm::vec4(occluders.vertices[i], 1.0f);
+		if (clip.w < OCCLUSION_NEAR_W) {
+			buffer.screen[i] = glm::vec4(0.0f, 0.0f, 0.0f, clip.w);
+			continue;
+		}
+		const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		buffer.screen[i] = glm::vec4(half_size.x * (ndc.x + 1.0f), half_size.y * (ndc.y + 1.0f), 0.5f * ndc.z + 0.5f, clip.w);
+	}
+}
+
+
+//! Edge function `a * x + b * y + c`, which is positive left of the edge (in counter-clockwise triangles).
+struct Edge {
+	float a, b, c;
+
+	Edge(const glm::vec4 &from, const glm::vec4 &to)
+		: a(from.y - to.y), b(to.x - from.x), c(-(a * from.x + b * from.y)) {}
+};
+
+
+//! Rasterize a single triangle into pixel rows [y_begin, y_end).
+static
+void rasterize_triangle(OcclusionBuffer &buffer, glm::vec4 v0, glm::vec4 v1, glm::vec4 v2, int y_begin, int y_end)
+{
+	// Pixels whose centers lie within the bounding box
+	const int x0 = std::max(0, (int)ceilf(std::min(v0.x, std::min(v1.x, v2.x)) - 0.5f));
+	const int x1 = std::min((int)buffer.width - 1, (int)floorf(std::max(v0.x, std::max(v1.x, v2.x)) - 0.5f));
+	const int y0 = std::max(y_begin, (int)ceilf(std::min(v0.y, std::min(v1.y, v2.y)) - 0.5f));
+	const int y1 = std::min(y_end - 1, (int)floorf(std::max(v0.y, std::max(v1.y, v2.y)) - 0.5f));
+	if (x0 > x1 || y0 > y1)
+		return;
+
+	// Occluders are two-sided, so flip clockwise triangles
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+	if (0.0f == area)
+		return;
+	if (area < 0.0f) {
+		std::swap(v1, v2);
+		area = -area;
+	}
+
+	const Edge e0(v1, v2), e1(v2, v0), e2(v0, v1);
+	const float za = (e0.a * v0.z + e1.a * v1.z + e2.a * v2.z) / area;
+	const float zb = (e0.b * v0.z + e1.b * v1.z + e2.b * v2.z) / area;
+	const float zc = (e0.c * v0.z + e1.c * v1.z + e2.c * v2.z) / area;
+
+	for (int y = y0; y <= y1; ++y) {
+		const float py = y + 0.5f;
+		float *row = &buffer.depth[y * buffer.width];
+#if defined(OCCLUSION_SSE2)
+		// Rows are multiples of 4 pixels, so aligned groups never cross the end of the row
+		const __m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		const __m128 zero = _mm_setzero_ps();
+		for (int x = x0 & ~3; x <= x1; x += 4) {
+			const __m128 px = _mm_add_ps(_mm_set1_ps((float)x), lane_offsets);
+			const __m128 w0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e0.a), px), _mm_set1_ps(e0.b * py + e0.c));
+			const __m128 w1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e1.a), px), _mm_set1_ps(e1.b * py + e1.c));
+			const __m128 w2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(e2.a), px), _mm_set1_ps(e2.b * py + e2.c));
+			const __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)), _mm_cmpge_ps(w2, zero));
+			if (0 == _mm_movemask_ps(inside))
+				continue;
+
+			const __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), _mm_set1_ps(zb * py + zc));
+			const __m128 old_depth = _mm_loadu_ps(row + x);
+			const __m128 nearest = _mm_min_ps(old_depth, z);
+			_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old_depth)));
+		}
+#else
+		for (int x = x0; x <= x1; ++x) {
+			const float px = x + 0.5f;
+			const float w0 = e0.a * px + (e0.b * py + e0.c);
+			const float w1 = e1.a * px + (e1.b * py + e1.c);
+			const float w2 = e2.a * px + (e2.b * py + e2.c);
+			if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f)
+				row[x] = std::min(row[x], za * px + (zb * py + zc));
+		}
+#endif
+	}
+}
+
+
+void rasterize_occluders(OcclusionBuffer &buffer, const Occluders &occluders, uint32_t first_row, uint32_t end_row)
+{
+	const int y_begin = first_row * OCCLUSION_TILE_SIZE;
+	const int y_end = end_row * OCCLUSION_TILE_SIZE;
+	std::fill(buffer.depth.begin() + y_begin * buffer.width, buffer.depth.begin() + y_end * buffer.width, 1.0f);
+
+	for (size_t i = 0; i + 2 < occluders.indices.size(); i += 3) {
+		const glm::vec4 &v0 = buffer.screen[occluders.indices[i + 0]];
+		const glm::vec4 &v1 = buffer.screen[occluders.indices[i + 1]];
+		const glm::vec4 &v2 = buffer.screen[occluders.indices[i + 2]];
+		// Skipping occluders is always safe, so we don't clip triangles crossing the camera plane
+		if (v0.w < OCCLUSION_NEAR_W || v1.w < OCCLUSION_NEAR_W || v2.w < OCCLUSION_NEAR_W)
+			continue;
+		rasterize_triangle(buffer, v0, v1, v2, y_begin, y_end);
+	}
+
+	for (uint32_t ty = first_row; ty < end_row; ++ty) {
+		for (uint32_t tx = 0; tx < buffer.tiles_x; ++tx) {
+			float farthest = 0.0f;
+			for (uint32_t y = ty * OCCLUSION_TILE_SIZE; y < (ty + 1) * OCCLUSION_TILE_SIZE; ++y)
+				for (uint32_t x = tx * OCCLUSION_TILE_SIZE; x < (tx + 1) * OCCLUSION_TILE_SIZE; ++x)
+					farthest = std::max(farthest, buffer.depth[y * buffer.width + x]);
+			buffer.tile_farthest[ty * buffer.tiles_x + tx] = farthest;
+		}
+	}
+}
+
+
+bool is_sphere_occluded(const OcclusionBuffer &buffer, const glm::mat4 &clip_from_world, const glm::vec4 &sphere)
+{
+	// Project corners of the box around the sphere
+	glm::vec3 lo(1.0e30f), hi(-1.0e30f);
+	for (int i = 0; i < 8; ++i) {
+		const glm::vec3 corner = glm::vec3(sphere) + sphere.w * glm::vec3((i & 1) ? 1.0f : -1.0f, (i & 2) ? 1.0f : -1.0f, (i & 4) ? 1.0f : -1.0f);
+		const glm::vec4 clip = clip_from_world * glm::vec4(corner, 1.0f);
+		if (clip.w < OCCLUSION_NEAR_W)
+			return false;
+		const glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		lo = glm::min(lo, ndc);
+		hi = glm::max(hi, ndc);
+	}
+	const float nearest = 0.5f * lo.z + 0.5f;
+	if (nearest <= 0.0f)
+		return false;
+
+	// Pixels overlapping the projected box (those outside of the buffer were culled by the frustum already)
+	const int x0 = std::max(0, (int)floorf(0.5f * (lo.x + 1.0f) * buffer.width));
+	const int x1 = std::min((int)buffer.width - 1, (int)floorf(0.5f * (hi.x + 1.0f) * buffer.width));
+	const int y0 = std::max(0, (int)floorf(0.5f * (lo.y + 1.0f) * buffer.height));
+	const int y1 = std::min((int)buffer.height - 1, (int)floorf(0.5f * (hi.y + 1.0f) * buffer.height));
+	if (x0 > x1 || y0 > y1)
+		return false;
+
+	for (int ty = y0 / (int)OCCLUSION_TILE_SIZE; ty <= y1 / (int)OCCLUSION_TILE_SIZE; ++ty) {
+		for (int tx = x0 / (int)OCCLUSION_TILE_SIZE; tx <= x1 / (int)OCCLUSION_TILE_SIZE; ++tx) {
+			if (buffer.tile_farthest[ty * buffer.tiles_x + tx] < nearest)
+				continue; // The whole tile is in front of the sphere
+
+			const int px0 = std::max(x0, tx * (int)OCCLUSION_TILE_SIZE);
+			const int px1 = std::min(x1, (tx + 1) * (int)OCCLUSION_TILE_SIZE - 1);
+			const int py0 = std::max(y0, ty * (int)OCCLUSION_TILE_SIZE);
+			const int py1 = std::min(y1, (ty + 1) * (int)OCCLUSION_TILE_SIZE - 1);
+			for (int y = py0; y <= py1; ++y)
+				for (int x = px0; x <= px1; ++x)
+					if (buffer.depth[y * buffer.width + x] >= nearest)
+						return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,202 @@
+#include "profiler.h"
+#if defined(ENABLE_PROFILER)
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <GL/glew.h>
+
+
+//! Single zone kept in the ring buffer.
+//! Writers publish the slot by storing its index + 1 into `sequence` (seqlock style),
+//! so readers can detect slots which are being overwritten and skip them.
+struct ProfileEvent {
+	std::atomic<uint64_t> sequence;
+	const char *name;
+	uint64_t start_ns, end_ns;
+	uint32_t thread_id; //!< GPU_THREAD_ID for GPU zones
+};
+
+static const uint64_t RING_SIZE = 1 << 16; // Has to be a power of two
+static const int MAX_GPU_ZONES = 64;
+
+//! GPU zones of a single frame, measured with pairs of GL_TIMESTAMP queries.
+struct GpuFrame {
+	GLuint queries[2 * MAX_GPU_ZONES];
+	const char *names[MAX_GPU_ZONES];
+	int count;
+};
+
+static const uint32_t GPU_THREAD_ID = 0;
+static ProfileEvent ring[RING_SIZE];
+static std::atomic<uint64_t> ring_head(0);
+static std::atomic<uint32_t> next_thread_id(1);
+static uint64_t start_time;
+static GpuFrame gpu_frames[2]; // Results are read two frames later, so we (almost) never stall
+static int gpu_frame_idx;
+static bool gpu_zone_open;
+static int64_t gpu_to_cpu_ns; //!< Offset between GL_TIMESTAMP and profiler_now()
+
+
+static
+uint32_t current_thread_id()
+{
+	static thread_local uint32_t thread_id = next_thread_id++;
+	return thread_id;
+}
+
+
+static
+void push_event(const char *name, uint64_t start_ns, uint64_t end_ns, uint32_t thread_id)
+{
+	const uint64_t idx = ring_head.fetch_add(1, std::memory_order_relaxed);
+	ProfileEvent &evt = ring[idx & (RING_SIZE - 1)];
+	evt.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	evt.name = name;
+	evt.start_ns = start_ns;
+	evt.end_ns = end_ns;
+	evt.thread_id = thread_id;
+	evt.sequence.store(idx + 1, std::memory_order_release);
+}
+
+
+//! Copy the event with given index out of the ring buffer.
+//! @returns False, if the slot has been overwritten (or is being written) in the meantime.
+static
+bool read_event(uint64_t idx, ProfileEvent &out)
+{
+	const ProfileEvent &evt = ring[idx & (RING_SIZE - 1)];
+	if (idx + 1 != evt.sequence.load(std::memory_order_acquire))
+		return false;
+	out.name = evt.name;
+	out.start_ns = evt.start_ns;
+	out.end_ns = evt.end_ns;
+	out.thread_id = evt.thread_id;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return idx + 1 == evt.sequence.load(std::memory_order_relaxed);
+}
+
+
+uint64_t profiler_now()
+{
+	using namespace std::chrono;
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+
+void profiler_record(const char *name, uint64_t start_ns, uint64_t end_ns)
+{
+	push_event(name, start_ns, end_ns, current_thread_id());
+}
+
+
+void profiler_init()
+{
+	start_time = profiler_now();
+	for (GpuFrame &frame : gpu_frames) {
+		glGenQueries(2 * MAX_GPU_ZONES, frame.queries);
+		frame.count = 0;
+	}
+
+	GLint64 gpu_time = 0;
+	glGetInteger64v(GL_TIMESTAMP, &gpu_time);
+	gpu_to_cpu_ns = (int64_t)profiler_now() - gpu_time;
+}
+
+
+void profiler_shutdown()
+{
+	for (GpuFrame &frame : gpu_frames)
+		glDeleteQueries(2 * MAX_GPU_ZONES, frame.queries);
+}
+
+
+void profiler_frame()
+{
+	// Resolve GPU zones recorded two frames ago and reuse their queries
+	gpu_frame_idx ^= 1;
+	GpuFrame &frame = gpu_frames[gpu_frame_idx];
+	for (int i = 0; i < frame.count; ++i) {
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(frame.queries[2 * i + 0], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(frame.queries[2 * i + 1], GL_QUERY_RESULT, &end);
+		push_event(frame.names[i], begin + gpu_to_cpu_ns, end + gpu_to_cpu_ns, GPU_THREAD_ID);
+	}
+	frame.count = 0;
+	gpu_zone_open = false;
+}
+
+
+void profiler_gpu_begin(const char *name)
+{
+	GpuFrame &frame = gpu_frames[gpu_frame_idx];
+	if (gpu_zone_open || MAX_GPU_ZONES == frame.count)
+		return;
+	glQueryCounter(frame.queries[2 * frame.count], GL_TIMESTAMP);
+	frame.names[frame.count] = name;
+	gpu_zone_open = true;
+}
+
+
+void profiler_gpu_end()
+{
+	GpuFrame &frame = gpu_frames[gpu_frame_idx];
+	if (!gpu_zone_open)
+		return;
+	glQueryCounter(frame.queries[2 * frame.count + 1], GL_TIMESTAMP);
+	++frame.count;
+	gpu_zone_open = false;
+}
+
+
+bool profiler_zone_stats(const char *name, ProfileStats &stats)
+{
+	const bool gpu = (0 == strncmp(name, "gpu:", 4));
+	if (gpu)
+		name += 4;
+
+	memset(&stats, 0, sizeof(ProfileStats));
+	double sum = 0.0;
+	const uint64_t head = ring_head.load(std::memory_order_acquire);
+	for (uint64_t idx = (head > RING_SIZE) ? head - RING_SIZE : 0; idx < head; ++idx) {
+		ProfileEvent evt;
+		if (!read_event(idx, evt) || gpu != (GPU_THREAD_ID == evt.thread_id) || 0 != strcmp(name, evt.name))
+			continue;
+
+		const double us = (evt.end_ns - evt.start_ns) / 1000.0;
+		const int bucket = (us < 1.0) ? 0 : 1 + (int)log2(us);
+		stats.histogram[(bucket < PROFILER_HISTOGRAM_BUCKETS) ? bucket : PROFILER_HISTOGRAM_BUCKETS - 1]++;
+		stats.min_us = (0 == stats.count || us < stats.min_us) ? us : stats.min_us;
+		stats.max_us = (us > stats.max_us) ? us : stats.max_us;
+		sum += us;
+		++stats.count;
+	}
+	stats.mean_us = stats.count ? sum / stats.count : 0.0;
+	return 0 < stats.count;
+}
+
+
+bool profiler_write_trace(const char *filename)
+{
+	FILE *out = fopen(filename, "w");
+	if (!out)
+		return false;
+
+	fprintf(out, "{\"traceEvents\":[\n");
+	fprintf(out, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", GPU_THREAD_ID);
+	const uint64_t head = ring_head.load(std::memory_order_acquire);
+	for (uint64_t idx = (head > RING_SIZE) ? head - RING_SIZE : 0; idx < head; ++idx) {
+		ProfileEvent evt;
+		if (!read_event(idx, evt) || evt.start_ns < start_time)
+			continue;
+		fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+			evt.name, evt.thread_id, (evt.start_ns - start_time) / 1000.0, (evt.end_ns - evt.start_ns) / 1000.0);
+	}
+	fprintf(out, "\n]}\n");
+	fclose(out);
+	return true;
+}
+
+#endif
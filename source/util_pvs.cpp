@@ -0,0 +1,61 @@
+#include "pvs.h"
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+
+uint32_t find_pvs_cell(const PotentiallyVisibleSets &pvs, const glm::vec3 &position)
+{
+	if (pvs.layers.size() < 2 || position.z < pvs.layers.front() || position.z >= pvs.layers.back())
+		return PVS_NO_CELL;
+
+	const float fx = floorf((position.x - pvs.origin.x) / pvs.cell_size);
+	const float fy = floorf((position.y - pvs.origin.y) / pvs.cell_size);
+	if (fx < 0.0f || fy < 0.0f || fx >= (float)pvs.cells_x || fy >= (float)pvs.cells_y)
+		return PVS_NO_CELL;
+
+	// The first layer whose top is above the position
+	const uint32_t layer = (uint32_t)(std::upper_bound(pvs.layers.begin() + 1, pvs.layers.end(), position.z) - (pvs.layers.begin() + 1));
+	return (layer * pvs.cells_y + (uint32_t)fy) * pvs.cells_x + (uint32_t)fx;
+}
+
+
+void get_pvs_cell_bounds(const PotentiallyVisibleSets &pvs, uint32_t cell, glm::vec3 &lo, glm::vec3 &hi)
+{
+	const uint32_t x = cell % pvs.cells_x;
+	const uint32_t y = (cell / pvs.cells_x) % pvs.cells_y;
+	const uint32_t layer = cell / (pvs.cells_x * pvs.cells_y);
+	lo = glm::vec3(pvs.origin + pvs.cell_size * glm::vec2(x, y), pvs.layers[layer]);
+	hi = glm::vec3(glm::vec2(lo) + glm::vec2(pvs.cell_size), pvs.layers[layer + 1]);
+}
+
+
+void encode_pvs_runs(const uint8_t *visible, uint32_t count, std::vector<uint16_t> &runs)
+{
+	bool run_visible = false;
+	uint32_t i = 0;
+	while (i < count) {
+		uint32_t length = 0;
+		while (i + length < count && length < 0xFFFF && (0 != visible[i + length]) == run_visible)
+			++length;
+		runs.push_back((uint16_t)length);
+		run_visible = !run_visible;
+		i += length;
+	}
+}
+
+
+void decode_pvs_cell(const PotentiallyVisibleSets &pvs, uint32_t cell, uint8_t *visible)
+{
+	// Instances past the last run are hidden
+	memset(visible, 0, pvs.num_instances);
+	bool run_visible = false;
+	uint32_t i = 0;
+	for (uint32_t r = pvs.cell_runs[cell]; r < pvs.cell_runs[cell + 1]; ++r) {
+		const uint32_t end = std::min(i + pvs.runs[r], pvs.num_instances);
+		if (run_visible)
+			memset(visible + i, 1, end - i);
+		run_visible = !run_visible;
+		i = end;
+	}
+}
@@ -0,0 +1,217 @@
+#include "simplify.h"
+#include <string.h>
+#include <algorithm>
+
+
+//! Sum of squared distances from a set of weighted planes (symmetric 4x4 matrix and total weight).
+struct Quadric {
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c;
+	double weight;
+};
+
+
+static
+void add_plane(Quadric &q, const glm::dvec3 &n, double d, double weight)
+{
+	q.a00 += weight * n.x * n.x;
+	q.a01 += weight * n.x * n.y;
+	q.a02 += weight * n.x * n.z;
+	q.a11 += weight * n.y * n.y;
+	q.a12 += weight * n.y * n.z;
+	q.a22 += weight * n.z * n.z;
+	q.b0 += weight * n.x * d;
+	q.b1 += weight * n.y * d;
+	q.b2 += weight * n.z * d;
+	q.c += weight * d * d;
+	q.weight += weight;
+}
+
+
+static
+void add_quadric(Quadric &q, const Quadric &r)
+{
+	q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02;
+	q.a11 += r.a11; q.a12 += r.a12; q.a22 += r.a22;
+	q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+	q.c += r.c;
+	q.weight += r.weight;
+}
+
+
+//! @returns Mean squared distance of the point from planes of the quadric.
+static
+double evaluate_quadric(const Quadric &q, const glm::vec3 &p)
+{
+	const double x = p.x, y = p.y, z = p.z;
+	const double error = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+		+ 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+		+ 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z)
+		+ q.c;
+	return (q.weight > 0.0) ? std::max(error / q.weight, 0.0) : 0.0;
+}
+
+
+//! Squared error of moving vertex `from` onto vertex `to` (its triangles take over attributes of `to`).
+static
+float get_collapse_cost(const SimplifyMesh &mesh, const std::vector<Quadric> &quadrics, uint32_t from, uint32_t to)
+{
+	Quadric q = quadrics[from];
+	add_quadric(q, quadrics[to]);
+	const glm::vec4 uv = mesh.uvs[from] - mesh.uvs[to];
+	const glm::vec4 color = (glm::vec4(mesh.colors[from]) - glm::vec4(mesh.colors[to])) / 255.0f;
+	const float attributes = mesh.attribute_scale * mesh.attribute_scale * (glm::dot(uv, uv) + glm::dot(color, color));
+	return (float)evaluate_quadric(q, mesh.positions[to]) + attributes;
+}
+
+
+float simplify_triangles(const SimplifyMesh &mesh, std::vector<uint32_t> &triangles, uint32_t target_triangles, float max_error)
+{
+	const uint32_t num_vertices = mesh.num_vertices;
+	std::vector<uint8_t> locked(num_vertices, 0);
+
+	// Vertices sharing their position with another one are on UV or color seams
+	std::vector<uint32_t> order(triangles);
+	std::sort(order.begin(), order.end());
+	order.erase(std::unique(order.begin(), order.end()), order.end());
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		const glm::vec3 &pa = mesh.positions[a], &pb = mesh.positions[b];
+		return (pa.x != pb.x) ? pa.x < pb.x : (pa.y != pb.y) ? pa.y < pb.y : pa.z < pb.z;
+	});
+	for (size_t i = 1; i < order.size(); ++i) {
+		if (mesh.positions[order[i - 1]] == mesh.positions[order[i]])
+			locked[order[i - 1]] = locked[order[i]] = 1;
+	}
+
+	// Edges not shared by exactly two triangles are on the border (or of the material split, or non-manifold)
+	std::vector<uint64_t> edges;
+	edges.reserve(triangles.size());
+	for (size_t t = 0; t < triangles.size(); t += 3) {
+		for (int e = 0; e < 3; ++e) {
+			const uint32_t a = triangles[t + e], b = triangles[t + (e + 1) % 3];
+			edges.push_back(((uint64_t)std::min(a, b) << 32) | std::max(a, b));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size();) {
+		size_t end = i + 1;
+		while (end < edges.size() && edges[end] == edges[i])
+			++end;
+		if (2 != end - i)
+			locked[edges[i] >> 32] = locked[edges[i] & 0xFFFFFFFF] = 1;
+		i = end;
+	}
+
+	// Every vertex measures distances from planes of its triangles (weighted by their area)
+	std::vector<Quadric> quadrics(num_vertices);
+	memset(quadrics.data(), 0, sizeof(Quadric) * num_vertices);
+	for (size_t t = 0; t < triangles.size(); t += 3) {
+		const glm::dvec3 p0(mesh.positions[triangles[t]]), p1(mesh.positions[triangles[t + 1]]), p2(mesh.positions[triangles[t + 2]]);
+		const glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		const double length = glm::length(normal);
+		if (0.0 == length)
+			continue;
+		for (int i = 0; i < 3; ++i)
+			add_plane(quadrics[triangles[t + i]], normal / length, -glm::dot(normal / length, p0), 0.5 * length);
+	}
+
+	struct Collapse {
+		float cost;
+		uint32_t from, to;
+	};
+	std::vector<Collapse> collapses;
+	std::vector<uint32_t> adjacency_offsets(num_vertices + 1), adjacency;
+	std::vector<uint32_t> remap(num_vertices);
+	std::vector<uint8_t> touched(num_vertices);
+	const float max_cost = max_error * max_error;
+	float worst_cost = 0.0f;
+	uint32_t num_triangles = triangles.size() / 3;
+
+	// Every pass collapses the cheapest edges, which don't share triangles with each other
+	while (num_triangles > target_triangles) {
+		std::fill(adjacency_offsets.begin(), adjacency_offsets.end(), 0);
+		for (uint32_t v : triangles)
+			++adjacency_offsets[v + 1];
+		for (uint32_t v = 0; v < num_vertices; ++v)
+			adjacency_offsets[v + 1] += adjacency_offsets[v];
+		adjacency.resize(triangles.size());
+		std::vector<uint32_t> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (size_t i = 0; i < triangles.size(); ++i)
+			adjacency[fill[triangles[i]]++] = i / 3;
+
+		// Interior edges are visited once (from the triangle, which has them in ascending order)
+		collapses.clear();
+		for (size_t t = 0; t < triangles.size(); t += 3) {
+			for (int e = 0; e < 3; ++e) {
+				const uint32_t a = triangles[t + e], b = triangles[t + (e + 1) % 3];
+				if (a > b || (locked[a] && locked[b]))
+					continue;
+				const float cost_ab = locked[a] ? 1.0e30f : get_collapse_cost(mesh, quadrics, a, b);
+				const float cost_ba = locked[b] ? 1.0e30f : get_collapse_cost(mesh, quadrics, b, a);
+				const Collapse collapse = { std::min(cost_ab, cost_ba), (cost_ab <= cost_ba) ? a : b, (cost_ab <= cost_ba) ? b : a };
+				if (collapse.cost <= max_cost)
+					collapses.push_back(collapse);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+		for (uint32_t v = 0; v < num_vertices; ++v)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+		uint32_t num_collapses = 0;
+		for (const Collapse &collapse : collapses) {
+			if (num_triangles <= target_triangles)
+				break;
+			if (touched[collapse.from] || touched[collapse.to])
+				continue;
+
+			// Remaining triangles around the moved vertex must not flip (or become degenerate)
+			bool flips = false;
+			uint32_t removed = 0;
+			for (uint32_t i = adjacency_offsets[collapse.from]; i < adjacency_offsets[collapse.from + 1] && !flips; ++i) {
+				const uint32_t *tri = &triangles[3 * adjacency[i]];
+				if (tri[0] == collapse.to || tri[1] == collapse.to || tri[2] == collapse.to) {
+					++removed;
+					continue;
+				}
+				glm::vec3 p[3], q[3];
+				for (int k = 0; k < 3; ++k) {
+					p[k] = mesh.positions[tri[k]];
+					q[k] = mesh.positions[(tri[k] == collapse.from) ? collapse.to : tri[k]];
+				}
+				const glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+				const glm::vec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+				flips = glm::dot(before, after) <= 0.25f * glm::length(before) * glm::length(after);
+			}
+			if (flips)
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			add_quadric(quadrics[collapse.to], quadrics[collapse.from]);
+			for (uint32_t i = adjacency_offsets[collapse.from]; i < adjacency_offsets[collapse.from + 1]; ++i) {
+				const uint32_t *tri = &triangles[3 * adjacency[i]];
+				touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+			}
+			num_triangles -= std::min(removed, num_triangles);
+			worst_cost = std::max(worst_cost, collapse.cost);
+			++num_collapses;
+		}
+		if (0 == num_collapses)
+			break;
+
+		// Drop triangles, which lost their area
+		size_t write = 0;
+		for (size_t t = 0; t < triangles.size(); t += 3) {
+			const uint32_t a = remap[triangles[t]], b = remap[triangles[t + 1]], c = remap[triangles[t + 2]];
+			if (a == b || b == c || a == c)
+				continue;
+			triangles[write++] = a;
+			triangles[write++] = b;
+			triangles[write++] = c;
+		}
+		triangles.resize(write);
+		num_triangles = triangles.size() / 3;
+	}
+	return sqrtf(worst_cost);
+}
@@ -0,0 +1,80 @@
+#include "sort.h"
+#include "jobs.h"
+#include <algorithm>
+
+
+void radix_sort(uint32_t *keys, uint32_t *values, uint32_t count, RadixSortScratch &scratch)
+{
+	if (count < 2)
+		return;
+	const uint32_t num_chunks = (count + RADIX_SORT_CHUNK - 1) / RADIX_SORT_CHUNK;
+	const bool parallel = count >= RADIX_SORT_MIN_PARALLEL;
+	scratch.keys.resize(count);
+	scratch.values.resize(count);
+	scratch.offsets.resize(num_chunks * RADIX_SORT_BUCKETS);
+	uint32_t *offsets = scratch.offsets.data();
+
+	uint32_t *src_keys = keys, *src_values = values;
+	uint32_t *dst_keys = scratch.keys.data(), *dst_values = scratch.values.data();
+	for (uint32_t shift = 0; shift < 32; shift += RADIX_SORT_BITS) {
+		// Every chunk counts its own digits, so the jobs never share a histogram
+		auto histogram = [&](uint32_t begin, uint32_t end) {
+			for (uint32_t c = begin; c < end; ++c) {
+				uint32_t *counts = offsets + c * RADIX_SORT_BUCKETS;
+				memset(counts, 0, sizeof(uint32_t) * RADIX_SORT_BUCKETS);
+				const uint32_t last = std::min(count, (c + 1) * RADIX_SORT_CHUNK);
+				for (uint32_t i = c * RADIX_SORT_CHUNK; i < last; ++i)
+					++counts[(src_keys[i] >> shift) & (RADIX_SORT_BUCKETS - 1)];
+			}
+		};
+		if (parallel)
+			parallel_for(num_chunks, 1, histogram);
+		else
+			histogram(0, num_chunks);
+
+		// Digits shared by all keys (e.g. the sign and exponent of similar depths) don't reorder anything
+		bool uniform = false;
+		for (uint32_t b = 0; b < RADIX_SORT_BUCKETS && !uniform; ++b) {
+			uint32_t total = 0;
+			for (uint32_t c = 0; c < num_chunks; ++c)
+				total += offsets[c * RADIX_SORT_BUCKETS + b];
+			uniform = (total == count);
+		}
+		if (uniform)
+			continue;
+
+		// Exclusive prefix sum over buckets, then chunks, keeps the sort stable
+		uint32_t sum = 0;
+		for (uint32_t b = 0; b < RADIX_SORT_BUCKETS; ++b) {
+			for (uint32_t c = 0; c < num_chunks; ++c) {
+				const uint32_t n = offsets[c * RADIX_SORT_BUCKETS + b];
+				offsets[c * RADIX_SORT_BUCKETS + b] = sum;
+				sum += n;
+			}
+		}
+
+		auto scatter = [&](uint32_t begin, uint32_t end) {
+			for (uint32_t c = begin; c < end; ++c) {
+				uint32_t *next = offsets + c * RADIX_SORT_BUCKETS;
+				const uint32_t last = std::min(count, (c + 1) * RADIX_SORT_CHUNK);
+				for (uint32_t i = c * RADIX_SORT_CHUNK; i < last; ++i) {
+					const uint32_t slot = next[(src_keys[i] >> shift) & (RADIX_SORT_BUCKETS - 1)]++;
+					dst_keys[slot] = src_keys[i];
+					dst_values[slot] = src_values[i];
+				}
+			}
+		};
+		if (parallel)
+			parallel_for(num_chunks, 1, scatter);
+		else
+			scatter(0, num_chunks);
+		std::swap(src_keys, dst_keys);
+		std::swap(src_values, dst_values);
+	}
+
+	// Skipped passes may leave the result in the scratch buffers
+	if (src_keys != keys) {
+		memcpy(keys, src_keys, sizeof(uint32_t) * count);
+		memcpy(values, src_values, sizeof(uint32_t) * count);
+	}
+}
@@ -0,0 +1,92 @@
+#include "stream.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+
+bool create_stream_buffer(StreamBuffer &stream, GLsizeiptr region_size, GLsizeiptr alignment, bool persistent)
+{
+	stream.alignment = std::max(alignment, (GLsizeiptr)1);
+	stream.region_size = (region_size + stream.alignment - 1) / stream.alignment * stream.alignment;
+	stream.used = 0;
+	stream.region = STREAM_FRAMES - 1; // The first frame starts from the first region
+	memset(stream.fences, 0, sizeof(stream.fences));
+	memset(&stream.stats, 0, sizeof(stream.stats));
+
+	// Streamed data is bound to various targets, so it doesn't disturb any of them
+	const GLsizeiptr size = STREAM_FRAMES * stream.region_size;
+	glGenBuffers(1, &stream.buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+	if (persistent) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+		stream.mapped = (uint8_t *)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		return NULL != stream.mapped;
+	}
+	glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+	stream.mapped = NULL;
+	stream.staging.resize(stream.region_size);
+	return true;
+}
+
+
+void destroy_stream_buffer(StreamBuffer &stream)
+{
+	for (GLsync &fence : stream.fences) {
+		if (fence)
+			glDeleteSync(fence);
+		fence = NULL;
+	}
+	glDeleteBuffers(1, &stream.buffer); // Unmaps it as well
+	stream.buffer = 0;
+	stream.mapped = NULL;
+}
+
+
+void begin_stream_frame(StreamBuffer &stream)
+{
+	stream.region = (stream.region + 1) % STREAM_FRAMES;
+	GLsync &fence = stream.fences[stream.region];
+	if (fence) {
+		// Polling first tells apart frames, which really had to wait
+		if (GL_TIMEOUT_EXPIRED == glClientWaitSync(fence, 0, 0)) {
+			const auto start = std::chrono::steady_clock::now();
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+			++stream.stats.stalls;
+			stream.stats.stall_ms += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		glDeleteSync(fence);
+		fence = NULL;
+	}
+	stream.used = 0;
+	++stream.stats.frames;
+}
+
+
+void *stream_alloc(StreamBuffer &stream, GLsizeiptr size, GLintptr *offset)
+{
+	const GLsizeiptr start = (stream.used + stream.alignment - 1) / stream.alignment * stream.alignment;
+	if (start + size > stream.region_size) {
+		++stream.stats.overflows;
+		return NULL;
+	}
+	stream.used = start + size;
+	*offset = stream.region * stream.region_size + start;
+	return stream.mapped ? stream.mapped + *offset : stream.staging.data() + start;
+}
+
+
+void stream_flush(StreamBuffer &stream)
+{
+	if (stream.mapped || 0 == stream.used)
+		return;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stream.buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, stream.region * stream.region_size, stream.used, stream.staging.data());
+}
+
+
+void end_stream_frame(StreamBuffer &stream)
+{
+	stream.stats.peak_bytes = std::max(stream.stats.peak_bytes, stream.used);
+	stream.fences[stream.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}